@@ -0,0 +1,570 @@
+// 微基准：内存池（无锁 / 加锁两种中心缓存、按页分片的前端）和 glibc malloc 在同样的负载下比一比
+//
+//   ./Benchmark [--allocators pool,pool-locked,pagelocal,glibc] [--sizes 16,64-256,1024-8192] [--threads 1,2,4]
+//               [--patterns pair,batch,random,chase] [--ops 1000000] [--live 1024]
+//               [--label <比如 git 提交号>] [--csv out.csv] [--json out.json]
+//
+// 每一组 分配器 x 大小范围 x 线程数 x 模式 报告：
+//   吞吐（每秒多少百万次操作，一次分配或一次释放算一次操作）
+//   单次分配、单次释放的延迟 p50 / p99 / p999（每次操作前后读 rdtsc，记进对数分桶的直方图，按校准出来的频率换算成纳秒）
+//     读 rdtsc 本身也要花时间（虚拟机里可能要几十个周期），延迟里包括这一部分，几种分配器之间比较的是差值
+//   峰值 RSS，包括事先生成好的操作序列，几种分配器一样多
+// 每一组都在 fork 出来的子进程里跑：几种分配器互不影响，峰值 RSS 也只算这一组自己的
+// 计时的循环里只有分配和释放本身：每次的大小、random 模式里操作哪个槽都是事先生成好的
+//
+// 默认不跑 pagelocal 和 chase，要比的时候在参数里列出来
+//
+// 四种模式：
+//   pair：分配一块马上释放
+//   batch：连着分配 live 块，再按分配的顺序全部释放
+//   random：live 个槽，每次随机挑一个，空的就分配、有的就释放，存活对象的数目在 live / 2 上下
+//   chase：先分配 2 * live 块，按随机的顺序释放其中一半，把自由链表打乱；再连着分配 live 个节点串成链表，
+//     从头到尾走 ops / live 遍（至少一遍）。吞吐只算遍历：每秒走了多少百万个节点，看的是分配出来的节点挨得近不近；
+//     延迟照常记分配和释放的。live 要比缓存大才看得出差别，比如 --live 200000
+#include "MemoryPool.h"
+#include "PageLocalCache.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+    // 时间戳：x86 上直接读 TSC，其他平台退回 steady_clock 的纳秒
+    inline uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // 每纳秒多少个 tick：和 steady_clock 对比 100 毫秒
+    double calibrateTicksPerNs()
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t t0 = ticks();
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(100)) {}
+        uint64_t t1 = ticks();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        return (t1 - t0) / ns;
+    }
+
+    // 延迟直方图：16 以内每个值一档，再往上每翻一倍分 16 档，相对误差不超过 1/16
+    class Histogram
+    {
+    public:
+        void add(uint64_t value) { ++counts_[bucketOf(value)]; }
+
+        void merge(const Histogram& other)
+        {
+            for (size_t i = 0; i < kBuckets; ++i) counts_[i] += other.counts_[i];
+        }
+
+        // 第 q 分位落在的那一档的中点
+        double percentile(double q) const
+        {
+            uint64_t total = 0;
+            for (uint64_t c : counts_) total += c;
+            if (total == 0) return 0;
+            uint64_t target = static_cast<uint64_t>(q * total);
+            if (target >= total) target = total - 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < kBuckets; ++i)
+            {
+                seen += counts_[i];
+                if (seen > target) return lowerBound(i) + (lowerBound(i + 1) - lowerBound(i)) / 2.0;
+            }
+            return lowerBound(kBuckets - 1);
+        }
+
+    private:
+        static constexpr int kSubBits = 4;
+        static constexpr uint64_t kSub = uint64_t(1) << kSubBits;
+        static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSub;
+
+        static size_t bucketOf(uint64_t value)
+        {
+            if (value < kSub) return value;
+            int shift = 63 - __builtin_clzll(value) - kSubBits;
+            return ((shift + 1) << kSubBits) + ((value >> shift) & (kSub - 1));
+        }
+
+        static double lowerBound(size_t bucket)
+        {
+            if (bucket < kSub) return static_cast<double>(bucket);
+            int shift = static_cast<int>(bucket >> kSubBits) - 1;
+            return std::ldexp(static_cast<double>(kSub + (bucket & (kSub - 1))), shift);
+        }
+
+        std::array<uint64_t, kBuckets> counts_{};
+    };
+
+    using LockedMemoryPool = BasicMemoryPool<PoolPolicy<LockedCentralCache>>;
+
+    struct PoolAllocator
+    {
+        static void* allocate(size_t size) { return MemoryPool::allocate(size); }
+        static void deallocate(void* ptr, size_t size) { MemoryPool::deallocate(ptr, size); }
+    };
+
+    struct LockedPoolAllocator
+    {
+        static void* allocate(size_t size) { return LockedMemoryPool::allocate(size); }
+        static void deallocate(void* ptr, size_t size) { LockedMemoryPool::deallocate(ptr, size); }
+    };
+
+    // 按页分片的前端（见 PageLocalCache.h），小块不能混着从 MemoryPool 释放，所以只在这里单独比
+    struct PageLocalAllocator
+    {
+        static void* allocate(size_t size) { return PageLocalCache::allocate(size); }
+        static void deallocate(void* ptr, size_t size) { PageLocalCache::deallocate(ptr, size); }
+    };
+
+    // 这个程序没有 LD_PRELOAD 内存池的话，malloc 就是 glibc 的
+    struct GlibcAllocator
+    {
+        static void* allocate(size_t size) { return std::malloc(size); }
+        static void deallocate(void* ptr, size_t) { std::free(ptr); }
+    };
+
+    enum class Pattern { Pair, Batch, Random, Chase };
+
+    const char* patternName(Pattern pattern)
+    {
+        switch (pattern)
+        {
+        case Pattern::Pair: return "pair";
+        case Pattern::Batch: return "batch";
+        case Pattern::Random: return "random";
+        default: return "chase";
+        }
+    }
+
+    struct Config
+    {
+        std::string allocator;
+        Pattern pattern;
+        size_t minSize;
+        size_t maxSize;
+        size_t threads;
+        size_t ops;  // 每个线程的分配次数
+        size_t live; // batch 模式一批多少块、random 模式多少个槽、chase 模式链表多长
+    };
+
+    // 子进程通过管道原样传回来，只能有平凡类型
+    struct Result
+    {
+        bool ok;
+        double seconds;
+        uint64_t operations; // 分配 + 释放
+        double allocP50, allocP99, allocP999;
+        double freeP50, freeP99, freeP999;
+        long peakRssKb;
+    };
+
+    // 一个线程要做的事，计时之前全部生成好
+    struct Script
+    {
+        std::vector<uint32_t> sizes; // 第 i 次分配的大小
+        std::vector<uint32_t> slots; // random 模式：第 i 次操作哪个槽；chase 模式：按什么顺序释放
+    };
+
+    Script makeScript(const Config& config, unsigned seed)
+    {
+        Script script;
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<size_t> size(config.minSize, config.maxSize);
+        std::uniform_int_distribution<size_t> slot(0, config.live - 1);
+        script.sizes.resize(config.pattern == Pattern::Chase ? config.live * 3 : config.ops);
+        for (auto& s : script.sizes) s = static_cast<uint32_t>(size(gen));
+        if (config.pattern == Pattern::Random)
+        {
+            // random 模式一半是释放，要操作两倍的次数才有 ops 次分配
+            script.slots.resize(config.ops * 2);
+            for (auto& s : script.slots) s = static_cast<uint32_t>(slot(gen));
+        }
+        else if (config.pattern == Pattern::Chase)
+        {
+            // 2 * live 块里释放前一半下标
+            script.slots.resize(config.live * 2);
+            for (size_t i = 0; i < script.slots.size(); ++i) script.slots[i] = static_cast<uint32_t>(i);
+            std::shuffle(script.slots.begin(), script.slots.end(), gen);
+            script.slots.resize(config.live);
+        }
+        return script;
+    }
+
+    template <class Alloc>
+    void runScript(const Config& config, const Script& script, Histogram& allocHist, Histogram& freeHist, uint64_t& operations,
+        uint64_t& chaseTicks)
+    {
+        auto timedAllocate = [&](size_t size) {
+            uint64_t t0 = ticks();
+            void* ptr = Alloc::allocate(size);
+            uint64_t t1 = ticks();
+            allocHist.add(t1 - t0);
+            *static_cast<volatile char*>(ptr) = 1; // 碰一下，和真实使用一样把缓存行拿进来
+            return ptr;
+        };
+        auto timedDeallocate = [&](void* ptr, size_t size) {
+            uint64_t t0 = ticks();
+            Alloc::deallocate(ptr, size);
+            uint64_t t1 = ticks();
+            freeHist.add(t1 - t0);
+        };
+
+        switch (config.pattern)
+        {
+        case Pattern::Pair:
+            for (uint32_t size : script.sizes)
+            {
+                timedDeallocate(timedAllocate(size), size);
+            }
+            operations = script.sizes.size() * 2;
+            break;
+
+        case Pattern::Batch:
+        {
+            std::vector<void*> batch(config.live);
+            for (size_t start = 0; start < script.sizes.size(); start += config.live)
+            {
+                size_t n = std::min(config.live, script.sizes.size() - start);
+                for (size_t i = 0; i < n; ++i) batch[i] = timedAllocate(script.sizes[start + i]);
+                for (size_t i = 0; i < n; ++i) timedDeallocate(batch[i], script.sizes[start + i]);
+            }
+            operations = script.sizes.size() * 2;
+            break;
+        }
+
+        case Pattern::Random:
+        {
+            std::vector<std::pair<void*, uint32_t>> slots(config.live, { nullptr, 0 });
+            size_t next = 0;
+            operations = 0;
+            for (uint32_t k : script.slots)
+            {
+                auto& [ptr, size] = slots[k];
+                if (ptr)
+                {
+                    timedDeallocate(ptr, size);
+                    ptr = nullptr;
+                }
+                else
+                {
+                    size = script.sizes[next++ % script.sizes.size()];
+                    ptr = timedAllocate(size);
+                }
+                ++operations;
+            }
+            // 收尾不计时
+            for (auto& [ptr, size] : slots) if (ptr) Alloc::deallocate(ptr, size);
+            break;
+        }
+
+        case Pattern::Chase:
+        {
+            // 每个节点的前 8 字节是指向下一个节点的指针
+            auto nodeSize = [&](size_t i) { return std::max<size_t>(script.sizes[i], sizeof(void*)); };
+            size_t scattered = config.live * 2;
+            std::vector<void*> blocks(scattered);
+            for (size_t i = 0; i < scattered; ++i) blocks[i] = timedAllocate(nodeSize(i));
+            for (uint32_t k : script.slots)
+            {
+                timedDeallocate(blocks[k], nodeSize(k));
+                blocks[k] = nullptr;
+            }
+
+            std::vector<void*> nodes(config.live);
+            for (size_t i = 0; i < config.live; ++i)
+            {
+                nodes[i] = timedAllocate(nodeSize(scattered + i));
+                if (i > 0) *static_cast<void**>(nodes[i - 1]) = nodes[i];
+            }
+            *static_cast<void**>(nodes.back()) = nullptr;
+
+            size_t passes = std::max<size_t>(config.ops / config.live, 1);
+            uint64_t t0 = ticks();
+            for (size_t pass = 0; pass < passes; ++pass)
+            {
+                void* node = nodes.front();
+                while (node) node = *static_cast<void* volatile*>(node);
+            }
+            chaseTicks = ticks() - t0;
+            operations = passes * config.live;
+
+            for (size_t i = 0; i < config.live; ++i) Alloc::deallocate(nodes[i], nodeSize(scattered + i));
+            for (size_t i = 0; i < scattered; ++i) if (blocks[i]) Alloc::deallocate(blocks[i], nodeSize(i));
+            break;
+        }
+        }
+    }
+
+    template <class Alloc>
+    Result runConfig(const Config& config, double ticksPerNs)
+    {
+        std::vector<Script> scripts;
+        for (size_t t = 0; t < config.threads; ++t) scripts.push_back(makeScript(config, static_cast<unsigned>(t + 1)));
+        std::vector<Histogram> allocHists(config.threads), freeHists(config.threads);
+        std::vector<uint64_t> operations(config.threads), chaseTicks(config.threads);
+
+        // 所有线程都就位了再一起开始
+        std::atomic<size_t> ready{ 0 };
+        std::atomic<bool> go{ false };
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < config.threads; ++t)
+        {
+            threads.emplace_back([&, t] {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+                runScript<Alloc>(config, scripts[t], allocHists[t], freeHists[t], operations[t], chaseTicks[t]);
+            });
+        }
+        while (ready.load() < config.threads) std::this_thread::yield();
+        auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& th : threads) th.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Histogram allocHist, freeHist;
+        Result result{};
+        for (size_t t = 0; t < config.threads; ++t)
+        {
+            allocHist.merge(allocHists[t]);
+            freeHist.merge(freeHists[t]);
+            result.operations += operations[t];
+        }
+        result.ok = true;
+        result.seconds = seconds;
+        if (config.pattern == Pattern::Chase)
+        {
+            // 吞吐只算遍历的时间，以最慢的线程为准
+            uint64_t slowest = *std::max_element(chaseTicks.begin(), chaseTicks.end());
+            result.seconds = std::max(slowest / ticksPerNs, 1.0) / 1e9;
+        }
+        result.allocP50 = allocHist.percentile(0.50) / ticksPerNs;
+        result.allocP99 = allocHist.percentile(0.99) / ticksPerNs;
+        result.allocP999 = allocHist.percentile(0.999) / ticksPerNs;
+        result.freeP50 = freeHist.percentile(0.50) / ticksPerNs;
+        result.freeP99 = freeHist.percentile(0.99) / ticksPerNs;
+        result.freeP999 = freeHist.percentile(0.999) / ticksPerNs;
+        return result;
+    }
+
+    Result runInChild(const Config& config, double ticksPerNs)
+    {
+        Result result{};
+        int fds[2];
+        if (pipe(fds) != 0) return result;
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            Result r{};
+            if (config.allocator == "pool") r = runConfig<PoolAllocator>(config, ticksPerNs);
+            else if (config.allocator == "pool-locked") r = runConfig<LockedPoolAllocator>(config, ticksPerNs);
+            else if (config.allocator == "pagelocal") r = runConfig<PageLocalAllocator>(config, ticksPerNs);
+            else if (config.allocator == "glibc") r = runConfig<GlibcAllocator>(config, ticksPerNs);
+
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            r.peakRssKb = usage.ru_maxrss; // Linux 上单位是 KB
+            ssize_t written = write(fds[1], &r, sizeof(r));
+            _exit(written == sizeof(r) ? 0 : 1);
+        }
+
+        close(fds[1]);
+        if (pid > 0)
+        {
+            if (read(fds[0], &result, sizeof(result)) != sizeof(result)) result.ok = false;
+            waitpid(pid, nullptr, 0);
+        }
+        close(fds[0]);
+        return result;
+    }
+
+    std::vector<std::string> split(const std::string& list)
+    {
+        std::vector<std::string> items;
+        size_t start = 0;
+        while (start <= list.size())
+        {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) items.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return items;
+    }
+
+    void usage(const char* argv0)
+    {
+        std::fprintf(stderr,
+            "usage: %s [--allocators pool,pool-locked,pagelocal,glibc] [--sizes 16,64-256,1024-8192] [--threads 1,2,4]\n"
+            "          [--patterns pair,batch,random,chase] [--ops N] [--live N] [--label TEXT] [--csv FILE] [--json FILE]\n",
+            argv0);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> allocators = { "pool", "pool-locked", "glibc" };
+    std::vector<std::pair<size_t, size_t>> sizes = { { 16, 16 }, { 16, 256 }, { 1024, 8192 } };
+    std::vector<size_t> threadCounts = { 1, 2, 4 };
+    std::vector<Pattern> patterns = { Pattern::Pair, Pattern::Batch, Pattern::Random };
+    size_t ops = 1000000;
+    size_t live = 1024;
+    std::string label, csvPath, jsonPath;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--allocators") allocators = split(value);
+        else if (arg == "--sizes")
+        {
+            sizes.clear();
+            for (const std::string& range : split(value))
+            {
+                size_t dash = range.find('-');
+                size_t lo = std::stoul(range.substr(0, dash));
+                size_t hi = dash == std::string::npos ? lo : std::stoul(range.substr(dash + 1));
+                sizes.emplace_back(std::max<size_t>(lo, 1), std::max(lo, hi));
+            }
+        }
+        else if (arg == "--threads")
+        {
+            threadCounts.clear();
+            for (const std::string& t : split(value)) threadCounts.push_back(std::max<size_t>(std::stoul(t), 1));
+        }
+        else if (arg == "--patterns")
+        {
+            patterns.clear();
+            for (const std::string& p : split(value))
+            {
+                if (p == "pair") patterns.push_back(Pattern::Pair);
+                else if (p == "batch") patterns.push_back(Pattern::Batch);
+                else if (p == "random") patterns.push_back(Pattern::Random);
+                else if (p == "chase") patterns.push_back(Pattern::Chase);
+                else
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+        }
+        else if (arg == "--ops") ops = std::max<size_t>(std::stoul(value), 1);
+        else if (arg == "--live") live = std::max<size_t>(std::stoul(value), 1);
+        else if (arg == "--label") label = value;
+        else if (arg == "--csv") csvPath = value;
+        else if (arg == "--json") jsonPath = value;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (const std::string& a : allocators)
+    {
+        if (a != "pool" && a != "pool-locked" && a != "pagelocal" && a != "glibc")
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    double ticksPerNs = calibrateTicksPerNs();
+    std::printf("%-12s %-7s %-12s %4s %10s | %-26s | %-26s | %10s\n",
+        "allocator", "pattern", "size", "thr", "Mops/s", "alloc p50/p99/p999 ns", "free p50/p99/p999 ns", "peak RSS");
+
+    std::string csv = "label,allocator,pattern,min_size,max_size,threads,ops,seconds,mops,"
+        "alloc_p50_ns,alloc_p99_ns,alloc_p999_ns,free_p50_ns,free_p99_ns,free_p999_ns,peak_rss_kb\n";
+    std::string json = "{\"label\":\"" + label + "\",\"ticks_per_ns\":" + std::to_string(ticksPerNs) + ",\"results\":[";
+    bool first = true;
+    bool failed = false;
+
+    for (auto [minSize, maxSize] : sizes)
+    {
+        for (Pattern pattern : patterns)
+        {
+            for (size_t threads : threadCounts)
+            {
+                for (const std::string& allocator : allocators)
+                {
+                    Config config{ allocator, pattern, minSize, maxSize, threads, ops, live };
+                    Result r = runInChild(config, ticksPerNs);
+                    if (!r.ok)
+                    {
+                        std::fprintf(stderr, "%s %s %zu-%zu x%zu failed\n", allocator.c_str(), patternName(pattern), minSize, maxSize, threads);
+                        failed = true;
+                        continue;
+                    }
+
+                    double mops = r.operations / r.seconds / 1e6;
+                    char sizeText[32], allocText[64], freeText[64], line[512];
+                    std::snprintf(sizeText, sizeof(sizeText), "%zu-%zu", minSize, maxSize);
+                    std::snprintf(allocText, sizeof(allocText), "%.0f/%.0f/%.0f", r.allocP50, r.allocP99, r.allocP999);
+                    std::snprintf(freeText, sizeof(freeText), "%.0f/%.0f/%.0f", r.freeP50, r.freeP99, r.freeP999);
+                    std::printf("%-12s %-7s %-12s %4zu %10.2f | %-26s | %-26s | %7ld KB\n",
+                        allocator.c_str(), patternName(pattern), sizeText, threads, mops, allocText, freeText, r.peakRssKb);
+                    std::fflush(stdout);
+
+                    std::snprintf(line, sizeof(line), "%s,%s,%s,%zu,%zu,%zu,%" PRIu64 ",%.6f,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%ld\n",
+                        label.c_str(), allocator.c_str(), patternName(pattern), minSize, maxSize, threads, r.operations,
+                        r.seconds, mops, r.allocP50, r.allocP99, r.allocP999, r.freeP50, r.freeP99, r.freeP999, r.peakRssKb);
+                    csv += line;
+
+                    std::snprintf(line, sizeof(line),
+                        "%s{\"allocator\":\"%s\",\"pattern\":\"%s\",\"min_size\":%zu,\"max_size\":%zu,\"threads\":%zu,"
+                        "\"ops\":%" PRIu64 ",\"seconds\":%.6f,\"mops\":%.3f,"
+                        "\"alloc_ns\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f},\"free_ns\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f},"
+                        "\"peak_rss_kb\":%ld}",
+                        first ? "" : ",", allocator.c_str(), patternName(pattern), minSize, maxSize, threads, r.operations,
+                        r.seconds, mops, r.allocP50, r.allocP99, r.allocP999, r.freeP50, r.freeP99, r.freeP999, r.peakRssKb);
+                    json += line;
+                    first = false;
+                }
+            }
+        }
+    }
+    json += "]}\n";
+
+    auto writeFile = [](const std::string& path, const std::string& content) {
+        if (path.empty()) return true;
+        std::FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) return false;
+        std::fwrite(content.data(), 1, content.size(), file);
+        std::fclose(file);
+        return true;
+    };
+    if (!writeFile(csvPath, csv) || !writeFile(jsonPath, json))
+    {
+        std::fprintf(stderr, "cannot write results\n");
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
@@ -1,212 +1,212 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <mutex>
-#include <condition_variable>
+#include <new>
 #include "common.h"
 #include "PageCache.h"
+#include "CentralSpanList.h"
+#include "CentralShards.h"
 
-class CentralCache {
+// 加锁的中心缓存，和 LockFreeCentralCache 接口一样，可以在 PoolPolicy 里二选一（见 PoolPolicy.h）
+template <class SizeClasses>
+class LockedCentralCache {
 public:
-    static CentralCache& getInstance() {
-        static CentralCache instance;
-        return instance;
+    static constexpr size_t kNumClasses = SizeClasses::kNumClasses;
+
+    static LockedCentralCache& getInstance() {
+        // mutex 不保证是平凡析构的：构造在静态存储里、永远不析构，进程退出时别的线程还在用也没关系（见 PageCache.h）
+        alignas(LockedCentralCache) static unsigned char storage[sizeof(LockedCentralCache)];
+        static LockedCentralCache* instance = new (storage) LockedCentralCache();
+        return *instance;
     }
 
-    void* fetchRange(size_t index, size_t batchNum);// Ļȡڴ
-    void returnRange(void* start, size_t size, size_t index);  // 黹ڴ鵽Ļ
+    void* fetchRange(size_t index, size_t batchNum);// 从中心缓存获取内存块
+    void returnRange(void* start, size_t size, size_t index);  // 归还内存块到中心缓存
+
+    // 同 LockFreeCentralCache::spanBytes
+    size_t spanBytes() const {
+        size_t total = 0;
+        for (const auto& spans : spanLists_) total += spans.spanBytes();
+        return total;
+    }
 
 private:
-    CentralCache()
+    LockedCentralCache()
+        : shards_(CentralShards::count())
     {
-        for (auto& ptr : centralFreeList_) {
-            ptr.store(nullptr);
+        for (size_t index = 0; index < kNumClasses; ++index)
+        {
+            size_t batchBytes = SizeClasses::numToMove(index) * SizeClasses::classToSize(index);
+            for (size_t shard = 0; shard < shards_; ++shard)
+            {
+                transferLists_[index][shard].capacity = std::clamp(kTransferBytes / batchBytes / shards_, kMinSlots, kMaxSlots);
+            }
         }
     }
 
-    void* fetchFromPageCache(size_t size);  //  PageCache ȡµ Span
+    void* fetchFromTransfer(size_t index);
+    bool returnToTransfer(size_t index, void* start);
 
 private:
-    std::array<std::atomic<void*>, FREE_LIST_SIZE> centralFreeList_;
-    std::array<std::mutex, FREE_LIST_SIZE> locks_;//ÿһ
-    std::array<std::condition_variable, FREE_LIST_SIZE> cond_vars_;
+    //传输缓存：整批存放 ThreadCache 之间来回倒腾的块（每批 numToMove 块，以 nullptr 结尾），
+    //一批进一批出只是数组里放一个 / 取一个指针，不用沿着链表走；
+    //每个大小类最多缓存 kTransferBytes 左右（kMinSlots ~ kMaxSlots 批），不满一批的和放不下的都走 span 后端
+    //每个大小类拆成 shards_ 个分片（见 CentralShards.h），每个分片有自己的锁，热门大小类的线程不再全挤在 locks_[index] 上
+    static constexpr size_t kTransferBytes = 256 * 1024;
+    static constexpr size_t kMinSlots = 2;
+    static constexpr size_t kMaxSlots = 64;
+    struct alignas(64) TransferList
+    {
+        std::mutex lock;
+        std::array<void*, kMaxSlots> batches{}; // 每批的链表头
+        size_t count = 0;
+        size_t capacity = 0;
+    };
+    size_t shards_;
+    std::array<std::array<TransferList, CentralShards::kMaxShards>, kNumClasses> transferLists_;
+
+    //每个大小类按 span 管理空闲块，span 的块全部回来以后整个还给 PageCache（见 CentralSpanList.h）
+    std::array<CentralSpanList<SizeClasses>, kNumClasses> spanLists_;
+    std::array<std::mutex, kNumClasses> locks_;//每个链表一个互斥锁
 };
 
 
 
 
-// ÿδPageCacheȡһڴ飬һڴ8ҳÿһҳأCentralCacheԼ
-static const size_t SPAN_PAGES = 8;
 
 
-void* CentralCache::fetchRange(size_t index, size_t batchNum)
+template <class SizeClasses>
+void* LockedCentralCache<SizeClasses>::fetchRange(size_t index, size_t batchNum)
 {
-    // 飬ڵFREE_LIST_SIZEʱ˵ڴӦֱϵͳ
-    if (index >= FREE_LIST_SIZE || batchNum == 0)
+    // 索引检查，当索引大于等于大小类个数时，说明申请内存过大应直接向系统申请
+    if (index >= kNumClasses || batchNum == 0)
         return nullptr;
 
-    std::unique_lock<std::mutex> lock(locks_[index]);
-    size_t size = (index + 1) * ALIGNMENT;
-
-    //ѭԻȡڴ飬ֱɹʧ
-    //һؼ飺CentralCacheڶؼ飺ܷPageCacheлȡ
-    //УôǾ+ȴ߳ͷԴ֪ͨȻ½ѭ
-    while (true)
+    //正好要一整批，传输缓存里有的话直接拿走
+    if (batchNum == SizeClasses::numToMove(index))
     {
-        void* result = centralFreeList_[index].load(std::memory_order_relaxed);
-
-        // 1Ļ㹻ڴ
-        if (result)
-        {
-            // лȡָĿ
-            void* current = result;
-            void* prev = nullptr;
-            size_t count = 0;
-
-            // ȡbatchNumڴ
-            while (current && count < batchNum)
-            {
-                prev = current;
-                current = *reinterpret_cast<void**>(current);
-                count++;
-            }
-
-            // ȡ㹻ڴ
-            if (count == batchNum)
-            {
-                if (prev) // ǰcentralFreeList_[index]ϵڴbatchNumʱҪõ 
-                {
-                    *reinterpret_cast<void**>(prev) = nullptr; // Ͽǰһ߼϶threadCache
-                }
+        if (void* batch = fetchFromTransfer(index))
+            return batch;
+    }
 
-                // Ļͷ
-                centralFreeList_[index].store(current, std::memory_order_release);
-                return result; // ػȡڴ
-            }
+    std::lock_guard<std::mutex> lock(locks_[index]);
 
-            // Ļڴ鲻batchNumԴPageCacheȡ
-        }
+    CentralSpanList<SizeClasses>& spans = spanLists_[index];
 
-        // 2ĻΪջڴ鲻batchNumǾҪڴ飬ҲǳԴPageCacheȡµڴ
-        void* newBlocks = fetchFromPageCache(size);
-        if (newBlocks)
+    //循环尝试获取内存块，直到凑满 batchNum 块
+    //第一重检查：还有空闲块的span，第二重检查：看能否从PageCache中获取新的span
+    //都不行就是系统内存不够了，和 LockFreeCentralCache 一样返回 nullptr，不在这里等：
+    //别的线程还回来的块可能进了传输缓存、也可能让整个span回了 PageCache，等哪一边的通知都不可靠，
+    //LD_PRELOAD 的 malloc 在这里一直等下去就是挂死，返回 nullptr 才能让调用方看到分配失败
+    void* result = nullptr;
+    size_t count = 0;
+    while (count < batchNum)
+    {
+        // 情况1：已有的span上还有空闲块
+        void* start;
+        size_t got = spans.removeRange(batchNum - count, start);
+        if (got > 0)
         {
-            // PageCacheȡڴзֳС
-            char* start = static_cast<char*>(newBlocks);
-            size_t totalBlocks = (SPAN_PAGES * PageCache::PAGE_SIZE) / size;// PageCache ȡĴڴܱиɶٸСڴ顣
-
-            //ȷʵҪ ThreadCache ڴ
-            //֮ǰbatchNum10totalBlocks16ôֻ10ڴ鹩䡣
-            //ʣ6ڴǱCentralCacheFreeList棬threadCacheʹ
-            size_t allocBlocks = std::min(batchNum, totalBlocks);
+            // 把新拿到的这一段接在 result 前面
+            void* tail = start;
+            while (*reinterpret_cast<void**>(tail)) tail = *reinterpret_cast<void**>(tail);
+            *reinterpret_cast<void**>(tail) = result;
+            result = start;
+            count += got;
+            continue;
+        }
 
-            //PageCacheùڴ飬ȡǰallocBlocksڴ飬ȥظThreadCacheڴ
-            if (allocBlocks > 1)
-            {
-                // ȷŹ
-                for (size_t i = 1; i < allocBlocks; ++i)
-                {
-                    void* current = start + (i - 1) * size;//ǰСĵַ
-                    void* next = start + i * size;// һСĵַ
-                    *reinterpret_cast<void**>(current) = next;// ǰĵһֽλָһ
+        // 情况2：所有span都切完了，从PageCache获取新的span（每个新span至少切得出一批，见 common.h）
+        if (spans.populate(index))
+            continue;
 
-                }
-                *reinterpret_cast<void**>(start + (allocBlocks - 1) * size) = nullptr;//һָΪ nullptrʾ
-            }
+        // 情况3：PageCache也无法分配，把已经拿到的还回去，要么给满一批，要么一块都不给
+        spans.insertRange(result);
+        return nullptr;
+    }
+    return result;
+}
 
-            //PageCacheĴڴУδǰThreadCacheȡߵǲʣڴ飬֯һµ
-            //صCentralCacheУthreadCacheʹ
-            if (totalBlocks > allocBlocks)
-            {
-                void* remainStart = start + allocBlocks * size;
-                for (size_t i = allocBlocks + 1; i < totalBlocks; ++i)
-                {
-                    void* current = start + (i - 1) * size;
-                    void* next = start + i * size;
-                    *reinterpret_cast<void**>(current) = next;
-                }
-                *reinterpret_cast<void**>(start + (totalBlocks - 1) * size) = nullptr;
 
-                // ʣĻ
-                centralFreeList_[index].store(remainStart, std::memory_order_release);
-            }
+template <class SizeClasses>
+void LockedCentralCache<SizeClasses>::returnRange(void* start, size_t size, size_t index)
+//将归还的内存块（start开头、以 nullptr 结尾的链表）整批放进传输缓存，放不下就逐块还给各自的 span
+{
+    if (!start || index >= kNumClasses)
+        return;
 
-            // ·ڴ
-            return start;
-        }
+    if (size / SizeClasses::classToSize(index) == SizeClasses::numToMove(index) && returnToTransfer(index, start))
+        return;
 
-        // 3PageCacheҲ޷䣬ʹȽԴȻȴֱڴ汻黹иղŵѭ
-        cond_vars_[index].wait(lock, [this, index] {
-            return centralFreeList_[index].load(std::memory_order_relaxed) != nullptr;
-            });
-    }
+    std::lock_guard<std::mutex> lock(locks_[index]);
+    spanLists_[index].insertRange(start);
 }
 
-void* CentralCache::fetchFromPageCache(size_t size)
+//先看自己CPU对应的分片，没有再依次看隔壁分片，每次只持有一个分片的锁
+template <class SizeClasses>
+void* LockedCentralCache<SizeClasses>::fetchFromTransfer(size_t index)
 {
-    // 1. ʵҪҳ
-    size_t numPages = (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
-
-    // 2. ݴС
-    if (size <= SPAN_PAGES * PageCache::PAGE_SIZE)
+    size_t home = CentralShards::current(shards_);
+    for (size_t i = 0; i < shards_; ++i)
     {
-        // Сڵ32KBʹù̶8ҳ 32KB趨SPAN_PAGES=8ҳС PAGE_SIZE=4KBֵΪ 8*4KB=32KB
-        return PageCache::getInstance().allocateSpan(SPAN_PAGES);
-    }
-    else
-    {
-        // 32KB󣬰ʵ
-        return PageCache::getInstance().allocateSpan(numPages);
+        TransferList& transfer = transferLists_[index][(home + i) & (shards_ - 1)];
+        std::lock_guard<std::mutex> lock(transfer.lock);
+        if (transfer.count > 0)
+            return transfer.batches[--transfer.count];
     }
+    return nullptr;
 }
 
-
-void CentralCache::returnRange(void* start, size_t size, size_t index)
-//黹ڴ飨ַΪstartͷ centralFreeList_[index] 
+template <class SizeClasses>
+bool LockedCentralCache<SizeClasses>::returnToTransfer(size_t index, void* start)
 {
-    if (!start || index >= FREE_LIST_SIZE)
-        return;
-
-    std::lock_guard<std::mutex> lock(locks_[index]);
-
-    void* current = centralFreeList_[index].load(std::memory_order_relaxed);
-    *reinterpret_cast<void**>(start) = current;
-    centralFreeList_[index].store(start, std::memory_order_release);
-
-    cond_vars_[index].notify_one();  // ֪ͨȴ߳
+    size_t home = CentralShards::current(shards_);
+    for (size_t i = 0; i < shards_; ++i)
+    {
+        TransferList& transfer = transferLists_[index][(home + i) & (shards_ - 1)];
+        std::lock_guard<std::mutex> lock(transfer.lock);
+        if (transfer.count < transfer.capacity)
+        {
+            transfer.batches[transfer.count++] = start;
+            return true;
+        }
+    }
+    return false;
 }
 
 
 
-//ɿ
-//// ԭ루
+//可考虑无锁操作：
+//// 原代码（有锁）
 //std::array<std::atomic<void*>, FREE_LIST_SIZE> centralFreeList_;
 //std::array<std::mutex, FREE_LIST_SIZE> locks_;
 //
-//// 
+//// 改造后（无锁）
 //struct LockFreeList {
-//    std::atomic<TaggedPtr> head;  // ǩָ루ABA⣩
-//    std::atomic<bool> need_notify{ false }; // 
+//    std::atomic<TaggedPtr> head;  // 带标签的指针（防ABA问题）
+//    std::atomic<bool> need_notify{ false }; // 无锁条件变量替代
 //};
 //std::array<LockFreeList, FREE_LIST_SIZE> centralFreeList_;
 //
-//ôʵһĻpushpop
+//那么我们先实现一下无锁操作的基础：push和pop
 //
 //void push(int index, void* block) {
 //    LockFreeList& list = centralFreeList_[index];
 //    TaggedPtr old_head = list.head.load(std::memory_order_relaxed);
 //    TaggedPtr new_head;
 //    do {
-//        // ¿nextָͷڵ
+//        // 将新块的next指向旧头节点
 //        *reinterpret_cast<void**>(block) = old_head.ptr;
-//        new_head = { block, old_head.tag + 1 }; // ǩ
+//        new_head = { block, old_head.tag + 1 }; // 标签递增
 //    } while (!list.head.compare_exchange_weak(
 //        old_head, new_head,
-//        std::memory_order_release,  // ɹʱͬ
+//        std::memory_order_release,  // 成功时同步
 //        std::memory_order_relaxed));
 //
-//    // ֪ͨȴ߳
+//    // 通知等待线程
 //    list.need_notify.store(true, std::memory_order_release);
 //}
 //
@@ -216,9 +216,9 @@ void CentralCache::returnRange(void* start, size_t size, size_t index)
 //    void* result = nullptr;
 //    do {
 //        old_head = list.head.load(std::memory_order_acquire);
-//        if (!old_head.ptr) return nullptr; // Ϊ
+//        if (!old_head.ptr) return nullptr; // 链表为空
 //        result = old_head.ptr;
-//        new_head.ptr = *reinterpret_cast<void**>(old_head.ptr); // һڵ
+//        new_head.ptr = *reinterpret_cast<void**>(old_head.ptr); // 下一个节点
 //        new_head.tag = old_head.tag + 1;
 //    } while (!list.head.compare_exchange_weak(
 //        old_head, new_head,
@@ -232,22 +232,22 @@ void CentralCache::returnRange(void* start, size_t size, size_t index)
 //    void* batch_head = nullptr;
 //    size_t count = 0;
 //
-//    // CASѭȡ㹻Ŀ
+//    // CAS循环获取足够数量的块
 //    do {
 //        TaggedPtr old_head = list.head.load(std::memory_order_acquire);
 //        void* current = old_head.ptr;
 //        batch_head = current;
 //        count = 0;
 //
-//        // ͳƿÿ
+//        // 遍历链表，统计可用块数
 //        while (current && count < batchNum) {
 //            current = *reinterpret_cast<void**>(current);
 //            count++;
 //        }
 //
-//        if (count < batchNum) break; // 㣬PageCache
+//        if (count < batchNum) break; // 数量不足，需从PageCache补充
 //
-//        // ԭԽض
+//        // 尝试原子性截断链表
 //        TaggedPtr new_head = { current, old_head.tag + 1 };
 //        if (list.head.compare_exchange_strong(
 //            old_head, new_head,
@@ -257,5 +257,5 @@ void CentralCache::returnRange(void* start, size_t size, size_t index)
 //        }
 //    } while (true);
 //
-//    return nullptr; // PageCache
+//    return nullptr; // 需从PageCache补充
 //}
\ No newline at end of file
@@ -1,213 +1,260 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <cstdint>
+#include <mutex>
+#include <type_traits>
 #include "common.h"
 #include "PageCache.h"
-
-// ֧ ABA Ĵǩָ
-struct TaggedPtr {
-    void* ptr;
-    unsigned int tag;
-
-    TaggedPtr() : ptr(nullptr), tag(0) {}
-    TaggedPtr(void* p, unsigned int t) : ptr(p), tag(t) {}
-
-    bool operator==(const TaggedPtr& other) const {
-        return ptr == other.ptr && tag == other.tag;
+#include "CentralSpanList.h"
+#include "CentralShards.h"
+
+// 支持 ABA 问题防护的带标签下标，打包在一个 64 位字里：低 7 位是描述符的下标 + 1（0 表示空栈），高 57 位是标签
+//
+// 原来是 { void* ptr; unsigned tag; }，加上填充一共 16 字节。GCC 不会把16字节的 std::atomic 内联成 cmpxchg16b，
+// 而是调用 libatomic，libatomic 在不支持的情况下会退回一把内部锁，"无锁"的中心缓存其实是有锁的。
+// 后来改成低 48 位放地址、高 16 位放标签，8 字节的 CAS 在所有 64 位平台上都是一条指令（lock cmpxchg / casal），
+// 但 16 位的标签太短：一个线程读了栈顶之后被挂起（被抢占、缺页），期间别的线程改了 65536 次、栈顶又恰好是原来那个描述符，
+// CAS 就会成功，热门大小类上几十毫秒就能改这么多次。
+// 栈里放的其实只会是同一个 TransferList 里的描述符（最多 kMaxSlots = 64 个），不需要整个地址，存下标就够了，
+// 省出来的位全给标签：2^57 次修改，每秒一亿次也要四十多年才回绕一圈
+struct TaggedIndex {
+    static constexpr int kSlotBits = 7;
+    static constexpr uint64_t kSlotMask = (uint64_t(1) << kSlotBits) - 1;
+
+    uint64_t bits;
+
+    TaggedIndex() : bits(0) {}
+    TaggedIndex(uint32_t slot, uint64_t t) : bits(slot | (t << kSlotBits)) {}
+
+    uint32_t slot() const { return static_cast<uint32_t>(bits & kSlotMask); }
+    uint64_t tag() const { return bits >> kSlotBits; }
+
+    bool operator==(const TaggedIndex& other) const {
+        return bits == other.bits;
     }
 };
 
-class CentralCache {
+static_assert(sizeof(TaggedIndex) == 8);
+static_assert(std::atomic<TaggedIndex>::is_always_lock_free, "central cache CAS must be a single instruction");
+
+// 无锁的中心缓存，SizeClasses 是 BasicSizeClass 的某个实例，每种大小类配置各有一个单例
+template <class SizeClasses>
+class LockFreeCentralCache {
 public:
-    static CentralCache& getInstance() {
-        static CentralCache instance;
+    static constexpr size_t kNumClasses = SizeClasses::kNumClasses;
+
+    static LockFreeCentralCache& getInstance() {
+        static LockFreeCentralCache instance;
         return instance;
     }
 
     void* fetchRange(size_t index, size_t batchNum);
     void returnRange(void* start, size_t size, size_t index);
 
+    // 所有大小类手里的 span 一共多少字节：传输缓存和 span 上的空闲块，加上已经分配给前端缓存和用户的块（统计用，见 PoolStats.h）
+    size_t spanBytes() const {
+        size_t total = 0;
+        for (const auto& spans : spanLists_) total += spans.spanBytes();
+        return total;
+    }
+
 private:
-    CentralCache()
+    LockFreeCentralCache()
+        : shards_(CentralShards::count())
     {
-        for (auto& list : centralFreeList_) {
-            list.head.store(TaggedPtr(nullptr, 0));
+        for (size_t index = 0; index < kNumClasses; ++index) {
+            // 每个大小类最多缓存多少批：批越大能放的越少，由各个分片平分，但每个分片至少 kMinSlots 批
+            size_t batchBytes = SizeClasses::numToMove(index) * SizeClasses::classToSize(index);
+            size_t slots = std::clamp(kTransferBytes / batchBytes / shards_, kMinSlots, kMaxSlots);
+            for (size_t shard = 0; shard < shards_; ++shard) {
+                TransferList& list = transferLists_[index][shard];
+                list.full.store(TaggedIndex());
+                list.free.store(TaggedIndex());
+                for (size_t i = 0; i < slots; ++i) {
+                    push(list, list.free, &list.slots[i]);
+                }
+            }
         }
     }
 
-    void* fetchFromPageCache(size_t size);
+    void* fetchFromSpans(size_t index, size_t batchNum);
 
-    struct LockFreeList {
-        std::atomic<TaggedPtr> head;  // ʹôǩԭָ
+    static constexpr size_t kTransferBytes = 256 * 1024;
+    static constexpr size_t kMinSlots = 2;
+    static constexpr size_t kMaxSlots = 64;
+    static_assert(kMaxSlots < (size_t(1) << TaggedIndex::kSlotBits), "slot + 1 must fit in the low bits of TaggedIndex");
+
+    // 一批块：head 开头、以 nullptr 结尾的链表，块数固定是 numToMove
+    struct Batch {
+        void* head;
+        std::atomic<uint32_t> next; // 在 full / free 栈里的下一个，存下标 + 1，0 表示栈底（可能被并发读，所以是原子的）
     };
 
-    std::array<LockFreeList, FREE_LIST_SIZE> centralFreeList_;
-};
+    // 按缓存行对齐，不同分片的栈顶不会落在同一行里
+    struct alignas(64) TransferList {
+        std::atomic<TaggedIndex> full;  // 装着一批块的描述符
+        std::atomic<TaggedIndex> free;  // 空闲的描述符，空了说明这个大小类已经缓存满了
+        std::array<Batch, kMaxSlots> slots;  // 描述符本身，和 CentralCache 一起静态分配，永远不会释放
+    };
 
-// ÿδPageCacheȡ8ҳڴ
-static const size_t SPAN_PAGES = 8;
+    // 描述符的无锁栈，push / pop 都是 O(1)；stack 是 list 的 full 或者 free，栈里的下标都是相对 list.slots 的
+    static void push(TransferList& list, std::atomic<TaggedIndex>& stack, Batch* batch);
+    static Batch* pop(TransferList& list, std::atomic<TaggedIndex>& stack);
+
+    //两层结构：
+    //  transferLists_：传输缓存，按整批存放 ThreadCache 之间来回倒腾的块，一批进一批出都是 O(1)，快速路径上没有锁
+    //  spanLists_：按 span 管理的后端，加锁；span 的块全部回来以后整个还给 PageCache
+    //传输缓存里的块还算 span 切出去的，会钉住 span，所以每个大小类最多缓存 kTransferBytes 左右（kMinSlots ~ kMaxSlots 批），多出来的进后端；
+    //不满一批的（慢启动阶段的小批量、线程退出时剩下的零头）也直接走后端
+    //每个大小类的传输缓存拆成 shards_ 个分片（见 CentralShards.h），线程先用自己CPU对应的分片，空了 / 满了再依次看隔壁的
+    size_t shards_;
+    std::array<std::array<TransferList, CentralShards::kMaxShards>, kNumClasses> transferLists_;
+    std::array<CentralSpanList<SizeClasses>, kNumClasses> spanLists_;
+    std::array<std::mutex, kNumClasses> spanLocks_;
+};
 
+// 和PageCache一样，单例必须是平凡析构的，见 PageCache.h
+static_assert(std::is_trivially_destructible_v<LockFreeCentralCache<SizeClass>>);
 
-//һЩ˼
-//ٽ + Ͳ	        ֶ / д	                ʵ֣ȶ
-//ٽ + ߲	        Hazard Pointer / RCU	         + ȫͷ
-//д	                RCU	                                    
-//߼	                ֹ۲ / HTM	                    ԣ
-//ǳٽCASԵĻҪ±һܺʱԿ̵
+// 默认配置的 MemoryPool 用的中心缓存
+using CentralCache = LockFreeCentralCache<SizeClass>;
 
 
-//̵ıǣ
-//Թݵ޸ֻͨԭӲ޸ģ CASԹݵĶȡ͵߳һȡ
-//ԭӲֻ"ռ"״̬½У CAS ɹ  
-//繲A->B->C->D  ǰ̰߳ѹͷΪC֮ǵǰ߳൱ڶǶռģ߳̿ABˣԺ͵߳һģһشAB
 
-void* CentralCache::fetchRange(size_t index, size_t batchNum) {
-    // 1. ϷԼ
-    if (index >= FREE_LIST_SIZE || batchNum == 0) {
-        return nullptr;  // ԽΪ0ʱֱӷ
-    }
+//一些思考：
+//长临界区 + 低并发	        分段锁 / 读写锁	                简单易实现，性能稳定
+//长临界区 + 高并发	        Hazard Pointer / RCU	        无锁 + 安全释放
+//读多写少	                RCU	                                    零锁读操作
+//复杂逻辑	                乐观并发控制 / HTM	                    减少重试，提升吞吐量
+//本例就是长临界区，导致CAS重试的话就要重新遍历一次链表，很耗时，所以看起来和有锁编程的提升不大
 
-    // 2. 㵱ǰӦڴС
-    size_t size = (index + 1) * ALIGNMENT;  // ALIGNMENT ڴֵ 8/16
-
-    // 3. ѭԣ̵ĺģʽ
-    while (true) {
-        // 4. ȡǰͷϢԭӶ
-        LockFreeList& list = centralFreeList_[index];
-        TaggedPtr old_head = list.head.load(std::memory_order_acquire);
-        void* current = old_head.ptr;  // ǰͷָ
-        void* batch_head = current;    // Ҫͷ
-        void* batch_tail = nullptr;    // Ҫβ
-        size_t count = 0;              // ͳƿڴ
-
-        // 5. ͳƿڴ飨߳߼
-        while (current && count < batchNum) {
-            batch_tail = current;
-            current = *reinterpret_cast<void**>(current);  // ͨڴǰ8ֽڶȡnext
-            count++;
-        }
 
-        // 6. A: ڴ㹻 batchNum ڴ飩
-        if (count == batchNum) {
-            // µͷָʣ
-            TaggedPtr new_head{ current, old_head.tag + 1 };
-
-            // 7. ԭӸͷCAS ̰߳ȫĹؼ
-            if (list.head.compare_exchange_weak(
-                old_head, new_head,           // ԭֵֵ
-                std::memory_order_release,     // д߳̿ɼ
-                std::memory_order_acquire)) {  // ȷ̵߳д
-
-                // 8. ضԭӲʱѶռڴ飩!!!!!!!!!!!!!!!!!!!!!!!
-                //=======================================================
-                //=======================================================
-                //Ｋõ̵ĺ˼룬Ȼݻǹϵ
-                //Ǳ߳Ѿ޷ȡһֵˣΪheadƶȥˣΪǵǰ̶߳ռ
-                if (batch_tail) {
-                    *reinterpret_cast<void**>(batch_tail) = nullptr;
-                }
+//无锁编程的本质是：
+//对共享数据的修改只能通过原子操作修改（如 CAS），对共享数据的读取和单线程一样，正常读取即可
+//非原子操作只能在"独占"状态下进行（如 CAS 成功后）  
+//比如共享链表A->B->C->D  当前线程把共享链表的头更新为了C之后，我们当前线程相当于对这个共享链表就是独占的（别的线程看不到A和B了），可以和单线程一模一样地处理A和B
 
-                // 9. طڴ
-                return batch_head;
-            }
-            else {
-                // 10. CASʧܣ߳޸ģ
-                continue;
-            }
-        }
+//原来这里直接在所有块串成的共享链表上摘 batchNum 个节点：
+//每次都要在 CAS 重试循环里沿着链表走 batchNum 步，走的还是别的核刚刚写过的内存，每一步都是缓存未命中，
+//CAS 失败了又得从头再走一遍。现在共享的是"一批一批"的描述符，摘一批只是一次 CAS，不碰块本身的内存
+//
+//这也是这里不需要 hazard pointer / epoch 之类安全回收机制的原因：
+//原来沿着块链表走的时候，读到的节点可能已经被别的线程弹走、当成用户数据改写了，tag 只能保护栈顶那一次 CAS，保护不了遍历；
+//现在无锁路径上唯一会被"读到过时数据"的只有描述符的 next，描述符是 transferLists_ 里的静态数组，类型稳定、永远不释放，
+//读到的过时值最多让 CAS 失败重来。块本身的内存（批里的 next 指针）只在 CAS 成功、描述符归自己独占以后才读写
 
-        // 11. B: ڴ治㣨Ҫ PageCache ȡڴ棩
-        void* newBlocks = fetchFromPageCache(size);
-        if (!newBlocks) {
-            continue;  // ȡʧܣ
+template <class SizeClasses>
+void LockFreeCentralCache<SizeClasses>::push(TransferList& list, std::atomic<TaggedIndex>& stack, Batch* batch) {
+    uint32_t slot = static_cast<uint32_t>(batch - list.slots.data()) + 1;
+    TaggedIndex old_head = stack.load(std::memory_order_relaxed);
+    TaggedIndex new_head;
+    do {
+        // 头插法：新节点的 next 指向旧的栈顶
+        batch->next.store(old_head.slot(), std::memory_order_relaxed);
+        new_head = TaggedIndex(slot, old_head.tag() + 1);
+    } while (!stack.compare_exchange_weak(
+        old_head, new_head,
+        std::memory_order_release, std::memory_order_relaxed));
+}
+
+template <class SizeClasses>
+typename LockFreeCentralCache<SizeClasses>::Batch* LockFreeCentralCache<SizeClasses>::pop(TransferList& list, std::atomic<TaggedIndex>& stack) {
+    TaggedIndex old_head = stack.load(std::memory_order_acquire);
+    while (uint32_t slot = old_head.slot()) {
+        // 读到的 next 可能已经过时（别的线程刚把这个节点弹走又压回来），
+        // 但那样的话 tag 一定变了，下面的 CAS 会失败（这就是 tag 防的 ABA 问题）；
+        // 描述符永远不会被释放，所以读 next 本身总是安全的
+        Batch* batch = &list.slots[slot - 1];
+        TaggedIndex new_head(batch->next.load(std::memory_order_relaxed), old_head.tag() + 1);
+        if (stack.compare_exchange_weak(
+            old_head, new_head,
+            std::memory_order_acquire, std::memory_order_acquire)) {
+            // CAS 成功以后这个描述符就归当前线程独占了
+            return batch;
         }
+    }
+    return nullptr;
+}
+
+template <class SizeClasses>
+void* LockFreeCentralCache<SizeClasses>::fetchRange(size_t index, size_t batchNum) {
+    // 1. 参数合法性检查
+    if (index >= kNumClasses || batchNum == 0) {
+        return nullptr;  // 索引越界或请求数量为0时直接返回
+    }
 
-
-        ///////////////ĺܺõ̵ĺ˼룺
-        //̶߳ռݣ·ڴ飩ֱӲԭԣ
-        //ݣͷͨCAS ֤ԭԣֹ̳߳ͻ
-
-        //磬ڴǵǰ̸߳մ PageCache ģδ뵽
-        //ʱûκܷ߳ڴ棨δǵǰ̶߳ռģд
-        //ȻҪʣһͷCentralCache
-        //ǹݣ߳̿ͬʱ޸ͷǵʹCAS
-        //ݺԼԤڵһ£̻߳ûдô˲ͷɹ
-        //ݺԼԤڵĲһ£ô߳Ѿˣô³Բ
-
-
-        // 12. зڴ飨߳߼
-        char* start = static_cast<char*>(newBlocks);
-        size_t totalBlocks = (SPAN_PAGES * PageCache::PAGE_SIZE) / size;
-        size_t allocBlocks = std::min(batchNum, totalBlocks);
-
-        // 13.  ThreadCache ԭӲ
-        if (allocBlocks > 1) {
-            for (size_t i = 1; i < allocBlocks; ++i) {
-                void* current = start + (i - 1) * size;
-                void* next = start + i * size;
-                *reinterpret_cast<void**>(current) = next;
+    // 2. 正好要一整批：从传输缓存里拿一批（无锁，O(1)），自己的分片没有就去隔壁分片偷
+    if (batchNum == SizeClasses::numToMove(index)) {
+        size_t home = CentralShards::current(shards_);
+        for (size_t i = 0; i < shards_; ++i) {
+            TransferList& list = transferLists_[index][(home + i) & (shards_ - 1)];
+            if (Batch* batch = pop(list, list.full)) {
+                // 3. 描述符已经被当前线程独占，取出链表之后还回同一个分片的空闲栈
+                void* head = batch->head;
+                push(list, list.free, batch);
+                return head;
             }
-            *reinterpret_cast<void**>(start + (allocBlocks - 1) * size) = nullptr;
-        }
-
-        // 14. ʣڴ鲢Ҫ CAS ԭӲ
-        if (totalBlocks > allocBlocks) {
-            void* remainStart = start + allocBlocks * size;
-            void* remainTail = start + (totalBlocks - 1) * size;
-            *reinterpret_cast<void**>(remainTail) = nullptr;
-
-            TaggedPtr remain_old_head;
-            TaggedPtr remain_new_head;
-            do {
-                // 15. ȡǰͷԭӶ
-                remain_old_head = list.head.load(std::memory_order_acquire);
-
-                // 16. ʣβӵǰͷ
-                *reinterpret_cast<void**>(remainTail) = remain_old_head.ptr;
-
-                // 17. ͷ汾ţ
-                remain_new_head = { remainStart, remain_old_head.tag + 1 };
-
-                // 18. ԭӲʣCAS ѭԣ
-            } while (!list.head.compare_exchange_weak(
-                remain_old_head, remain_new_head,
-                std::memory_order_release, std::memory_order_acquire));
         }
-
-        // 19. ·ڴ
-        return start;
     }
-};
 
-void* CentralCache::fetchFromPageCache(size_t size)
+    // 4. 传输缓存空了，或者要的不是整批：到 span 后端去拿（必要时从 PageCache 获取新span）
+    return fetchFromSpans(index, batchNum);
+}
+
+template <class SizeClasses>
+void* LockFreeCentralCache<SizeClasses>::fetchFromSpans(size_t index, size_t batchNum)
 {
-    size_t numPages = (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+    std::lock_guard<std::mutex> lock(spanLocks_[index]);
+    CentralSpanList<SizeClasses>& spans = spanLists_[index];
+
+    void* result = nullptr;
+    size_t count = 0;
+    while (count < batchNum) {
+        void* start;
+        size_t got = spans.removeRange(batchNum - count, start);
+        if (got == 0) {
+            // 所有span都切完了，找 PageCache 要新的（每个新span至少切得出一批，见 common.h）
+            if (spans.populate(index)) continue;
+
+            // 系统内存不够了：把已经拿到的还回去，要么给满一批，要么一块都不给
+            spans.insertRange(result);
+            return nullptr;
+        }
 
-    if (size <= SPAN_PAGES * PageCache::PAGE_SIZE) {
-        return PageCache::getInstance().allocateSpan(SPAN_PAGES);
+        // 把新拿到的这一段接在 result 前面
+        void* tail = start;
+        while (*reinterpret_cast<void**>(tail)) tail = *reinterpret_cast<void**>(tail);
+        *reinterpret_cast<void**>(tail) = result;
+        result = start;
+        count += got;
     }
-    else {
-        return PageCache::getInstance().allocateSpan(numPages);
-    }
-};
+    return result;
+}
 
-void CentralCache::returnRange(void* start, size_t size, size_t index)
+template <class SizeClasses>
+void LockFreeCentralCache<SizeClasses>::returnRange(void* start, size_t size, size_t index)
 {
-    if (!start || index >= FREE_LIST_SIZE)
+    if (!start || index >= kNumClasses)
         return;
 
-    LockFreeList& list = centralFreeList_[index];
-    TaggedPtr old_head = list.head.load(std::memory_order_relaxed);
-    TaggedPtr new_head;
-
-    do {
-        // ͷ巨ڴ
-        *reinterpret_cast<void**>(start) = old_head.ptr;
-        new_head = { start, old_head.tag + 1 };
+    // start 是一条以 nullptr 结尾、共 size / 块大小 块的链表
+    // 正好一整批，并且传输缓存还有空位：整批放进去，O(1)，不用找链表尾；自己的分片满了就放隔壁分片
+    if (size / SizeClasses::classToSize(index) == SizeClasses::numToMove(index)) {
+        size_t home = CentralShards::current(shards_);
+        for (size_t i = 0; i < shards_; ++i) {
+            TransferList& list = transferLists_[index][(home + i) & (shards_ - 1)];
+            if (Batch* batch = pop(list, list.free)) {
+                batch->head = start;
+                push(list, list.full, batch);
+                return;
+            }
+        }
+    }
 
-    } while (!list.head.compare_exchange_weak(
-        old_head, new_head,
-        std::memory_order_release, std::memory_order_relaxed));
-}
\ No newline at end of file
+    // 传输缓存满了，或者不是整批：逐块还给各自的 span，凑齐了的 span 就能还给 PageCache
+    std::lock_guard<std::mutex> lock(spanLocks_[index]);
+    spanLists_[index].insertRange(start);
+}
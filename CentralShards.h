@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include "common.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// 中心缓存的分片
+//
+// 所有线程分配同一个热门大小类（32、64字节）时都在抢同一个传输缓存的栈顶（加锁版本是同一把锁），
+// 十几个线程以上那一条缓存行就成了瓶颈。CentralCache 把每个大小类的传输缓存拆成若干个分片，
+// 每个线程按当前所在的CPU挑一个分片，不同核上的线程碰的是不同的缓存行；自己的分片空了（或者满了）再去隔壁分片偷。
+// span 后端不分片，它本来就不在快速路径上
+//
+// 分片数是可用的CPU数向上取整到2的幂，最多 kMaxShards 个；编译时定义 MEMORYPOOL_CENTRAL_SHARDS 可以固定下来
+class CentralShards
+{
+public:
+    static constexpr size_t kMaxShards = 16;
+
+    // 只在中心缓存构造时调用一次。Linux 上不用 hardware_concurrency：它可能要读 /sys 下的文件，
+    // 而中心缓存是在进程里第一次 malloc 的时候构造的
+    static size_t count()
+    {
+#ifdef MEMORYPOOL_CENTRAL_SHARDS
+        size_t cpus = MEMORYPOOL_CENTRAL_SHARDS;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        size_t cpus = sched_getaffinity(0, sizeof(set), &set) == 0 ? CPU_COUNT(&set) : 1;
+#else
+        size_t cpus = std::thread::hardware_concurrency();
+#endif
+        size_t shards = 1;
+        while (shards < cpus && shards < kMaxShards) shards *= 2;
+        return shards;
+    }
+
+    // 当前线程该用哪个分片，shards 必须是2的幂
+    static size_t current(size_t shards)
+    {
+        if (shards == 1) return 0;
+#ifdef __linux__
+        // glibc 2.35 以后 sched_getcpu 直接读 rseq 区域里的CPU号，不进内核
+        int cpu = sched_getcpu();
+        if (cpu >= 0) return static_cast<size_t>(cpu) & (shards - 1);
+#endif
+        // 拿不到CPU号就按线程轮流分配
+        if (tlsShard_ == 0) tlsShard_ = nextShard_.fetch_add(1, std::memory_order_relaxed) + 1;
+        return (tlsShard_ - 1) & (shards - 1);
+    }
+
+private:
+    static inline std::atomic<uint32_t> nextShard_{ 0 };
+    static inline thread_local uint32_t tlsShard_ THREAD_CACHE_TLS_MODEL = 0;
+};
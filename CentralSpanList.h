@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#include "common.h"
+#include "PageCache.h"
+
+// CentralCache 里某一个大小类的 span 后端
+//
+// 原来 CentralCache 从 PageCache 拿到 span 之后就把它切成小块全部倒进一条大链表，
+// 不同 span 的块混在一起，再也分不清哪个 span 的块都回来了，span 永远还不回 PageCache，
+// 流量高峰过后内存就一直被钉死在这个大小类里。
+// 现在每个 span 自己挂着自己的空闲块（Span::freeList 和还没切过的 bumpPtr 那一段），并且记着切出去了多少块还没回来（Span::useCount）：
+//   removeRange：从还有空闲块的 span 上取块，useCount 增加
+//   insertRange：每一块按地址查回自己的 span，useCount 减少，减到 0 就把整个 span 还给 PageCache 去合并，
+//                别的大小类（或者大对象）就能用上这些页了
+//
+// 这个类本身不加锁，调用方（CentralCache）用每个大小类自己的锁保护；SizeClasses 是 BasicSizeClass 的某个实例
+template <class SizeClasses>
+class CentralSpanList
+{
+public:
+    // 从 span 里取最多 batchNum 块，串成以 nullptr 结尾的链表放进 start，返回实际取到的块数
+    size_t removeRange(size_t batchNum, void*& start)
+    {
+        start = nullptr;
+        size_t count = 0;
+        while (count < batchNum && head_)
+        {
+            Span* span = head_;
+            while (count < batchNum && span->hasFreeBlock())
+            {
+                void* block = span->popBlock();
+                *reinterpret_cast<void**>(block) = start;
+                start = block;
+                ++span->useCount;
+                ++count;
+            }
+            // 取空了的 span 不需要再挂在链表上，等有块还回来的时候再挂回来
+            if (!span->hasFreeBlock()) unlink(span);
+        }
+        return count;
+    }
+
+    // 把一条以 nullptr 结尾的链表里的块逐个还给各自的 span
+    void insertRange(void* start)
+    {
+        PageCache& pageCache = PageCache::getInstance();
+        Span* span = nullptr;
+        while (start)
+        {
+            void* block = start;
+            start = *reinterpret_cast<void**>(block);
+
+            // 一批里相邻的块大多来自同一个 span，命中的话就不用再查基数树
+            if (!span || !contains(span, block)) span = pageCache.mapToSpan(block);
+
+            if (!span->hasFreeBlock()) pushFront(span);
+            *reinterpret_cast<void**>(block) = span->freeList;
+            span->freeList = block;
+
+            if (--span->useCount == 0)
+            {
+                unlink(span);
+                addSpanBytes(-static_cast<ptrdiff_t>(span->numPages * PageCache::PAGE_SIZE));
+                pageCache.deallocateSpan(span->pageAddr, span->numPages);
+                span = nullptr;
+            }
+        }
+    }
+
+    // 找 PageCache 要一个新 span，按 index 这个大小类的块大小挂进来
+    bool populate(size_t index)
+    {
+        Span* span = PageCache::getInstance().allocateSpan(SizeClasses::classToPages(index));
+        if (!span) return false;
+
+        // 记下span被切成的块大小，释放时只凭指针就能查回来
+        size_t size = SizeClasses::classToSize(index);
+        span->sizeClass = index;
+        span->objSize = size;
+
+        // 原来在这里把每一块都串进 freeList，一个 32KB 的 span 拿来就要写遍每一页，哪怕最后只用了几块；
+        // 现在只记下从哪切到哪，removeRange 取一块才往后推一块（见 Span::popBlock）
+        span->initBump((span->numPages * PageCache::PAGE_SIZE) / size);
+        span->freeList = nullptr;
+        span->useCount = 0;
+        pushFront(span);
+        addSpanBytes(span->numPages * PageCache::PAGE_SIZE);
+        return true;
+    }
+
+    bool empty() const { return head_ == nullptr; }
+
+    // 这个大小类手里的 span 一共多少字节（不管块切出去了没有），不加锁也能读，统计用
+    size_t spanBytes() const { return spanBytes_.load(std::memory_order_relaxed); }
+
+private:
+    static bool contains(const Span* span, const void* ptr)
+    {
+        const char* begin = static_cast<const char*>(span->pageAddr);
+        return ptr >= begin && ptr < begin + span->numPages * PageCache::PAGE_SIZE;
+    }
+
+    // 交给 CentralCache 之后 span 的 next/prev 就空出来了（PageCache 只在 span 空闲时用它们），这里借来串链表
+    void pushFront(Span* span)
+    {
+        span->prev = nullptr;
+        span->next = head_;
+        if (head_) head_->prev = span;
+        head_ = span;
+    }
+
+    void unlink(Span* span)
+    {
+        if (span->prev) span->prev->next = span->next;
+        else head_ = span->next;
+        if (span->next) span->next->prev = span->prev;
+        span->next = span->prev = nullptr;
+    }
+
+    // 只在调用方的锁下写，所以 load + store 就够了
+    void addSpanBytes(ptrdiff_t bytes)
+    {
+        spanBytes_.store(spanBytes_.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    }
+
+    Span* head_ = nullptr; // 还有空闲块的 span
+    std::atomic<size_t> spanBytes_{ 0 };
+};
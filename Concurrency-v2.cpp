@@ -1,13 +1,660 @@
-﻿
-// Concurrency-v2.cpp: 定义应用程序的入口点。
+﻿// Concurrency-v2.cpp：宏基准，用接近线上服务的负载看内存池能不能随核数扩展
 //
+//   ./Concurrency-v2 [--workloads kv,request,pipeline,fragmentation] [--allocators pool,pool-locked,glibc]
+//                    [--max-threads N] [--seconds 1.0] [--csv out.csv]
+//
+// 四种负载：
+//   kv：分片加锁的哈希表，预先放好 20 万个长期存活的节点（32~512 字节的值），90% 读、10% 覆盖写（新节点换掉旧节点）
+//       一次操作 = 一次读或写
+//   request：线程池处理请求，每个请求分配一阵 20~200 个对象（大部分是小对象，少数几 KB），处理完一起释放
+//       一次操作 = 一个请求
+//   pipeline：生产者 / 消费者成对，生产者分配消息放进环形队列，消费者取出来用完释放，全部是跨线程释放
+//       一次操作 = 一条消息；N 个核上跑 N / 2 对（只有一个核时一对挤在同一个核上）
+//   fragmentation：生命周期混在一起：95% 的对象很快就释放，5% 长期存活、随机地被替换掉，
+//       大小的分布每隔一段时间换一次，旧大小类里零散的长期对象会把页钉住；结束时报告 RSS / 存活字节数
+//       一次操作 = 一次分配
+// 每一种负载按 1 到 N 个线程各跑 --seconds 秒（N 默认是这个进程能用的核数），第 i 个线程绑在第 i 个核上，
+// 报告吞吐和相对单线程的加速比，每个点都在 fork 出来的子进程里跑，分配器之间互不影响
+#include "MemoryPool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    using LockedMemoryPool = BasicMemoryPool<PoolPolicy<LockedCentralCache>>;
+
+    struct PoolAllocator
+    {
+        static void* allocate(size_t size) { return MemoryPool::allocate(size); }
+        static void deallocate(void* ptr, size_t size) { MemoryPool::deallocate(ptr, size); }
+    };
+
+    struct LockedPoolAllocator
+    {
+        static void* allocate(size_t size) { return LockedMemoryPool::allocate(size); }
+        static void deallocate(void* ptr, size_t size) { LockedMemoryPool::deallocate(ptr, size); }
+    };
+
+    struct GlibcAllocator
+    {
+        static void* allocate(size_t size) { return std::malloc(size); }
+        static void deallocate(void* ptr, size_t) { std::free(ptr); }
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // 这个进程允许用的核，第 i 个线程绑在 cpus[i % cpus.size()] 上
+    std::vector<int> availableCpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+            }
+        }
+        if (cpus.empty()) cpus.push_back(0);
+        return cpus;
+    }
+
+    void pinTo(int cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    size_t residentKb()
+    {
+        long pages = 0, resident = 0;
+        if (std::FILE* statm = std::fopen("/proc/self/statm", "r"))
+        {
+            if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+            std::fclose(statm);
+        }
+        return static_cast<size_t>(resident) * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    // 所有线程都就位以后一起开始，到点一起停下
+    class Run
+    {
+    public:
+        explicit Run(size_t threads) : threads_(threads) {}
+
+        void arrive()
+        {
+            ready_.fetch_add(1);
+            while (!go_.load(std::memory_order_acquire)) std::this_thread::yield();
+        }
+
+        bool running() const { return !stop_.load(std::memory_order_relaxed); }
+
+        // 主线程：等所有线程就位，开始计时，seconds 秒后叫停，返回实际经过的秒数
+        double drive(double seconds)
+        {
+            while (ready_.load() < threads_) std::this_thread::yield();
+            auto start = Clock::now();
+            go_.store(true, std::memory_order_release);
+            std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+            stop_.store(true, std::memory_order_relaxed);
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+    private:
+        size_t threads_;
+        std::atomic<size_t> ready_{ 0 };
+        std::atomic<bool> go_{ false };
+        std::atomic<bool> stop_{ false };
+    };
+
+    struct Result
+    {
+        bool ok;
+        double seconds;
+        uint64_t ops;
+        long peakRssKb;
+        size_t endRssKb;   // 负载结束、还没清理时的 RSS
+        size_t liveBytes;  // 这时负载手里还有多少字节（只有 kv 和 fragmentation 统计）
+    };
+
+    // ---------------------------------------------------------------------
+    // kv
+    // ---------------------------------------------------------------------
+    template <class Alloc>
+    class KvStore
+    {
+    public:
+        static constexpr size_t kShards = 64;
+        static constexpr size_t kBucketsPerShard = 8192;
+
+        KvStore()
+        {
+            for (Shard& shard : shards_) shard.buckets.assign(kBucketsPerShard, nullptr);
+        }
+
+        ~KvStore()
+        {
+            for (Shard& shard : shards_)
+            {
+                for (Node* node : shard.buckets)
+                {
+                    while (node)
+                    {
+                        Node* next = node->next;
+                        Alloc::deallocate(node, sizeof(Node) + node->size);
+                        node = next;
+                    }
+                }
+            }
+        }
+
+        // 读出值的第一个字节，没有这个键返回 -1
+        int get(uint64_t key)
+        {
+            Shard& shard = shardOf(key);
+            std::lock_guard<std::mutex> lock(shard.lock);
+            for (Node* node = shard.buckets[bucketOf(key)]; node; node = node->next)
+            {
+                if (node->key == key) return static_cast<unsigned char>(node->value()[0]);
+            }
+            return -1;
+        }
+
+        // 新节点换掉旧节点，旧节点在锁外面释放
+        void put(uint64_t key, uint32_t size)
+        {
+            Node* node = static_cast<Node*>(Alloc::allocate(sizeof(Node) + size));
+            node->key = key;
+            node->size = size;
+            std::memset(node->value(), static_cast<int>(key), size);
+
+            Node* old = nullptr;
+            Shard& shard = shardOf(key);
+            {
+                std::lock_guard<std::mutex> lock(shard.lock);
+                Node** link = &shard.buckets[bucketOf(key)];
+                while (*link && (*link)->key != key) link = &(*link)->next;
+                old = *link;
+                node->next = old ? old->next : nullptr;
+                *link = node;
+                // 存活字节数按节点算（节点头 + 值），替换时加上差值（可能是负的，靠无符号回绕减回去）
+                size_t added = sizeof(Node) + size;
+                liveBytes_.fetch_add(old ? added - (sizeof(Node) + old->size) : added, std::memory_order_relaxed);
+            }
+            if (old) Alloc::deallocate(old, sizeof(Node) + old->size);
+        }
+
+        size_t liveBytes() const { return liveBytes_.load(std::memory_order_relaxed); }
+
+    private:
+        struct Node
+        {
+            Node* next;
+            uint64_t key;
+            uint32_t size;
+            char* value() { return reinterpret_cast<char*>(this + 1); }
+        };
+
+        struct alignas(64) Shard
+        {
+            std::mutex lock;
+            std::vector<Node*> buckets;
+        };
+
+        Shard& shardOf(uint64_t key) { return shards_[(key * 0x9E3779B97F4A7C15ull) >> 58]; }
+        static size_t bucketOf(uint64_t key) { return (key * 0xC2B2AE3D27D4EB4Full >> 32) % kBucketsPerShard; }
+
+        std::array<Shard, kShards> shards_;
+        std::atomic<size_t> liveBytes_{ 0 };
+    };
+    static_assert(KvStore<GlibcAllocator>::kShards == 64, "shardOf takes the top 6 bits");
+
+    template <class Alloc>
+    Result runKv(const std::vector<int>& cpus, size_t threads, double seconds)
+    {
+        constexpr uint64_t kKeys = 200000;
+        KvStore<Alloc> store;
+        {
+            std::mt19937 gen(42);
+            for (uint64_t key = 0; key < kKeys; ++key) store.put(key, 32 + gen() % 481);
+        }
 
-#include "Concurrency-v2.h"
+        Run run(threads);
+        std::vector<uint64_t> ops(threads);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t] {
+                pinTo(cpus[t % cpus.size()]);
+                std::mt19937_64 gen(t + 1);
+                uint64_t n = 0;
+                long checksum = 0;
+                run.arrive();
+                while (run.running())
+                {
+                    for (int i = 0; i < 256; ++i, ++n)
+                    {
+                        uint64_t r = gen();
+                        uint64_t key = r % kKeys;
+                        if ((r >> 32) % 10 == 0) store.put(key, 32 + (r >> 40) % 481);
+                        else checksum += store.get(key);
+                    }
+                }
+                ops[t] = n + (checksum == 42); // 防止读被优化掉
+            });
+        }
 
-using namespace std;
+        Result result{};
+        result.seconds = run.drive(seconds);
+        for (auto& w : workers) w.join();
+        for (uint64_t n : ops) result.ops += n;
+        result.endRssKb = residentKb();
+        result.liveBytes = store.liveBytes();
+        result.ok = true;
+        return result;
+    }
 
-int main()
+    // ---------------------------------------------------------------------
+    // request
+    // ---------------------------------------------------------------------
+
+    // 一个请求里对象大小的分布：70% 16~128，25% 128~1024，5% 1K~16K
+    size_t requestObjectSize(std::mt19937& gen)
+    {
+        uint32_t r = gen();
+        uint32_t pick = r % 100;
+        if (pick < 70) return 16 + (r >> 8) % 113;
+        if (pick < 95) return 128 + (r >> 8) % 897;
+        return 1024 + (r >> 8) % (15 * 1024 + 1);
+    }
+
+    template <class Alloc>
+    Result runRequest(const std::vector<int>& cpus, size_t threads, double seconds)
+    {
+        Run run(threads);
+        std::atomic<uint64_t> nextRequest{ 0 }; // 线程池的任务队列：空闲的线程领下一个请求号
+        std::vector<uint64_t> ops(threads);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t] {
+                pinTo(cpus[t % cpus.size()]);
+                std::mt19937 gen(static_cast<uint32_t>(t + 1));
+                std::vector<std::pair<void*, size_t>> objects;
+                objects.reserve(256);
+                uint64_t n = 0;
+                run.arrive();
+                while (run.running())
+                {
+                    nextRequest.fetch_add(1, std::memory_order_relaxed);
+                    size_t count = 20 + gen() % 181;
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        size_t size = requestObjectSize(gen);
+                        void* p = Alloc::allocate(size);
+                        std::memset(p, static_cast<int>(i), std::min<size_t>(size, 64)); // 请求处理时会写对象开头的几条缓存行
+                        objects.emplace_back(p, size);
+                    }
+                    // 请求结束，整个作用域的对象一起释放
+                    for (auto [p, size] : objects) Alloc::deallocate(p, size);
+                    objects.clear();
+                    ++n;
+                }
+                ops[t] = n;
+            });
+        }
+
+        Result result{};
+        result.seconds = run.drive(seconds);
+        for (auto& w : workers) w.join();
+        for (uint64_t n : ops) result.ops += n;
+        result.endRssKb = residentKb();
+        result.ok = true;
+        return result;
+    }
+
+    // ---------------------------------------------------------------------
+    // pipeline
+    // ---------------------------------------------------------------------
+
+    // 单生产者单消费者的环形队列
+    struct alignas(64) Ring
+    {
+        static constexpr size_t kCapacity = 1024;
+        std::array<std::pair<void*, size_t>, kCapacity> slots;
+        alignas(64) std::atomic<size_t> head{ 0 }; // 消费者
+        alignas(64) std::atomic<size_t> tail{ 0 }; // 生产者
+    };
+
+    template <class Alloc>
+    Result runPipeline(const std::vector<int>& cpus, size_t threads, double seconds)
+    {
+        size_t pairs = std::max<size_t>(threads / 2, 1);
+        Run run(pairs * 2);
+        std::vector<Ring> rings(pairs);
+        std::vector<uint64_t> ops(pairs);
+        std::atomic<bool> bad{ false };
+        std::vector<std::thread> workers;
+        for (size_t p = 0; p < pairs; ++p)
+        {
+            workers.emplace_back([&, p] {
+                pinTo(cpus[(2 * p) % threads % cpus.size()]);
+                Ring& ring = rings[p];
+                std::mt19937 gen(static_cast<uint32_t>(p + 1));
+                run.arrive();
+                while (run.running())
+                {
+                    size_t tail = ring.tail.load(std::memory_order_relaxed);
+                    if (tail - ring.head.load(std::memory_order_acquire) == Ring::kCapacity)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    size_t size = 64 + gen() % 961;
+                    void* msg = Alloc::allocate(size);
+                    std::memset(msg, static_cast<int>(size), std::min<size_t>(size, 64));
+                    ring.slots[tail % Ring::kCapacity] = { msg, size };
+                    ring.tail.store(tail + 1, std::memory_order_release);
+                }
+            });
+            workers.emplace_back([&, p] {
+                pinTo(cpus[(2 * p + 1) % threads % cpus.size()]);
+                Ring& ring = rings[p];
+                uint64_t n = 0;
+                run.arrive();
+                for (;;)
+                {
+                    size_t head = ring.head.load(std::memory_order_relaxed);
+                    if (head == ring.tail.load(std::memory_order_acquire))
+                    {
+                        if (!run.running()) break;
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    auto [msg, size] = ring.slots[head % Ring::kCapacity];
+                    if (static_cast<unsigned char*>(msg)[0] != static_cast<unsigned char>(size)) bad = true;
+                    Alloc::deallocate(msg, size); // 在另一个线程上释放
+                    ring.head.store(head + 1, std::memory_order_release);
+                    ++n;
+                }
+                ops[p] = n;
+            });
+        }
+
+        Result result{};
+        result.seconds = run.drive(seconds);
+        for (auto& w : workers) w.join();
+        // 消费者在生产者停下之后把队列取空才退出，不会漏掉没释放的消息
+        for (uint64_t n : ops) result.ops += n;
+        result.endRssKb = residentKb();
+        result.ok = !bad;
+        return result;
+    }
+
+    // ---------------------------------------------------------------------
+    // fragmentation
+    // ---------------------------------------------------------------------
+    template <class Alloc>
+    Result runFragmentation(const std::vector<int>& cpus, size_t threads, double seconds)
+    {
+        constexpr size_t kShortLived = 64;      // 短命对象：FIFO，分配 64 次之后释放
+        constexpr size_t kLongLived = 20000;    // 每个线程最多攥着这么多个长期对象
+        constexpr uint64_t kPhaseOps = 1 << 16; // 每隔这么多次分配换一次大小分布
+
+        Run run(threads);
+        std::vector<uint64_t> ops(threads);
+        std::vector<size_t> liveBytes(threads);
+        std::atomic<size_t> finished{ 0 };
+        std::atomic<bool> measured{ false };
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t] {
+                pinTo(cpus[t % cpus.size()]);
+                std::mt19937 gen(static_cast<uint32_t>(t + 1));
+                std::vector<std::pair<void*, size_t>> shortLived(kShortLived, { nullptr, 0 });
+                std::vector<std::pair<void*, size_t>> longLived;
+                longLived.reserve(kLongLived);
+                size_t live = 0;
+                uint64_t n = 0;
+                run.arrive();
+                while (run.running())
+                {
+                    // 每个阶段的大小集中在一个 2 倍的区间里：8~16、16~32 …… 4K~8K 轮流来
+                    size_t phase = (n / kPhaseOps) % 10;
+                    size_t lo = size_t(8) << phase;
+                    size_t size = lo + gen() % lo;
+                    void* p = Alloc::allocate(size);
+                    std::memset(p, 1, std::min<size_t>(size, 16));
+                    live += size;
+
+                    if (gen() % 100 < 5)
+                    {
+                        if (longLived.size() < kLongLived) longLived.emplace_back(p, size);
+                        else
+                        {
+                            auto& victim = longLived[gen() % kLongLived];
+                            Alloc::deallocate(victim.first, victim.second);
+                            live -= victim.second;
+                            victim = { p, size };
+                        }
+                    }
+                    else
+                    {
+                        auto& slot = shortLived[n % kShortLived];
+                        if (slot.first)
+                        {
+                            Alloc::deallocate(slot.first, slot.second);
+                            live -= slot.second;
+                        }
+                        slot = { p, size };
+                    }
+                    ++n;
+                }
+                ops[t] = n;
+                liveBytes[t] = live;
+
+                // 所有线程都停下之后由主线程量一下 RSS，量完再清理
+                finished.fetch_add(1);
+                while (!measured.load(std::memory_order_acquire)) std::this_thread::yield();
+                for (auto [q, size] : shortLived) if (q) Alloc::deallocate(q, size);
+                for (auto [q, size] : longLived) Alloc::deallocate(q, size);
+            });
+        }
+
+        Result result{};
+        result.seconds = run.drive(seconds);
+        while (finished.load() < threads) std::this_thread::yield();
+        result.endRssKb = residentKb();
+        measured.store(true, std::memory_order_release);
+        for (auto& w : workers) w.join();
+        for (size_t t = 0; t < threads; ++t)
+        {
+            result.ops += ops[t];
+            result.liveBytes += liveBytes[t];
+        }
+        result.ok = true;
+        return result;
+    }
+
+    // ---------------------------------------------------------------------
+
+    template <class Alloc>
+    Result runWorkload(const std::string& workload, const std::vector<int>& cpus, size_t threads, double seconds)
+    {
+        if (workload == "kv") return runKv<Alloc>(cpus, threads, seconds);
+        if (workload == "request") return runRequest<Alloc>(cpus, threads, seconds);
+        if (workload == "pipeline") return runPipeline<Alloc>(cpus, threads, seconds);
+        return runFragmentation<Alloc>(cpus, threads, seconds);
+    }
+
+    Result runInChild(const std::string& workload, const std::string& allocator, const std::vector<int>& cpus, size_t threads, double seconds)
+    {
+        Result result{};
+        int fds[2];
+        if (pipe(fds) != 0) return result;
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            Result r{};
+            if (allocator == "pool") r = runWorkload<PoolAllocator>(workload, cpus, threads, seconds);
+            else if (allocator == "pool-locked") r = runWorkload<LockedPoolAllocator>(workload, cpus, threads, seconds);
+            else r = runWorkload<GlibcAllocator>(workload, cpus, threads, seconds);
+
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            r.peakRssKb = usage.ru_maxrss;
+            ssize_t written = write(fds[1], &r, sizeof(r));
+            _exit(written == sizeof(r) ? 0 : 1);
+        }
+
+        close(fds[1]);
+        if (pid > 0)
+        {
+            if (read(fds[0], &result, sizeof(result)) != sizeof(result)) result.ok = false;
+            waitpid(pid, nullptr, 0);
+        }
+        close(fds[0]);
+        return result;
+    }
+
+    std::vector<std::string> split(const std::string& list)
+    {
+        std::vector<std::string> items;
+        size_t start = 0;
+        while (start <= list.size())
+        {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) items.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return items;
+    }
+
+    bool known(const std::string& item, std::initializer_list<const char*> names)
+    {
+        for (const char* name : names) if (item == name) return true;
+        return false;
+    }
+
+    void usage(const char* argv0)
+    {
+        std::fprintf(stderr,
+            "usage: %s [--workloads kv,request,pipeline,fragmentation] [--allocators pool,pool-locked,glibc]\n"
+            "          [--max-threads N] [--seconds S] [--csv FILE]\n",
+            argv0);
+    }
+}
+
+int main(int argc, char** argv)
 {
-	cout << "Hello CMake." << endl;
-	return 0;
+    std::vector<std::string> workloads = { "kv", "request", "pipeline", "fragmentation" };
+    std::vector<std::string> allocators = { "pool", "glibc" };
+    std::vector<int> cpus = availableCpus();
+    size_t maxThreads = cpus.size();
+    double seconds = 1.0;
+    std::string csvPath;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        if (arg == "--workloads") workloads = split(value);
+        else if (arg == "--allocators") allocators = split(value);
+        else if (arg == "--max-threads") maxThreads = std::max<size_t>(std::stoul(value), 1);
+        else if (arg == "--seconds") seconds = std::stod(value);
+        else if (arg == "--csv") csvPath = value;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (const std::string& w : workloads)
+    {
+        if (!known(w, { "kv", "request", "pipeline", "fragmentation" })) { usage(argv[0]); return 1; }
+    }
+    for (const std::string& a : allocators)
+    {
+        if (!known(a, { "pool", "pool-locked", "glibc" })) { usage(argv[0]); return 1; }
+    }
+
+    std::printf("%zu cpus available, threads pinned in order\n", cpus.size());
+    std::printf("%-14s %-12s %4s %12s %8s %11s %11s %9s\n",
+        "workload", "allocator", "thr", "Mops/s", "speedup", "peak RSS", "end RSS", "RSS/live");
+    std::string csv = "workload,allocator,threads,seconds,ops,mops,speedup,peak_rss_kb,end_rss_kb,live_bytes\n";
+    bool failed = false;
+
+    for (const std::string& workload : workloads)
+    {
+        for (const std::string& allocator : allocators)
+        {
+            double base = 0;
+            for (size_t threads = 1; threads <= maxThreads; ++threads)
+            {
+                Result r = runInChild(workload, allocator, cpus, threads, seconds);
+                if (!r.ok)
+                {
+                    std::fprintf(stderr, "%s %s x%zu failed\n", workload.c_str(), allocator.c_str(), threads);
+                    failed = true;
+                    continue;
+                }
+                double mops = r.ops / r.seconds / 1e6;
+                if (threads == 1) base = mops;
+                double speedup = base > 0 ? mops / base : 0;
+
+                char ratio[32] = "-";
+                if (r.liveBytes) std::snprintf(ratio, sizeof(ratio), "%.2f", r.endRssKb * 1024.0 / r.liveBytes);
+                std::printf("%-14s %-12s %4zu %12.3f %8.2f %8ld KB %8zu KB %9s\n",
+                    workload.c_str(), allocator.c_str(), threads, mops, speedup, r.peakRssKb, r.endRssKb, ratio);
+                std::fflush(stdout);
+
+                char line[256];
+                std::snprintf(line, sizeof(line), "%s,%s,%zu,%.6f,%llu,%.4f,%.3f,%ld,%zu,%zu\n",
+                    workload.c_str(), allocator.c_str(), threads, r.seconds, static_cast<unsigned long long>(r.ops),
+                    mops, speedup, r.peakRssKb, r.endRssKb, r.liveBytes);
+                csv += line;
+            }
+        }
+    }
+
+    if (!csvPath.empty())
+    {
+        std::FILE* file = std::fopen(csvPath.c_str(), "w");
+        if (!file)
+        {
+            std::fprintf(stderr, "cannot write %s\n", csvPath.c_str());
+            return 1;
+        }
+        std::fwrite(csv.data(), 1, csv.size(), file);
+        std::fclose(file);
+    }
+    return failed ? 1 : 0;
 }
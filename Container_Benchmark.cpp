@@ -0,0 +1,282 @@
+// 标准库容器的基准：节点从 PoolAllocator（见 PoolAllocator.h）拿和从 std::allocator（glibc malloc）拿比一比
+//
+//   ./ContainerBenchmark [--containers list,map,unordered_map,deque] [--allocators std,pool]
+//                        [--elements 100000] [--rounds 20] [--csv out.csv]
+//
+// 每一轮对一个空容器做：
+//   list：尾部插入 elements 个，删掉一半（隔一个删一个），头部再插入 elements / 2 个，遍历一遍，清空
+//   map / unordered_map：插入 elements 个随机的键，每个键查一次，删掉一半，清空
+//   deque：尾部插入 elements 个，头部弹出一半，头部再插入一半，遍历一遍，清空
+// 吞吐按元素操作算（一次插入、查找或者删除算一次，clear 掉的每个元素也算一次删除），键事先生成好；
+// 每一组都在 fork 出来的子进程里跑，峰值 RSS 只算这一组自己的。这个程序没有 LD_PRELOAD 内存池的话 std 就是 glibc
+#include "PoolAllocator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    struct Config
+    {
+        std::string container;
+        std::string allocator;
+        size_t elements;
+        size_t rounds;
+    };
+
+    // 子进程通过管道原样传回来，只能有平凡类型
+    struct Result
+    {
+        bool ok;
+        double seconds;
+        uint64_t ops;
+        uint64_t checksum; // 遍历、查找的结果，免得被优化掉
+        long peakRssKb;
+    };
+
+    template <template <class> class Alloc>
+    uint64_t runList(const Config& config, uint64_t& ops)
+    {
+        std::list<uint64_t, Alloc<uint64_t>> list;
+        uint64_t sum = 0;
+        for (size_t round = 0; round < config.rounds; ++round)
+        {
+            for (size_t i = 0; i < config.elements; ++i) list.push_back(i);
+            bool drop = false;
+            for (auto it = list.begin(); it != list.end(); drop = !drop)
+            {
+                it = drop ? list.erase(it) : std::next(it);
+            }
+            size_t erased = config.elements - list.size();
+            for (size_t i = 0; i < config.elements / 2; ++i) list.push_front(i);
+            for (uint64_t v : list) sum += v;
+            ops += config.elements + erased + config.elements / 2 + list.size();
+            list.clear();
+        }
+        return sum;
+    }
+
+    template <class Map>
+    uint64_t runMap(const Config& config, const std::vector<uint64_t>& keys, uint64_t& ops)
+    {
+        Map map;
+        uint64_t sum = 0;
+        for (size_t round = 0; round < config.rounds; ++round)
+        {
+            for (uint64_t key : keys) map.emplace(key, key);
+            for (uint64_t key : keys) sum += map.find(key)->second;
+            size_t inserted = map.size();
+            for (size_t i = 0; i < keys.size(); i += 2) map.erase(keys[i]);
+            ops += inserted + keys.size() + (inserted - map.size()) + map.size();
+            map.clear();
+        }
+        return sum;
+    }
+
+    template <template <class> class Alloc>
+    uint64_t runDeque(const Config& config, uint64_t& ops)
+    {
+        std::deque<uint64_t, Alloc<uint64_t>> deque;
+        uint64_t sum = 0;
+        for (size_t round = 0; round < config.rounds; ++round)
+        {
+            for (size_t i = 0; i < config.elements; ++i) deque.push_back(i);
+            for (size_t i = 0; i < config.elements / 2; ++i) deque.pop_front();
+            for (size_t i = 0; i < config.elements / 2; ++i) deque.push_front(i);
+            for (uint64_t v : deque) sum += v;
+            ops += config.elements + config.elements / 2 * 2 + deque.size();
+            deque.clear();
+        }
+        return sum;
+    }
+
+    template <template <class> class Alloc>
+    Result runConfig(const Config& config)
+    {
+        using Key = uint64_t;
+        using Value = std::pair<const Key, Key>;
+        std::vector<Key> keys(config.elements);
+        std::mt19937_64 gen(1);
+        for (Key& key : keys) key = gen();
+
+        Result result{};
+        auto start = std::chrono::steady_clock::now();
+        if (config.container == "list") result.checksum = runList<Alloc>(config, result.ops);
+        else if (config.container == "map")
+        {
+            result.checksum = runMap<std::map<Key, Key, std::less<Key>, Alloc<Value>>>(config, keys, result.ops);
+        }
+        else if (config.container == "unordered_map")
+        {
+            result.checksum = runMap<std::unordered_map<Key, Key, std::hash<Key>, std::equal_to<Key>, Alloc<Value>>>(config, keys, result.ops);
+        }
+        else result.checksum = runDeque<Alloc>(config, result.ops);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.ok = true;
+        return result;
+    }
+
+    Result runInChild(const Config& config)
+    {
+        Result result{};
+        int fds[2];
+        if (pipe(fds) != 0) return result;
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            Result r = config.allocator == "pool" ? runConfig<PoolAllocator>(config) : runConfig<std::allocator>(config);
+
+            rusage usage{};
+            getrusage(RUSAGE_SELF, &usage);
+            r.peakRssKb = usage.ru_maxrss; // Linux 上单位是 KB
+            ssize_t written = write(fds[1], &r, sizeof(r));
+            _exit(written == sizeof(r) ? 0 : 1);
+        }
+
+        close(fds[1]);
+        if (pid > 0)
+        {
+            if (read(fds[0], &result, sizeof(result)) != sizeof(result)) result.ok = false;
+            waitpid(pid, nullptr, 0);
+        }
+        close(fds[0]);
+        return result;
+    }
+
+    std::vector<std::string> split(const std::string& list)
+    {
+        std::vector<std::string> items;
+        size_t start = 0;
+        while (start <= list.size())
+        {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            if (end > start) items.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return items;
+    }
+
+    void usage(const char* argv0)
+    {
+        std::fprintf(stderr,
+            "usage: %s [--containers list,map,unordered_map,deque] [--allocators std,pool]\n"
+            "          [--elements N] [--rounds N] [--csv FILE]\n",
+            argv0);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> containers = { "list", "map", "unordered_map", "deque" };
+    std::vector<std::string> allocators = { "std", "pool" };
+    size_t elements = 100000;
+    size_t rounds = 20;
+    std::string csvPath;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[i + 1];
+        if (arg == "--containers") containers = split(value);
+        else if (arg == "--allocators") allocators = split(value);
+        else if (arg == "--elements") elements = std::max<size_t>(std::stoul(value), 2);
+        else if (arg == "--rounds") rounds = std::max<size_t>(std::stoul(value), 1);
+        else if (arg == "--csv") csvPath = value;
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (const std::string& c : containers)
+    {
+        if (c != "list" && c != "map" && c != "unordered_map" && c != "deque")
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (const std::string& a : allocators)
+    {
+        if (a != "std" && a != "pool")
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::printf("%-14s %-6s %10s %8s %8s %10s\n", "container", "alloc", "Mops/s", "ns/op", "vs std", "peak RSS");
+    std::string csv = "container,allocator,elements,rounds,ops,seconds,mops,peak_rss_kb\n";
+    bool failed = false;
+
+    for (const std::string& container : containers)
+    {
+        double base = 0;
+        uint64_t checksum = 0;
+        for (const std::string& allocator : allocators)
+        {
+            Config config{ container, allocator, elements, rounds };
+            Result r = runInChild(config);
+            if (!r.ok)
+            {
+                std::fprintf(stderr, "%s %s failed\n", container.c_str(), allocator.c_str());
+                failed = true;
+                continue;
+            }
+            // 两种分配器做的是同样的操作，结果必须一样
+            if (checksum && r.checksum != checksum)
+            {
+                std::fprintf(stderr, "%s %s: checksum mismatch\n", container.c_str(), allocator.c_str());
+                failed = true;
+            }
+            checksum = r.checksum;
+
+            double mops = r.ops / r.seconds / 1e6;
+            if (allocator == "std") base = mops;
+            char ratio[32] = "-";
+            if (base > 0) std::snprintf(ratio, sizeof(ratio), "%.2fx", mops / base);
+            std::printf("%-14s %-6s %10.2f %8.1f %8s %7ld KB\n",
+                container.c_str(), allocator.c_str(), mops, 1e3 / mops, ratio, r.peakRssKb);
+            std::fflush(stdout);
+
+            char line[256];
+            std::snprintf(line, sizeof(line), "%s,%s,%zu,%zu,%llu,%.6f,%.3f,%ld\n", container.c_str(), allocator.c_str(),
+                elements, rounds, static_cast<unsigned long long>(r.ops), r.seconds, mops, r.peakRssKb);
+            csv += line;
+        }
+    }
+
+    if (!csvPath.empty())
+    {
+        std::FILE* file = std::fopen(csvPath.c_str(), "w");
+        if (!file)
+        {
+            std::fprintf(stderr, "cannot write %s\n", csvPath.c_str());
+            return 1;
+        }
+        std::fwrite(csv.data(), 1, csv.size(), file);
+        std::fclose(file);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,460 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "common.h"
+#include "MetadataAllocator.h"
+#include "ThreadCache.h"
+
+// 每个CPU一份的前端缓存（tcmalloc 的 per-CPU 模式），编译时定义 MEMORYPOOL_PERCPU 打开
+//
+// ThreadCache 是每个线程一份：几千个线程的服务里每个线程都攥着一些块，总的缓存量跟着线程数涨，
+// 线程大部分时间又在睡觉，缓存着的块谁也用不上。按CPU缓存的话总量只跟核数有关，
+// 同一个核上轮流跑的线程用的是同一份缓存。
+//
+// 难点是不加锁、不用原子指令也要保证同一个CPU上的操作互斥：用 Linux 的 restartable sequences（rseq）。
+// 每个操作是一小段汇编（临界区），只有最后一条指令（提交）是对共享数据的写；
+// 线程在临界区中间被抢占、迁移到别的CPU、或者收到信号时，内核把它跳到 abort 入口，
+// 这里的 abort 入口什么都不做，直接报告"被打断"，调用方重新读一遍当前CPU再来。
+//
+// 每个CPU上每个大小类是一个以块自身前 8 字节串起来的栈，链表头和块数打包在一个 64 位字里：
+//   低 48 位是链表头指针（x86-64 用户态地址只有 47 位），高 16 位是块数
+// 这样一次存储就能同时提交链表头和块数。链表最长 capacity(index) 块，取空了从中心缓存拿一批，
+// 放满了还一批回去，每个CPU最多缓存 大小类个数 * kMaxBatches 批（默认配置下不到 2MB）。
+//
+// 需要 glibc 2.35 以上：glibc 会在每个线程启动时注册 rseq 区域，这里直接用（__rseq_offset / __rseq_size）。
+// 没有注册成功的线程（老内核、GLIBC_TUNABLES=glibc.pthread.rseq=0、不经过 glibc 创建的线程）available() 返回 false，
+// MemoryPool 继续走 ThreadCache。两边的块都来自同一个中心缓存，从哪边分配出去的块都可以从另一边释放
+#if defined(MEMORYPOOL_PERCPU) && defined(__linux__) && defined(__x86_64__) && defined(__GNUC__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#ifdef RSEQ_SIG
+#define MEMORYPOOL_RSEQ 1
+static_assert(RSEQ_SIG == 0x53053053, "abort handlers below embed the x86 rseq signature");
+#endif
+#endif
+
+// Policy 和 BasicThreadCache 的一样（见 PoolPolicy.h），每种配置各有一套每CPU的链表
+template <class Policy>
+class BasicCpuCache
+{
+public:
+    using SizeClass = typename Policy::SizeClass;
+    using CentralCache = typename Policy::CentralCache;
+    using ThreadCache = BasicThreadCache<Policy>;
+    static constexpr size_t kNumClasses = SizeClass::kNumClasses;
+
+#ifdef MEMORYPOOL_RSEQ
+    // 当前线程能不能用 CPU 缓存（rseq 注册成功了）
+    static bool available()
+    {
+        return __rseq_size != 0 && static_cast<int32_t>(rseqArea()->cpu_id) >= 0;
+    }
+
+    static void* allocate(size_t size);
+    static void deallocate(void* ptr, size_t size);
+    static void deallocate(void* ptr);
+
+    // 所有CPU缓存里一共缓存了多少字节（只是个快照）
+    static size_t totalCachedBytes();
+
+#if MEMORYPOOL_STATS
+    static void collectStats(MemoryPoolStats& stats);
+#endif
+#else
+    static constexpr bool available() { return false; }
+    static void* allocate(size_t) { return nullptr; }
+    static void deallocate(void*, size_t) {}
+    static void deallocate(void*) {}
+    static constexpr size_t totalCachedBytes() { return 0; }
+    static void collectStats(MemoryPoolStats&) {}
+#endif
+
+    static constexpr size_t kMaxBatches = 4;
+    static constexpr size_t kMaxCpus = 1024; // 更大的CPU编号走 ThreadCache
+
+    // 每个CPU上 index 这个大小类最多缓存几块
+    static constexpr size_t capacity(size_t index)
+    {
+        return kMaxBatches * SizeClass::kTable.numToMove[index];
+    }
+
+#ifdef MEMORYPOOL_RSEQ
+private:
+    static constexpr uint64_t kPtrMask = (uint64_t(1) << 48) - 1;
+    static constexpr int kCountShift = 48;
+
+    struct alignas(64) Slab // 按缓存行对齐，不同CPU的链表头不会落在同一行里
+    {
+        std::array<uint64_t, kNumClasses> lists; // 只在本CPU的 rseq 临界区里写
+
+#if MEMORYPOOL_STATS
+        // 次数统计（见 PoolStats.h），和 ThreadCache 一样是 load + store，不是原子加：
+        // 一个线程在加法中间被抢占、同一个CPU上的另一个线程也来加的话会丢一次计数，统计用不在乎
+        std::array<std::atomic<uint64_t>, kNumClasses> allocs{};
+        std::array<std::atomic<uint64_t>, kNumClasses> frees{};
+        std::atomic<uint64_t> misses{ 0 };
+        std::atomic<uint64_t> returns{ 0 };
+#endif
+    };
+
+    enum Status { kOk = 0, kFull = 1, kAborted = 2 };
+
+    static struct rseq* rseqArea()
+    {
+        return reinterpret_cast<struct rseq*>(static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+    }
+
+    static Slab* slabFor(uint32_t cpu);
+    static Slab* currentSlab() { return slabFor(__atomic_load_n(&rseqArea()->cpu_id_start, __ATOMIC_RELAXED)); }
+    static void* refill(size_t index);
+    static void overflow(size_t index, void* ptr);
+    static void pushChain(size_t index, void* head, void* tail, size_t num);
+    static void returnChain(size_t index, void* head, size_t num);
+
+    static Status rseqPop(uint64_t* list, struct rseq* rs, uint32_t cpu, void*& block);
+    static Status rseqPush(uint64_t* list, struct rseq* rs, uint32_t cpu, void* head, void* tail, size_t num, size_t cap);
+    static Status rseqTakeAll(uint64_t* list, struct rseq* rs, uint32_t cpu, uint64_t& word);
+
+    // 第一次在某个CPU上分配时才建这个CPU的 Slab
+    static inline std::array<std::atomic<Slab*>, kMaxCpus> slabs_{};
+#endif
+};
+
+#ifdef MEMORYPOOL_RSEQ
+
+// 临界区描述符和 abort 入口，见内核文档 Documentation/userspace-api/rseq.rst：
+//   3: 描述符 { version, flags, start_ip = 1, post_commit_offset = 2 - 1, abort_ip = 4 }
+//   1: 临界区开始，第一件事是确认还在 cpu 上；2: 提交（最后一条写）之后
+//   4: abort 入口，前面 4 字节必须是注册时的签名（这里包成一条 ud1 指令，反汇编不会乱）
+#define MEMORYPOOL_RSEQ_BEGIN                                   \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                        \
+    ".balign 32\n\t"                                            \
+    "3:\n\t"                                                    \
+    ".long 0x0, 0x0\n\t"                                        \
+    ".quad 1f, (2f - 1f), 4f\n\t"                               \
+    ".popsection\n\t"                                           \
+    "leaq 3b(%%rip), %%rax\n\t"                                 \
+    "movq %%rax, %[rseq_cs]\n\t"                                \
+    "1:\n\t"                                                    \
+    "cmpl %[cpu], %[cpu_id]\n\t"                                \
+    "jnz 4f\n\t"
+
+#define MEMORYPOOL_RSEQ_ABORT                                   \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                   \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                \
+    ".long 0x53053053\n\t"                                      \
+    "4:\n\t"                                                    \
+    "movl $2, %[status]\n\t"                                    \
+    "jmp 5f\n\t"                                                \
+    ".popsection\n\t"                                           \
+    "5:\n\t"
+
+// 弹出链表头，链表是空的时候 block 为 nullptr
+template <class Policy>
+inline typename BasicCpuCache<Policy>::Status BasicCpuCache<Policy>::rseqPop(uint64_t* list, struct rseq* rs, uint32_t cpu, void*& block)
+{
+    int status = kOk;
+    uint64_t head;
+    asm volatile(
+        MEMORYPOOL_RSEQ_BEGIN
+        "movq %[list], %%rax\n\t"
+        "movabsq $0xffffffffffff, %[head]\n\t"
+        "andq %%rax, %[head]\n\t"
+        "jz 5f\n\t"
+        "movq (%[head]), %%rcx\n\t"       // 下一块
+        "shrq $48, %%rax\n\t"
+        "decq %%rax\n\t"
+        "shlq $48, %%rax\n\t"
+        "orq %%rcx, %%rax\n\t"
+        "movq %%rax, %[list]\n\t"         // 提交
+        "2:\n\t"
+        MEMORYPOOL_RSEQ_ABORT
+        : [head] "=&r"(head), [status] "+r"(status)
+        : [rseq_cs] "m"(rs->rseq_cs), [cpu_id] "m"(rs->cpu_id), [cpu] "r"(cpu), [list] "m"(*list)
+        : "rax", "rcx", "memory", "cc");
+    block = reinterpret_cast<void*>(head);
+    return static_cast<Status>(status);
+}
+
+// 把 head..tail 这 num 块接到链表前面，放不下返回 kFull
+// tail 的 next 在提交之前就写了：tail 是调用方自己的块，被打断重来也只是再写一遍
+template <class Policy>
+inline typename BasicCpuCache<Policy>::Status BasicCpuCache<Policy>::rseqPush(uint64_t* list, struct rseq* rs, uint32_t cpu,
+    void* head, void* tail, size_t num, size_t cap)
+{
+    int status = kOk;
+    asm volatile(
+        MEMORYPOOL_RSEQ_BEGIN
+        "movq %[list], %%rax\n\t"
+        "movq %%rax, %%rcx\n\t"
+        "shrq $48, %%rcx\n\t"
+        "addq %[num], %%rcx\n\t"
+        "cmpq %[cap], %%rcx\n\t"
+        "ja 6f\n\t"
+        "movabsq $0xffffffffffff, %%rdx\n\t"
+        "andq %%rax, %%rdx\n\t"
+        "movq %%rdx, (%[tail])\n\t"
+        "shlq $48, %%rcx\n\t"
+        "orq %[head], %%rcx\n\t"
+        "movq %%rcx, %[list]\n\t"         // 提交
+        "2:\n\t"
+        "jmp 5f\n\t"
+        "6:\n\t"
+        "movl $1, %[status]\n\t"
+        "jmp 5f\n\t"
+        MEMORYPOOL_RSEQ_ABORT
+        : [status] "+r"(status)
+        : [rseq_cs] "m"(rs->rseq_cs), [cpu_id] "m"(rs->cpu_id), [cpu] "r"(cpu), [list] "m"(*list),
+          [head] "r"(head), [tail] "r"(tail), [num] "r"(num), [cap] "r"(cap)
+        : "rax", "rcx", "rdx", "memory", "cc");
+    return static_cast<Status>(status);
+}
+
+// 把整条链表拿走（链表头 + 块数），链表清空
+template <class Policy>
+inline typename BasicCpuCache<Policy>::Status BasicCpuCache<Policy>::rseqTakeAll(uint64_t* list, struct rseq* rs, uint32_t cpu, uint64_t& word)
+{
+    int status = kOk;
+    uint64_t old = 0;
+    asm volatile(
+        MEMORYPOOL_RSEQ_BEGIN
+        "movq %[list], %[old]\n\t"
+        "movq $0, %[list]\n\t"            // 提交
+        "2:\n\t"
+        MEMORYPOOL_RSEQ_ABORT
+        : [old] "+r"(old), [status] "+r"(status)
+        : [rseq_cs] "m"(rs->rseq_cs), [cpu_id] "m"(rs->cpu_id), [cpu] "r"(cpu), [list] "m"(*list)
+        : "rax", "memory", "cc");
+    word = old;
+    return static_cast<Status>(status);
+}
+
+#undef MEMORYPOOL_RSEQ_BEGIN
+#undef MEMORYPOOL_RSEQ_ABORT
+
+template <class Policy>
+inline typename BasicCpuCache<Policy>::Slab* BasicCpuCache<Policy>::slabFor(uint32_t cpu)
+{
+    if (cpu >= kMaxCpus) return nullptr;
+    Slab* slab = slabs_[cpu].load(std::memory_order_acquire);
+    if (slab) return slab;
+
+    void* mem = MetadataAllocator<Slab>::allocate();
+    if (!mem) return nullptr;
+    Slab* fresh = new (mem) Slab();
+    fresh->lists.fill(0);
+    if (slabs_[cpu].compare_exchange_strong(slab, fresh, std::memory_order_acq_rel)) return fresh;
+
+    // 同一个CPU上另一个线程抢先建好了
+    MetadataAllocator<Slab>::deallocate(fresh);
+    return slab;
+}
+
+template <class Policy>
+inline void* BasicCpuCache<Policy>::allocate(size_t size)
+{
+    if (size == 0) size = SizeClass::kAlignment;
+    if (HeapProfiler::tick(size))
+    {
+        if (void* ptr = HeapProfiler::allocateSampled(size)) return ptr;
+    }
+    // 大对象不经过任何前端缓存，和 ThreadCache 共用一条路径
+    if (size > SizeClass::kMaxBytes) return ThreadCache::allocateLarge(size);
+
+    size_t index = SizeClass::getIndex(size);
+    for (;;)
+    {
+        struct rseq* rs = rseqArea();
+        uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+        Slab* slab = slabFor(cpu);
+        if (!slab) return ThreadCache::getInstance()->allocate(size);
+
+        void* block;
+        Status status = rseqPop(&slab->lists[index], rs, cpu, block);
+        if (status == kAborted) continue; // 被抢占或者换了CPU，按新的CPU重来
+#if MEMORYPOOL_STATS
+        statsAdd(slab->allocs[index]);
+#endif
+        if (block) return block;
+        return refill(index);
+    }
+}
+
+template <class Policy>
+inline void BasicCpuCache<Policy>::deallocate(void* ptr, size_t size)
+{
+    if (size > SizeClass::kMaxBytes)
+    {
+        ThreadCache::deallocateLarge(PageCache::getInstance().mapToSpan(ptr));
+        return;
+    }
+    // 可能是被采样的对象，见 ThreadCache::deallocate
+    if ((reinterpret_cast<uintptr_t>(ptr) & (PageCache::PAGE_SIZE - 1)) == 0)
+    {
+        deallocate(ptr);
+        return;
+    }
+    overflow(SizeClass::getIndex(size), ptr);
+}
+
+template <class Policy>
+inline void BasicCpuCache<Policy>::deallocate(void* ptr)
+{
+    if (!ptr) return;
+    Span* span = PageCache::getInstance().mapToSpan(ptr);
+    assert(span && span->isUse && "Attempt to deallocate unmanaged memory!");
+    if (span->objSize == 0)
+    {
+        ThreadCache::deallocateLarge(span);
+        return;
+    }
+    overflow(span->sizeClass, ptr);
+}
+
+// 当前CPU的链表空了：从中心缓存拿一批，留一块返回，其余放进当前CPU的链表
+template <class Policy>
+inline void* BasicCpuCache<Policy>::refill(size_t index)
+{
+    size_t num = SizeClass::numToMove(index);
+    void* start = CentralCache::getInstance().fetchRange(index, num);
+    if (!start) return nullptr;
+#if MEMORYPOOL_STATS
+    if (Slab* slab = currentSlab()) statsAdd(slab->misses);
+#endif
+    if (num == 1) return start;
+
+    void* head = *reinterpret_cast<void**>(start);
+    void* tail = head;
+    while (*reinterpret_cast<void**>(tail)) tail = *reinterpret_cast<void**>(tail);
+    pushChain(index, head, tail, num - 1);
+    return start;
+}
+
+// 释放一块：当前CPU的链表放得下就直接放；放满了就把整条链表拿下来，最老的一批还给中心缓存，剩下的连同这一块放回去
+template <class Policy>
+inline void BasicCpuCache<Policy>::overflow(size_t index, void* ptr)
+{
+    for (;;)
+    {
+        struct rseq* rs = rseqArea();
+        uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+        Slab* slab = slabFor(cpu);
+        if (!slab)
+        {
+            ThreadCache::getInstance()->deallocate(ptr, SizeClass::classToSize(index));
+            return;
+        }
+
+        Status status = rseqPush(&slab->lists[index], rs, cpu, ptr, ptr, 1, capacity(index));
+        if (status == kOk)
+        {
+#if MEMORYPOOL_STATS
+            statsAdd(slab->frees[index]);
+#endif
+            return;
+        }
+        if (status == kAborted) continue;
+
+        uint64_t word;
+        if (rseqTakeAll(&slab->lists[index], rs, cpu, word) != kOk) continue;
+#if MEMORYPOOL_STATS
+        statsAdd(slab->frees[index]);
+#endif
+        void* head = reinterpret_cast<void*>(word & kPtrMask);
+        size_t count = word >> kCountShift;
+
+        // 拿下来的链表归自己了，不用再担心别的线程
+        size_t batchNum = std::min(count, SizeClass::numToMove(index));
+        void* rest = head;
+        for (size_t i = 0; i < batchNum; ++i) rest = *reinterpret_cast<void**>(rest);
+        returnChain(index, head, batchNum);
+
+        // 这里的 rest 还是拿下来之后没断开的后半截，链表是以 nullptr 结尾的
+        *reinterpret_cast<void**>(ptr) = rest;
+        void* tail = ptr;
+        while (*reinterpret_cast<void**>(tail)) tail = *reinterpret_cast<void**>(tail);
+        pushChain(index, ptr, tail, count - batchNum + 1);
+        return;
+    }
+}
+
+// 把自己手里的一串块放进当前CPU的链表，放不下就还给中心缓存
+template <class Policy>
+inline void BasicCpuCache<Policy>::pushChain(size_t index, void* head, void* tail, size_t num)
+{
+    for (;;)
+    {
+        struct rseq* rs = rseqArea();
+        uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+        Slab* slab = slabFor(cpu);
+        Status status = slab ? rseqPush(&slab->lists[index], rs, cpu, head, tail, num, capacity(index)) : kFull;
+        if (status == kOk) return;
+        if (status == kFull) break;
+    }
+    *reinterpret_cast<void**>(tail) = nullptr;
+    returnChain(index, head, num);
+}
+
+// 按批还给中心缓存，和 ThreadCache 一样每次最多一批；head 开始的 num 块之后的部分不动
+template <class Policy>
+inline void BasicCpuCache<Policy>::returnChain(size_t index, void* head, size_t num)
+{
+    size_t batchNum = SizeClass::numToMove(index);
+    while (num > 0)
+    {
+        size_t n = std::min(num, batchNum);
+        void* last = head;
+        for (size_t i = 1; i < n; ++i) last = *reinterpret_cast<void**>(last);
+        void* next = *reinterpret_cast<void**>(last);
+        *reinterpret_cast<void**>(last) = nullptr;
+        CentralCache::getInstance().returnRange(head, n * SizeClass::classToSize(index), index);
+#if MEMORYPOOL_STATS
+        if (Slab* slab = currentSlab()) statsAdd(slab->returns);
+#endif
+        head = next;
+        num -= n;
+    }
+}
+
+template <class Policy>
+inline size_t BasicCpuCache<Policy>::totalCachedBytes()
+{
+    size_t total = 0;
+    for (auto& entry : slabs_)
+    {
+        Slab* slab = entry.load(std::memory_order_acquire);
+        if (!slab) continue;
+        for (size_t index = 0; index < kNumClasses; ++index)
+        {
+            uint64_t word = __atomic_load_n(&slab->lists[index], __ATOMIC_RELAXED);
+            total += (word >> kCountShift) * SizeClass::classToSize(index);
+        }
+    }
+    return total;
+}
+
+#if MEMORYPOOL_STATS
+template <class Policy>
+inline void BasicCpuCache<Policy>::collectStats(MemoryPoolStats& stats)
+{
+    for (auto& entry : slabs_)
+    {
+        Slab* slab = entry.load(std::memory_order_acquire);
+        if (!slab) continue;
+        for (size_t index = 0; index < kNumClasses; ++index)
+        {
+            stats.sizeClasses[index].allocs += slab->allocs[index].load(std::memory_order_relaxed);
+            stats.sizeClasses[index].frees += slab->frees[index].load(std::memory_order_relaxed);
+        }
+        stats.frontendMisses += slab->misses.load(std::memory_order_relaxed);
+        stats.centralReturns += slab->returns.load(std::memory_order_relaxed);
+    }
+}
+#endif
+
+#endif // MEMORYPOOL_RSEQ
+
+// 默认配置的CPU缓存
+using CpuCache = BasicCpuCache<DefaultPoolPolicy>;
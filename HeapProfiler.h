@@ -0,0 +1,378 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "PageCache.h"
+#include "MetadataAllocator.h"
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define MEMORYPOOL_HAS_BACKTRACE 1
+#endif
+
+// 一个调用栈，记着从这里抽中的样本
+struct HeapBucket
+{
+    static constexpr int kMaxDepth = 32;
+
+    HeapBucket* next; // 同一个哈希槽里的下一个
+    uint64_t hash;
+    int depth;
+    void* stack[kMaxDepth];
+    uint64_t allocs;
+    uint64_t allocBytes;
+    uint64_t frees;
+    uint64_t freeBytes;
+};
+
+// 一个被采样的对象：属于哪个调用栈，请求的是多大
+struct HeapSample
+{
+    HeapBucket* bucket;
+    size_t size;
+};
+
+// 堆采样（tcmalloc 的 heap profiler），用来回答"内存涨上去是哪些调用点分配的"
+//
+// 平均每分配 interval 字节抽一个样，记下请求的大小和调用栈：
+//   前端缓存的 allocate 里每次只是把本线程的 bytesUntilSample_ 减去 size、判断一下是不是减到了负数，减到了才进慢路径；
+//   两次采样之间隔多少字节服从指数分布（字节流上的几何分布），一个对象被抽中的概率只和它的大小有关，
+//   每个样本代表 1 / (1 - e^(-size/interval)) 个对象，输出的时候按这个折算回去
+// 被抽中的分配不走自由链表，单独找 PageCache 要一个 span（objSize = 0，和大对象一样），Span::sample 指向它的记录，
+// 释放时凭span就知道它是被采样的。每次采样最多多用一页，平均每 interval 字节才一次，浪费可以忽略
+//
+// 调用栈按内容去重，每个不同的调用栈一个 Bucket，记着抽中的分配 / 释放次数和字节数：
+//   正在使用（live heap）= 分配 - 释放，累计分配（cumulative）= 分配
+// 两种输出：
+//   dumpText：人看的，按正在使用的字节数排序，带符号名
+//   dumpPprof：gperftools 的 heap profile 格式（heap_v2），pprof --text / --svg 之类直接能读；
+//              后面附上 /proc/self/maps，pprof 靠它把地址对应回二进制文件和符号
+class HeapProfiler
+{
+public:
+    static constexpr size_t kDefaultInterval = 512 * 1024;
+    static constexpr int kMaxDepth = HeapBucket::kMaxDepth;
+
+    // 开始采样，已经在采的话只是换一个采样间隔；调用的这个线程马上开始按新间隔抽样，其他线程在下一次进慢路径时跟上
+    static void start(size_t interval = kDefaultInterval)
+    {
+        interval = std::max<size_t>(interval, 1);
+        reportInterval_.store(interval, std::memory_order_relaxed);
+        interval_.store(interval, std::memory_order_relaxed);
+        bytesUntilSample_ = 0;
+    }
+
+    // 停止采样：已经记下的样本还在，被采样的对象释放时照样记下来
+    static void stop() { interval_.store(0, std::memory_order_relaxed); }
+
+    static bool enabled() { return interval_.load(std::memory_order_relaxed) != 0; }
+
+    // 抽中的样本的原始计数（没有折算）
+    struct Totals
+    {
+        uint64_t liveObjects = 0;
+        uint64_t liveBytes = 0;
+        uint64_t allocObjects = 0;
+        uint64_t allocBytes = 0;
+    };
+    static Totals sampledTotals();
+
+    static std::string dumpText(size_t maxStacks = 20);
+    static std::string dumpPprof();
+
+    // 前端缓存的快速路径：返回 true 时要调用 allocateSampled
+    static bool tick(size_t size)
+    {
+        bytesUntilSample_ -= static_cast<ptrdiff_t>(size);
+        return bytesUntilSample_ < 0;
+    }
+
+    // 慢路径：抽好下一次的间隔，采样开着的话把这次分配单独放进一个span并记下调用栈；
+    // 返回 nullptr 表示这次不采（没开、或者正在采样 / 输出的过程中又分配了），调用方照常分配
+    static void* allocateSampled(size_t size);
+
+    // Span::sample 不为空的span从这里释放
+    static void deallocateSampled(Span* span);
+
+private:
+    using Bucket = HeapBucket;
+
+    static size_t nextInterval(size_t interval);
+    static Bucket* findBucket(void* const* stack, int depth); // 调用方持有 mutex_
+    static void estimate(const Bucket& bucket, double& liveObjects, double& liveBytes, double& allocObjects, double& allocBytes);
+
+    static constexpr size_t kTableSize = 4096;
+
+    static inline std::atomic<size_t> interval_{ 0 };                     // 0 表示没在采样
+    static inline std::atomic<size_t> reportInterval_{ kDefaultInterval }; // 最近一次 start 的间隔，输出时折算用
+    static inline std::mutex mutex_;                                      // 保护 table_ 和所有 Bucket 的计数
+    static inline std::array<Bucket*, kTableSize> table_{};
+
+    static inline thread_local ptrdiff_t bytesUntilSample_ THREAD_CACHE_TLS_MODEL = 0;
+    static inline thread_local uint64_t rng_ THREAD_CACHE_TLS_MODEL = 0;
+    // 取调用栈（第一次调用 backtrace 时 glibc 要 dlopen libgcc_s）、输出结果时都会分配内存，这时候不再采样，
+    // 也就不会在持有 mutex_ 的时候重入
+    static inline thread_local bool busy_ THREAD_CACHE_TLS_MODEL = false;
+};
+
+inline size_t HeapProfiler::nextInterval(size_t interval)
+{
+    // xorshift64*，每个线程一个种子
+    if (rng_ == 0) rng_ = (reinterpret_cast<uintptr_t>(&rng_) ^ (PageCache::nowMs() * 0x9E3779B97F4A7C15ull)) | 1;
+    rng_ ^= rng_ >> 12;
+    rng_ ^= rng_ << 25;
+    rng_ ^= rng_ >> 27;
+    uint64_t bits = rng_ * 0x2545F4914F6CDD1Dull;
+
+    // (0, 1] 上的均匀分布 -> 均值为 interval 的指数分布
+    double u = static_cast<double>((bits >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double next = -std::log(u) * static_cast<double>(interval);
+    return static_cast<size_t>(std::min(next, 1e15)) + 1;
+}
+
+MEMORYPOOL_NOINLINE inline void* HeapProfiler::allocateSampled(size_t size)
+{
+    size_t interval = interval_.load(std::memory_order_relaxed);
+    if (interval == 0 || busy_)
+    {
+        // 没在采样：隔一个默认间隔再回来看看，start 之后其他线程最多再分配这么多就开始采样
+        bytesUntilSample_ = static_cast<ptrdiff_t>(kDefaultInterval);
+        return nullptr;
+    }
+    bytesUntilSample_ = static_cast<ptrdiff_t>(nextInterval(interval));
+
+    busy_ = true;
+    void* stack[kMaxDepth + 1];
+    int depth = 0;
+#ifdef MEMORYPOOL_HAS_BACKTRACE
+    depth = backtrace(stack, kMaxDepth + 1);
+#endif
+    // 第一层是 allocateSampled 自己
+    int skip = depth > 0 ? 1 : 0;
+
+    void* result = nullptr;
+    size_t numPages = (std::max<size_t>(size, 1) + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+    HeapSample* sample = MetadataAllocator<HeapSample>::allocate();
+    Span* span = sample ? PageCache::getInstance().allocateSpan(numPages) : nullptr;
+    if (span)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Bucket* bucket = findBucket(stack + skip, depth - skip);
+        if (bucket)
+        {
+            ++bucket->allocs;
+            bucket->allocBytes += size;
+            sample->bucket = bucket;
+            sample->size = size;
+            span->objSize = 0;
+            span->sample = sample;
+            result = span->pageAddr;
+        }
+    }
+    if (!result)
+    {
+        if (span) PageCache::getInstance().deallocateSpan(span->pageAddr, span->numPages);
+        if (sample) MetadataAllocator<HeapSample>::deallocate(sample);
+    }
+    busy_ = false;
+    return result;
+}
+
+inline void HeapProfiler::deallocateSampled(Span* span)
+{
+    HeapSample* sample = span->sample;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Bucket* bucket = sample->bucket;
+        ++bucket->frees;
+        bucket->freeBytes += sample->size;
+    }
+    span->sample = nullptr;
+    MetadataAllocator<HeapSample>::deallocate(sample);
+    PageCache::getInstance().deallocateSpan(span->pageAddr, span->numPages);
+}
+
+inline HeapProfiler::Bucket* HeapProfiler::findBucket(void* const* stack, int depth)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < depth; ++i)
+    {
+        hash = (hash ^ reinterpret_cast<uintptr_t>(stack[i])) * 0x100000001b3ull;
+    }
+
+    Bucket*& head = table_[hash % kTableSize];
+    for (Bucket* bucket = head; bucket; bucket = bucket->next)
+    {
+        if (bucket->hash == hash && bucket->depth == depth && std::equal(stack, stack + depth, bucket->stack))
+        {
+            return bucket;
+        }
+    }
+
+    // 调用栈的种类有限，Bucket 一直留着，不释放
+    Bucket* bucket = MetadataAllocator<Bucket>::allocate();
+    if (!bucket) return nullptr;
+    *bucket = Bucket{};
+    bucket->hash = hash;
+    bucket->depth = depth;
+    std::copy(stack, stack + depth, bucket->stack);
+    bucket->next = head;
+    head = bucket;
+    return bucket;
+}
+
+inline void HeapProfiler::estimate(const Bucket& bucket, double& liveObjects, double& liveBytes, double& allocObjects, double& allocBytes)
+{
+    // 和 pprof 读 heap_v2 时一样，按这个调用栈的平均对象大小折算
+    double scale = 1.0;
+    if (bucket.allocs > 0)
+    {
+        double avg = static_cast<double>(bucket.allocBytes) / bucket.allocs;
+        scale = 1.0 / (1.0 - std::exp(-avg / reportInterval_.load(std::memory_order_relaxed)));
+    }
+    liveObjects = (bucket.allocs - bucket.frees) * scale;
+    liveBytes = (bucket.allocBytes - bucket.freeBytes) * scale;
+    allocObjects = bucket.allocs * scale;
+    allocBytes = bucket.allocBytes * scale;
+}
+
+inline HeapProfiler::Totals HeapProfiler::sampledTotals()
+{
+    Totals totals;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Bucket* head : table_)
+    {
+        for (Bucket* bucket = head; bucket; bucket = bucket->next)
+        {
+            totals.liveObjects += bucket->allocs - bucket->frees;
+            totals.liveBytes += bucket->allocBytes - bucket->freeBytes;
+            totals.allocObjects += bucket->allocs;
+            totals.allocBytes += bucket->allocBytes;
+        }
+    }
+    return totals;
+}
+
+inline std::string HeapProfiler::dumpText(size_t maxStacks)
+{
+    struct Row
+    {
+        Bucket bucket;
+        double liveObjects, liveBytes, allocObjects, allocBytes;
+    };
+
+    bool wasBusy = busy_;
+    busy_ = true;
+    std::vector<Row> rows;
+    {
+        // 这里分配的内存都不会被采样（busy_），释放它们也就不会回来拿 mutex_
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Bucket* head : table_)
+        {
+            for (Bucket* bucket = head; bucket; bucket = bucket->next) rows.push_back(Row{ *bucket, 0, 0, 0, 0 });
+        }
+    }
+
+    double liveObjects = 0, liveBytes = 0, allocObjects = 0, allocBytes = 0;
+    for (Row& row : rows)
+    {
+        estimate(row.bucket, row.liveObjects, row.liveBytes, row.allocObjects, row.allocBytes);
+        liveObjects += row.liveObjects;
+        liveBytes += row.liveBytes;
+        allocObjects += row.allocObjects;
+        allocBytes += row.allocBytes;
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.liveBytes != b.liveBytes ? a.liveBytes > b.liveBytes : a.allocBytes > b.allocBytes;
+    });
+
+    std::string out;
+    char line[512];
+    std::snprintf(line, sizeof(line), "heap profile: sampling every %zu bytes on average, %zu stacks\n",
+        reportInterval_.load(std::memory_order_relaxed), rows.size());
+    out += line;
+    std::snprintf(line, sizeof(line), "live      %12.0f objects %16.0f bytes (estimated)\n", liveObjects, liveBytes);
+    out += line;
+    std::snprintf(line, sizeof(line), "allocated %12.0f objects %16.0f bytes (estimated)\n", allocObjects, allocBytes);
+    out += line;
+
+    for (size_t i = 0; i < rows.size() && i < maxStacks; ++i)
+    {
+        const Row& row = rows[i];
+        std::snprintf(line, sizeof(line), "\n#%zu live %.0f bytes in %.0f objects, allocated %.0f bytes in %.0f objects\n",
+            i + 1, row.liveBytes, row.liveObjects, row.allocBytes, row.allocObjects);
+        out += line;
+#ifdef MEMORYPOOL_HAS_BACKTRACE
+        char** symbols = backtrace_symbols(row.bucket.stack, row.bucket.depth);
+#else
+        char** symbols = nullptr;
+#endif
+        for (int frame = 0; frame < row.bucket.depth; ++frame)
+        {
+            if (symbols) std::snprintf(line, sizeof(line), "    %s\n", symbols[frame]);
+            else std::snprintf(line, sizeof(line), "    %p\n", row.bucket.stack[frame]);
+            out += line;
+        }
+        std::free(symbols);
+    }
+    busy_ = wasBusy;
+    return out;
+}
+
+inline std::string HeapProfiler::dumpPprof()
+{
+    bool wasBusy = busy_;
+    busy_ = true;
+    std::string out;
+    char line[128];
+    uint64_t liveObjects = 0, liveBytes = 0, allocObjects = 0, allocBytes = 0;
+    std::string body;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Bucket* head : table_)
+        {
+            for (Bucket* bucket = head; bucket; bucket = bucket->next)
+            {
+                // pprof 自己按 heap_v2/interval 折算，这里给原始的样本数
+                std::snprintf(line, sizeof(line), "%6" PRIu64 ": %8" PRIu64 " [%6" PRIu64 ": %8" PRIu64 "] @",
+                    bucket->allocs - bucket->frees, bucket->allocBytes - bucket->freeBytes, bucket->allocs, bucket->allocBytes);
+                body += line;
+                for (int frame = 0; frame < bucket->depth; ++frame)
+                {
+                    std::snprintf(line, sizeof(line), " %p", bucket->stack[frame]);
+                    body += line;
+                }
+                body += '\n';
+                liveObjects += bucket->allocs - bucket->frees;
+                liveBytes += bucket->allocBytes - bucket->freeBytes;
+                allocObjects += bucket->allocs;
+                allocBytes += bucket->allocBytes;
+            }
+        }
+    }
+
+    std::snprintf(line, sizeof(line), "heap profile: %6" PRIu64 ": %8" PRIu64 " [%6" PRIu64 ": %8" PRIu64 "] @ heap_v2/%zu\n",
+        liveObjects, liveBytes, allocObjects, allocBytes, reportInterval_.load(std::memory_order_relaxed));
+    out += line;
+    out += body;
+
+    out += "\nMAPPED_LIBRARIES:\n";
+    if (std::FILE* maps = std::fopen("/proc/self/maps", "r"))
+    {
+        char buffer[4096];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), maps)) > 0) out.append(buffer, n);
+        std::fclose(maps);
+    }
+    busy_ = wasBusy;
+    return out;
+}
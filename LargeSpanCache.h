@@ -0,0 +1,183 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include "common.h"
+#include "PageCache.h"
+
+// 大对象（> MAX_BYTES）的 span 缓存
+//
+// 大对象本身已经是按整页从 PageCache 要的 span，但每次释放都要进 PageCache 的全局锁、和邻居合并，
+// 下一次同样大小的请求又要从合并后的大span里重新切，0.5~8MB 这种反复申请释放的缓冲区全花在这上面了。
+// 这里把刚释放的大span按页数分桶留一小会儿，同一个桶的请求直接拿走，不经过 PageCache：
+//   页数像小对象的大小类一样分档：每翻一倍切 8 档，请求向上取整到档位，同一个桶里的span可以互换，浪费不超过 12.5%
+//   只缓存不超过 kMaxCachedPages 页的span，总量不超过 kMaxCachedBytes，放不下的直接还给 PageCache
+//   缓存着的span仍然算"正在使用"（isUse = true），scavenger 和 releaseFreeMemory 会先把闲置的还给 PageCache
+class LargeSpanCache
+{
+public:
+    static LargeSpanCache& getInstance()
+    {
+        static LargeSpanCache instance;
+        return instance;
+    }
+
+    static constexpr size_t kMinPages = MAX_BYTES / PageCache::PAGE_SIZE; // 不超过这个页数的span是小对象的
+    static constexpr size_t kMaxCachedPages = 2048;                      // 8MB
+    static constexpr size_t kNumBuckets = 40; // 64 页到 2048 页一共翻了 5 倍，每倍 8 档
+    static constexpr size_t kMaxCachedBytes = 64 * 1024 * 1024;
+
+    // 大对象要 numPages 页时实际分配多少页：能缓存的按档位向上取整，更大的原样
+    static constexpr size_t roundPages(size_t numPages)
+    {
+        if (numPages <= kMinPages || numPages > kMaxCachedPages) return numPages;
+        size_t step = stepOf(numPages);
+        return (numPages + step - 1) / step * step;
+    }
+
+    // 先看缓存，没有再找 PageCache
+    Span* allocate(size_t numPages)
+    {
+        numPages = roundPages(numPages);
+        Span* span = nullptr;
+        if (cacheable(numPages))
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Span*& head = buckets_[bucketIndex(numPages)];
+            if (head)
+            {
+                span = head;
+                head = span->next;
+                span->next = nullptr;
+                cachedPages_ -= span->numPages;
+            }
+        }
+        if (span)
+        {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            span = PageCache::getInstance().allocateSpan(numPages);
+            if (!span) return nullptr;
+        }
+        inUsePages_.fetch_add(span->numPages, std::memory_order_relaxed);
+        return span;
+    }
+
+    // 放得下就留着，放不下就还给 PageCache
+    void deallocate(Span* span)
+    {
+        inUsePages_.fetch_sub(span->numPages, std::memory_order_relaxed);
+        if (cacheable(span->numPages))
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if ((cachedPages_ + span->numPages) * PageCache::PAGE_SIZE <= kMaxCachedBytes)
+            {
+                span->isZero = false;
+                span->freeTime = PageCache::nowMs();
+                Span*& head = buckets_[bucketIndex(span->numPages)];
+                span->next = head;
+                head = span;
+                cachedPages_ += span->numPages;
+                return;
+            }
+        }
+        PageCache::getInstance().deallocateSpan(span->pageAddr, span->numPages);
+    }
+
+    // 缓存里闲置了至少 minIdleMs 毫秒的span都还给 PageCache（之后由 PageCache 决定要不要还给操作系统）
+    void releaseIdle(uint64_t minIdleMs = 0)
+    {
+        Span* idle = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint64_t now = PageCache::nowMs();
+            for (Span*& head : buckets_)
+            {
+                for (Span** link = &head; *link;)
+                {
+                    Span* span = *link;
+                    if (now - span->freeTime >= minIdleMs)
+                    {
+                        *link = span->next;
+                        cachedPages_ -= span->numPages;
+                        span->next = idle;
+                        idle = span;
+                    }
+                    else
+                    {
+                        link = &span->next;
+                    }
+                }
+            }
+        }
+
+        // 不持有自己的锁去拿 PageCache 的锁
+        while (idle)
+        {
+            Span* span = idle;
+            idle = span->next;
+            PageCache::getInstance().deallocateSpan(span->pageAddr, span->numPages);
+        }
+    }
+
+    size_t cachedBytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cachedPages_ * PageCache::PAGE_SIZE;
+    }
+
+    // 正在被用户使用的大对象一共多少字节（按整页算）
+    size_t inUseBytes() const { return inUsePages_.load(std::memory_order_relaxed) * PageCache::PAGE_SIZE; }
+    size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    size_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    LargeSpanCache()
+    {
+        buckets_.fill(nullptr);
+    }
+
+    // (2^k, 2^(k+1)] 页切 8 档，每档 2^k / 8 页
+    static constexpr size_t stepOf(size_t numPages)
+    {
+        size_t pow2 = 1;
+        while (pow2 * 2 < numPages) pow2 *= 2;
+        return pow2 / 8;
+    }
+
+    static constexpr bool cacheable(size_t numPages)
+    {
+        return numPages > kMinPages && numPages <= kMaxCachedPages;
+    }
+
+    // numPages 必须已经取整过
+    static constexpr size_t bucketIndex(size_t numPages)
+    {
+        size_t pow2 = kMinPages;
+        size_t index = 0;
+        while (pow2 * 2 < numPages)
+        {
+            pow2 *= 2;
+            index += 8;
+        }
+        return index + (numPages - pow2) / (pow2 / 8) - 1;
+    }
+
+    std::array<Span*, kNumBuckets> buckets_; // 每个桶是一个用 Span::next 串起来的栈，最近释放的在最前面
+    size_t cachedPages_ = 0;
+    std::mutex mutex_;
+
+    std::atomic<size_t> inUsePages_{ 0 };
+    std::atomic<size_t> hits_{ 0 };
+    std::atomic<size_t> misses_{ 0 };
+};
+
+// 单例必须是平凡析构的，见 PageCache.h
+static_assert(std::is_trivially_destructible_v<LargeSpanCache>);
+static_assert(LargeSpanCache::kMaxCachedPages == LargeSpanCache::kMinPages * 32, "kNumBuckets assumes 5 doublings");
+static_assert(LargeSpanCache::roundPages(LargeSpanCache::kMinPages + 1) == LargeSpanCache::kMinPages + 8);
+static_assert(LargeSpanCache::roundPages(LargeSpanCache::kMaxCachedPages) == LargeSpanCache::kMaxCachedPages);
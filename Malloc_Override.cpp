@@ -0,0 +1,252 @@
+// 把内存池编译成一个可以 LD_PRELOAD 的动态库，接管进程里所有的 malloc/free/new/delete：
+//   LD_PRELOAD=./libMemoryPoolMalloc.so ./your_service
+// 不需要改业务代码，所有请求都经过 ThreadCache -> CentralCache -> PageCache
+//
+// 这里的每一个函数都可能在进程初始化的极早期被调用（甚至早于 main、早于各种全局构造），
+// 所以整条分配路径上不能依赖任何需要运行时初始化、或者自己会调用 malloc 的东西，
+// 具体见 ThreadCache::getInstance、MetadataAllocator 和 PageCache 单例上的说明
+
+#include "MemoryPool.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define MEMORYPOOL_EXPORT extern "C" __attribute__((visibility("default")))
+
+namespace
+{
+    bool isPowerOfTwo(size_t x)
+    {
+        return x != 0 && (x & (x - 1)) == 0;
+    }
+
+    // glibc 保证 malloc / new 返回的地址按 alignof(max_align_t)（x86-64 上是16）对齐，SSE、long double 之类的代码依赖这一点。
+    // 128 字节以内的大小类是 8 字节一档，把请求向上取整到 16 的倍数就一定落在 16 的倍数那一档上；
+    // 更大的大小类本来就都是 16 的倍数。8 字节以内的请求放不下需要 16 字节对齐的类型，保持原样
+    constexpr size_t kMallocAlignment = alignof(std::max_align_t);
+    static_assert(kMallocAlignment <= 16, "size classes above 128 bytes are multiples of 16");
+
+    size_t mallocSize(size_t size)
+    {
+        return size <= ALIGNMENT ? size : (size + kMallocAlignment - 1) & ~(kMallocAlignment - 1);
+    }
+
+    void* allocateWithAlignment(size_t size, size_t alignment)
+    {
+        return alignment <= kMallocAlignment ? MemoryPool::allocate(mallocSize(size))
+            : MemoryPool::allocateAligned(size, alignment);
+    }
+
+    void* allocateOrSetErrno(size_t size, size_t alignment)
+    {
+        void* ptr = allocateWithAlignment(size, alignment);
+        if (!ptr) errno = ENOMEM;
+        return ptr;
+    }
+
+    // operator new 的语义：失败时先调用 new_handler，没有 new_handler 才抛 bad_alloc
+    void* newImpl(size_t size, size_t alignment)
+    {
+        for (;;)
+        {
+            void* ptr = allocateWithAlignment(size, alignment);
+            if (ptr) return ptr;
+
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* newNothrowImpl(size_t size, size_t alignment) noexcept
+    {
+        try
+        {
+            return newImpl(size, alignment);
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// 堆采样：设置环境变量 MEMORYPOOL_HEAPPROFILE=<文件名>，加载时就开始采样，进程退出时把 pprof 格式的结果写进这个文件
+//   MEMORYPOOL_HEAPPROFILE_INTERVAL=<字节数> 改平均采样间隔，默认 512KB
+// 之后 pprof --text ./your_service <文件名> 就能看到正在使用的内存是从哪里分配的（见 HeapProfiler.h）
+// ---------------------------------------------------------------------------
+
+namespace
+{
+    const char* heapProfilePath = nullptr;
+
+    void writeHeapProfile()
+    {
+        std::string profile = HeapProfiler::dumpPprof();
+        if (std::FILE* file = std::fopen(heapProfilePath, "w"))
+        {
+            std::fwrite(profile.data(), 1, profile.size(), file);
+            std::fclose(file);
+        }
+    }
+
+    __attribute__((constructor)) void startHeapProfile()
+    {
+        heapProfilePath = std::getenv("MEMORYPOOL_HEAPPROFILE");
+        if (!heapProfilePath || !*heapProfilePath) return;
+
+        const char* interval = std::getenv("MEMORYPOOL_HEAPPROFILE_INTERVAL");
+        HeapProfiler::start(interval ? std::strtoull(interval, nullptr, 10) : HeapProfiler::kDefaultInterval);
+        std::atexit(writeHeapProfile);
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// C 接口
+// ---------------------------------------------------------------------------
+
+MEMORYPOOL_EXPORT void* malloc(size_t size) noexcept
+{
+    return allocateOrSetErrno(size, kMallocAlignment);
+}
+
+MEMORYPOOL_EXPORT void free(void* ptr) noexcept
+{
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORYPOOL_EXPORT void* calloc(size_t n, size_t size) noexcept
+{
+    size_t total;
+    if (__builtin_mul_overflow(n, size, &total))
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    // 大块直接 mmap 来的页本来就是全 0，不用再写一遍
+    void* ptr = MemoryPool::allocateZeroed(mallocSize(total));
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+MEMORYPOOL_EXPORT void* realloc(void* ptr, size_t size) noexcept
+{
+    if (!ptr) return malloc(size);
+    if (size == 0)
+    {
+        free(ptr);
+        return nullptr;
+    }
+
+    size_t oldSize = MemoryPool::usableSize(ptr);
+    if (oldSize == 0)
+    {
+        // 不是内存池分配的指针，不知道原来有多大，没法搬
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    // 原地就放得下，而且不会浪费超过一半，就不搬了
+    if (size <= oldSize && size >= oldSize / 2) return ptr;
+
+    void* newPtr = allocateOrSetErrno(size, kMallocAlignment);
+    if (!newPtr) return nullptr;
+    std::memcpy(newPtr, ptr, std::min(oldSize, size));
+    MemoryPool::deallocate(ptr);
+    return newPtr;
+}
+
+MEMORYPOOL_EXPORT void* reallocarray(void* ptr, size_t n, size_t size) noexcept
+{
+    size_t total;
+    if (__builtin_mul_overflow(n, size, &total))
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(ptr, total);
+}
+
+MEMORYPOOL_EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size) noexcept
+{
+    if (!isPowerOfTwo(alignment) || alignment % sizeof(void*) != 0) return EINVAL;
+
+    void* ptr = allocateWithAlignment(size, alignment);
+    if (!ptr) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+MEMORYPOOL_EXPORT void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    if (!isPowerOfTwo(alignment))
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return allocateOrSetErrno(size, alignment);
+}
+
+MEMORYPOOL_EXPORT void* memalign(size_t alignment, size_t size) noexcept
+{
+    return aligned_alloc(alignment, size);
+}
+
+MEMORYPOOL_EXPORT void* valloc(size_t size) noexcept
+{
+    return allocateOrSetErrno(size, PageCache::PAGE_SIZE);
+}
+
+MEMORYPOOL_EXPORT void* pvalloc(size_t size) noexcept
+{
+    size = (size + PageCache::PAGE_SIZE - 1) & ~(PageCache::PAGE_SIZE - 1);
+    return allocateOrSetErrno(size ? size : PageCache::PAGE_SIZE, PageCache::PAGE_SIZE);
+}
+
+MEMORYPOOL_EXPORT size_t malloc_usable_size(void* ptr) noexcept
+{
+    return MemoryPool::usableSize(ptr);
+}
+
+
+// ---------------------------------------------------------------------------
+// C++ 全局 operator new / delete，包括 C++14 的带大小版本和 C++17 的对齐版本
+// ---------------------------------------------------------------------------
+
+void* operator new(size_t size) { return newImpl(size, kMallocAlignment); }
+void* operator new[](size_t size) { return newImpl(size, kMallocAlignment); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return newNothrowImpl(size, kMallocAlignment); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return newNothrowImpl(size, kMallocAlignment); }
+
+void* operator new(size_t size, std::align_val_t al) { return newImpl(size, static_cast<size_t>(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return newImpl(size, static_cast<size_t>(al)); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return newNothrowImpl(size, static_cast<size_t>(al)); }
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return newNothrowImpl(size, static_cast<size_t>(al)); }
+
+void operator delete(void* ptr) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { MemoryPool::deallocate(ptr); }
+
+// 带大小的 delete 走 ThreadCache 的快速路径，不查基数树（size 要和 new 的时候一样取整）
+void operator delete(void* ptr, size_t size) noexcept { if (ptr) MemoryPool::deallocate(ptr, mallocSize(size)); }
+void operator delete[](void* ptr, size_t size) noexcept { if (ptr) MemoryPool::deallocate(ptr, mallocSize(size)); }
+
+// 对齐分配出来的块不一定落在 getIndex(size) 对应的自由链表里，所以即使给了 size 也要反查
+void operator delete(void* ptr, std::align_val_t) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { MemoryPool::deallocate(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { MemoryPool::deallocate(ptr); }
@@ -1,16 +1,199 @@
 #pragma once
+#include <cstring>
 #include "ThreadCache.h"
+#include "CpuCache.h"
+#include "Scavenger.h"
 
-class MemoryPool
+// 前端缓存有两种：每个线程一份的 ThreadCache，和编译时打开 MEMORYPOOL_PERCPU 之后每个CPU一份的 CpuCache（见 CpuCache.h）
+// 当前线程能用 CpuCache 就用它，不能用（没开、或者这个线程没注册上 rseq）就用 ThreadCache
+//
+// Policy 选中心缓存和大小类参数（见 PoolPolicy.h），平时用的 MemoryPool 是默认配置
+template <class Policy>
+class BasicMemoryPool
 {
 public:
+    using SizeClass = typename Policy::SizeClass;
+    using ThreadCache = BasicThreadCache<Policy>;
+    using CpuCache = BasicCpuCache<Policy>;
+
+    static constexpr size_t kAlignment = SizeClass::kAlignment; // 每一块至少按这个对齐
+    static constexpr size_t kMaxBytes = SizeClass::kMaxBytes;   // 更大的请求按整页分配
+
     static void* allocate(size_t size)
     {
+        if (CpuCache::available()) return CpuCache::allocate(size);
         return ThreadCache::getInstance()->allocate(size);
     }
 
+    // alignment 必须是2的幂，posix_memalign / aligned_alloc / 对齐版 operator new 都走这里
+    static void* allocateAligned(size_t size, size_t alignment)
+    {
+        if (alignment <= kAlignment)
+        {
+            return allocate(size);
+        }
+
+        //小块都是从页对齐的span起始地址开始、按 objSize 一个挨一个切出来的，
+        //所以只要块大小是 alignment 的整数倍，切出来的每一块都天然满足对齐要求
+        //getIndex 的查找表只覆盖 kMaxBytes 以内
+        if (alignment <= PageCache::PAGE_SIZE && size <= kMaxBytes)
+        {
+            size_t index = alignedClass(size, alignment);
+            if (index < SizeClass::kNumClasses)
+            {
+                return allocate(SizeClass::classToSize(index));
+            }
+        }
+
+        return ThreadCache::allocateLarge(size, alignment);
+    }
+
+    // 放得下 size、块大小又是 alignment 整数倍的最小的大小类，没有的话返回 kNumClasses
+    // size 不超过 kMaxBytes、alignment 不超过一页；编译期也能算，ObjectPool 用它在编译期定下大小类
+    static constexpr size_t alignedClass(size_t size, size_t alignment)
+    {
+        size_t index = SizeClass::getIndex(std::max(size, alignment));
+        while (index < SizeClass::kNumClasses && SizeClass::classToSize(index) % alignment != 0)
+        {
+            ++index;
+        }
+        return index;
+    }
+
+    // 已经知道大小类的分配（见 ObjectPool.h），ThreadCache 上省掉一次查表
+    static void* allocateClass(size_t index)
+    {
+        if (CpuCache::available()) return CpuCache::allocate(SizeClass::classToSize(index));
+        return ThreadCache::getInstance()->allocateClass(index);
+    }
+
+    // 内容全 0 的内存，已知是全 0 的新页时不会再清零一遍
+    static void* allocateZeroed(size_t size)
+    {
+        void* ptr = allocate(size);
+        if (!ptr) return nullptr;
+
+        if (size > kMaxBytes)
+        {
+            // 大对象是整个span：刚从操作系统要来、或者被 scavenger 还回去过的页本来就是全 0，不用再写一遍
+            Span* span = PageCache::getInstance().mapToSpan(ptr);
+            if (!span->isZero) SystemMemory::zero(ptr, size);
+        }
+        else
+        {
+            // 小块至少开头被自由链表的 next 指针写过，总是要清
+            std::memset(ptr, 0, size);
+        }
+        return ptr;
+    }
+
     static void deallocate(void* ptr, size_t size)
     {
-        ThreadCache::getInstance()->deallocate(ptr, size);
+        if (CpuCache::available()) CpuCache::deallocate(ptr, size);
+        else ThreadCache::getInstance()->deallocate(ptr, size);
+    }
+
+    // 不需要传size的释放，适合 free / delete 这类拿不到原始大小的场景
+    static void deallocate(void* ptr)
+    {
+        if (CpuCache::available()) CpuCache::deallocate(ptr);
+        else ThreadCache::getInstance()->deallocate(ptr);
+    }
+
+    // 所有线程的 ThreadCache 里一共缓存着多少字节（已经从中心缓存拿走、但还没分配出去的块）
+    static size_t threadCacheBytes()
+    {
+        return ThreadCache::totalCachedBytes();
+    }
+
+    // 所有CPU的 CpuCache 里一共缓存着多少字节，没打开 MEMORYPOOL_PERCPU 时总是 0
+    static size_t cpuCacheBytes()
+    {
+        return CpuCache::totalCachedBytes();
+    }
+
+    // 各层的字节数和次数统计（见 PoolStats.h），各线程同时还在分配释放，只是个大致的快照
+    // LargeSpanCache、PageCache 是所有 MemoryPool 配置共用的，这几项算的是整个进程
+    static MemoryPoolStats getStats()
+    {
+        MemoryPoolStats stats;
+        stats.sizeClasses.resize(SizeClass::kNumClasses);
+        for (size_t index = 0; index < SizeClass::kNumClasses; ++index)
+        {
+            stats.sizeClasses[index].size = SizeClass::classToSize(index);
+        }
+
+        stats.threadCacheBytes = ThreadCache::totalCachedBytes();
+        stats.cpuCacheBytes = CpuCache::totalCachedBytes();
+        stats.remoteFreeBytes = ThreadCache::remoteFreeBytes();
+        stats.smallSpanBytes = Policy::CentralCache::getInstance().spanBytes();
+
+        LargeSpanCache& largeCache = LargeSpanCache::getInstance();
+        stats.largeSpanCacheBytes = largeCache.cachedBytes();
+        stats.largeCacheHits = largeCache.hits();
+        stats.largeCacheMisses = largeCache.misses();
+        stats.inUseBytes = largeCache.inUseBytes();
+
+        PageHeapStats pageHeap = PageCache::getInstance().stats();
+        stats.pageHeapFreeBytes = pageHeap.freeBytes - pageHeap.releasedBytes;
+        stats.pageHeapReleasedBytes = pageHeap.releasedBytes;
+        stats.systemBytes = pageHeap.systemBytes;
+        stats.pageHeapSpanAllocs = pageHeap.spanAllocs;
+        stats.systemAllocs = pageHeap.systemAllocs;
+
+#if MEMORYPOOL_STATS
+        ThreadCache::collectStats(stats);
+        CpuCache::collectStats(stats);
+
+        // 分配和释放可能被不同的线程计数，挨个线程读的时候释放可能先于分配被读到，单个大小类会短暂地出现负数
+        uint64_t allocs = 0;
+        size_t smallInUse = 0;
+        for (const SizeClassStats& c : stats.sizeClasses)
+        {
+            allocs += c.allocs;
+            if (c.allocs > c.frees) smallInUse += (c.allocs - c.frees) * c.size;
+        }
+        stats.frontendHits = allocs > stats.frontendMisses ? allocs - stats.frontendMisses : 0;
+        stats.inUseBytes += smallInUse;
+
+        // span 里剩下的既不在用户手里、也不在前端缓存里，就都在中心缓存
+        size_t outside = smallInUse + stats.threadCacheBytes + stats.cpuCacheBytes + stats.remoteFreeBytes;
+        stats.centralCacheBytes = stats.smallSpanBytes > outside ? stats.smallSpanBytes - outside : 0;
+#endif
+        return stats;
+    }
+
+    // 把 LargeSpanCache 里缓存的大span还给 PageCache，再把 PageCache 里所有空闲span的物理页立即还给操作系统，返回还了多少字节
+    // 地址空间不变，这些页以后照样能分配出去，第一次访问时由内核按需缺页
+    static size_t releaseFreeMemory()
+    {
+        LargeSpanCache::getInstance().releaseIdle();
+        return PageCache::getInstance().releaseFreeMemory();
+    }
+
+    // 启动 / 停止后台回收线程，按 options 里的闲置时间和速率慢慢归还（见 Scavenger.h）
+    static bool startScavenger(const ScavengerOptions& options = {})
+    {
+        return Scavenger::start(options);
+    }
+
+    static void stopScavenger()
+    {
+        Scavenger::stop();
+    }
+
+    // ptr 实际可用的字节数（>= 申请时的size）
+    static size_t usableSize(void* ptr)
+    {
+        if (!ptr) return 0;
+        Span* span = PageCache::getInstance().mapToSpan(ptr);
+        if (!span) return 0;
+        if (span->objSize) return span->objSize;
+        // 大对象：对齐分配时返回的可能是span中间的地址
+        char* end = static_cast<char*>(span->pageAddr) + span->numPages * PageCache::PAGE_SIZE;
+        return end - static_cast<char*>(ptr);
     }
-};
\ No newline at end of file
+};
+
+// 默认配置的内存池，malloc 替换库也是用的它
+using MemoryPool = BasicMemoryPool<DefaultPoolPolicy>;
@@ -0,0 +1,60 @@
+#pragma once
+#include <mutex>
+#include <cstddef>
+#include "SystemMemory.h"
+
+// 内存池自己的元数据（Span、基数树节点、ThreadCache对象）专用的定长分配器
+// 原来这些对象都是 new 出来的，内存池一旦接管了 malloc，new Span 就会递归回自己身上，
+// 所以这里直接向系统一次要一大块，切成 sizeof(T) 的小块自己管理，用完挂在自由链表上复用
+//
+// 所有成员都是 constinit 的静态变量，不需要运行时构造，第一次调用 malloc 时就能用
+template <typename T>
+class MetadataAllocator
+{
+public:
+    // 返回未构造的内存，调用方自己 placement new
+    static T* allocate()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (freeList_) {
+            void* result = freeList_;
+            freeList_ = *reinterpret_cast<void**>(result);
+            return static_cast<T*>(result);
+        }
+
+        if (freeAvail_ < kObjSize) {
+            size_t chunk = kObjSize > kChunkSize ? kObjSize : kChunkSize;
+            freeArea_ = static_cast<char*>(SystemMemory::allocate(chunk));
+            if (!freeArea_) {
+                freeAvail_ = 0;
+                return nullptr;
+            }
+            freeAvail_ = chunk;
+        }
+
+        void* result = freeArea_;
+        freeArea_ += kObjSize;
+        freeAvail_ -= kObjSize;
+        return static_cast<T*>(result);
+    }
+
+    // 调用方负责先析构
+    static void deallocate(T* obj)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        *reinterpret_cast<void**>(obj) = freeList_;
+        freeList_ = obj;
+    }
+
+private:
+    static constexpr size_t kChunkSize = 128 * 1024;
+    // 至少要放得下一个next指针，并且保持对齐
+    static constexpr size_t kAlign = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+    static constexpr size_t kObjSize = ((sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*)) + kAlign - 1) / kAlign * kAlign;
+
+    static inline std::mutex mutex_;
+    static inline char* freeArea_ = nullptr; // 当前大块里还没切出去的部分
+    static inline size_t freeAvail_ = 0;
+    static inline void* freeList_ = nullptr; // 还回来的对象
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "MemoryPool.h"
+
+// 按类型分配（tcmalloc / mimalloc 都有类似的 typed 接口）
+//
+// MemoryPool::allocate 每次都要拿 size 查一遍大小类表；分配同一种对象的时候 size 是 sizeof(T)，
+// 大小类在编译期就定下来了（kIndex），ThreadCache 上直接从那条自由链表取。对齐也在编译期处理：
+// alignof(T) 超过池子的对齐时挑一个块大小是 alignof(T) 整数倍的大小类（和 allocateAligned 一样），照样走自由链表
+//
+//   Node* node = ObjectPool<Node>::create(key, value);
+//   ...
+//   ObjectPool<Node>::destroy(node);
+//
+// 和 MemoryPool 一样全是静态函数，Policy 选用哪个 BasicMemoryPool（见 PoolPolicy.h）。
+// 块来自同一个池子，create 出来的对象析构以后也可以交给不带 size 的 MemoryPool::deallocate
+template <class T, class Policy = DefaultPoolPolicy>
+class BasicObjectPool
+{
+public:
+    using Pool = BasicMemoryPool<Policy>;
+    using SizeClass = typename Policy::SizeClass;
+
+    // sizeof(T) 和 alignof(T) 都放得进某个大小类的话就是它的下标，否则 kNumClasses（按大对象分配）
+    static constexpr size_t kIndex = sizeof(T) <= SizeClass::kMaxBytes && alignof(T) <= PageCache::PAGE_SIZE
+        ? Pool::alignedClass(sizeof(T), alignof(T))
+        : SizeClass::kNumClasses;
+    static constexpr bool kSmall = kIndex < SizeClass::kNumClasses;
+
+    // 构造函数抛异常的话内存还回去，异常原样抛出；内存不够抛 std::bad_alloc
+    template <class... Args>
+    static T* create(Args&&... args)
+    {
+        void* mem = allocate();
+        if (!mem) throw std::bad_alloc();
+        if constexpr (std::is_nothrow_constructible_v<T, Args&&...>)
+        {
+            return new (mem) T(std::forward<Args>(args)...);
+        }
+        else
+        {
+            try
+            {
+                return new (mem) T(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                deallocate(mem);
+                throw;
+            }
+        }
+    }
+
+    static void destroy(T* ptr)
+    {
+        if (!ptr) return;
+        ptr->~T();
+        deallocate(ptr);
+    }
+
+    // 只要内存、不构造，PoolAllocator 用；失败返回 nullptr
+    static void* allocate()
+    {
+        if constexpr (kSmall) return Pool::allocateClass(kIndex);
+        else return Pool::allocateAligned(sizeof(T), alignof(T));
+    }
+
+    static void deallocate(void* ptr)
+    {
+        // 带上块大小，不带 size 的释放要多查一次基数树
+        if constexpr (kSmall) Pool::deallocate(ptr, SizeClass::classToSize(kIndex));
+        else Pool::deallocate(ptr);
+    }
+};
+
+// 默认配置的对象池
+template <class T>
+using ObjectPool = BasicObjectPool<T, DefaultPoolPolicy>;
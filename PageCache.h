@@ -1,246 +1,481 @@
 #pragma once
-#include <map>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <mutex>
 #include "common.h"
+#include "PageMap.h"
+#include "MetadataAllocator.h"
+#include "SystemMemory.h"
 #include <cstring>
 #include <cassert>
+#include <type_traits>
+
+struct HeapSample;
+
+// 一段连续的页，PageCache 的基本管理单位
+struct Span {
+    void* pageAddr;  // 页起始地址
+    size_t numPages; // 页数
+    Span* next;      // 链表指针
+    Span* prev;      // 双向链表，合并时可以 O(1) 把邻居从空闲链表里摘出来
+    bool isUse;      // true：已经交给了CentralCache；false：挂在PageCache的空闲链表上
+    bool isReleased; // 空闲span的物理页已经还给了操作系统（见 PageCache::releaseFreeMemory）
+    uint64_t freeTime; // 变成空闲span的时间（毫秒），scavenger 按它判断闲置了多久
+    bool isZero;     // 分配出去的时候内容一定全是 0：刚从操作系统要来的页、或者 madvise 还回去过的页
+
+    // 下面两个字段由使用者（CentralCache / ThreadCache）在拿到span之后填写，
+    // 释放时只给一个指针，就靠它们反查出这块内存有多大、该还到哪个自由链表
+    size_t sizeClass; // 这个span被切成的小块属于哪个自由链表（SizeClass::getIndex的结果）
+    size_t objSize;   // 切出来的每个小块的大小；0 表示整个span就是一个大对象
+
+    // 下面四个字段由 CentralCache 维护（见 CentralSpanList.h）
+    // 新 span 不预先切块：bumpPtr 往后到 bumpEnd 是从来没分出去过的块，要用的时候才一块一块往后推，
+    // freeList 里只有分出去又还回来的块。没用到的页一次都不会被写，也就不会缺页
+    void* freeList;   // 这个span上还回来的空闲块
+    char* bumpPtr;    // 下一块从来没分出去过的块，都分出去过了是 nullptr
+    char* bumpEnd;    // 最后一块的结尾（span 结尾的边角料不算）
+    size_t useCount;  // 切出去还没还回来的块数，回到 0 时整个span还给PageCache
+
+    HeapSample* sample; // 不为空说明这个span是堆采样抽中的一次分配（见 HeapProfiler.h）
+    void* owner;        // 这个span上的块现在归哪个线程，别的线程释放时还给它（RemoteFreeHeap，见 RemoteFreeHeap.h；
+                        // 按页分片的前端里是 PageLocalCache 本身）
+
+    // 下面三个字段只有按页分片的前端用（见 PageLocalCache.h），freeList / useCount 在那里由主人线程维护
+    void* localFree;    // 主人线程自己释放的块
+    void* threadFree;   // 别的线程释放的块，无锁链表，主人整条拿走
+    bool inFull;        // 块都分出去了，挂在主人的 full 链表上
+
+    // 新拿到的 span 从 pageAddr 开始往后切，一共 totalBlocks 块（调用方保证至少一块）
+    void initBump(size_t totalBlocks)
+    {
+        bumpPtr = static_cast<char*>(pageAddr);
+        bumpEnd = bumpPtr + totalBlocks * objSize;
+    }
+
+    bool hasFreeBlock() const { return freeList || bumpPtr; }
+
+    // 先用还回来的块，没有了再往后推一块；调用方先用 hasFreeBlock 确认过
+    void* popBlock()
+    {
+        void* block = freeList;
+        if (block)
+        {
+            freeList = *reinterpret_cast<void**>(block);
+            return block;
+        }
+        return bumpBlock();
+    }
+
+    // 往后推一块；调用方先确认过 bumpPtr 不为空
+    void* bumpBlock()
+    {
+        void* block = bumpPtr;
+        bumpPtr += objSize;
+        if (bumpPtr == bumpEnd) bumpPtr = nullptr;
+        return block;
+    }
+};
+
+// PageCache 自己的统计（见 PoolStats.h），getStats 时在 mutex_ 下一次取出来
+struct PageHeapStats {
+    uint64_t spanAllocs;   // allocateSpan 成功的次数
+    uint64_t systemAllocs; // 其中空闲链表里没有、向操作系统要内存的次数
+    size_t systemBytes;    // 一共向操作系统要了多少字节
+    size_t freeBytes;      // 同 freeBytes()
+    size_t releasedBytes;  // 同 releasedBytes()
+};
 
 class PageCache {
 
 public:
-    static const size_t PAGE_SIZE = 4096; // 4KҳС
+    static const size_t PAGE_SIZE = 4096; // 4K页大小
+    static const size_t PAGE_SHIFT = 12;
 
     static PageCache& getInstance() {
         static PageCache instance;
         return instance;
     }
 
-    void* allocateSpan(size_t numPages); // ָҳspan
-    void deallocateSpan(void* ptr, size_t numPages); // ͷspan
+    Span* allocateSpan(size_t numPages); // 分配指定页数的span
+    void deallocateSpan(void* ptr, size_t numPages); // 释放span
 
-private:
-    PageCache() = default;
-    void* systemAlloc(size_t numPages); // ϵͳڴ
+    // 把闲置了至少 minIdleMs 毫秒的空闲span的物理页还给操作系统，最多还 maxBytes 字节（比预算大的span切开、只还前一段，
+    // 按页取整），返回实际还了多少字节。地址空间还留着，span照样可以再分配，再次访问时按需缺页
+    size_t releaseFreeMemory(size_t maxBytes = SIZE_MAX, uint64_t minIdleMs = 0);
 
-private:
-    struct Span {
-        void* pageAddr; // ҳʼַ
-        size_t numPages; // ҳ
-        Span* next;     // ָ
-    };
-
-    //allocateڼ¼ݽṹӦ
-    // spanMap_ дڵ Span ʾʹáspanMap_ вڵ Span ʾС
-    // keyΪvoid*ڴҳʼַ Span::pageAddr 0x10000x2000
-    // valueΪSpan*ָ Span ָ룬SpanᱣڴԪϢʼַҳָȣ
-    std::map<void*, Span*> spanMap_;//ȻʵҲŻspanMap_ԿʹtbbĲhashmapԼʹд
-    std::mutex map_mutex_; // spanMap_ȫͳȫΪʵʲ֮ҪspanMap_д
+    size_t freeBytes();     // 空闲span一共多少字节（包括已经还给操作系统的）
+    size_t releasedBytes(); // 其中已经还给操作系统的字节数
+    PageHeapStats stats();
 
+    // 毫秒时间戳，span 的闲置时间用它来算
+    static uint64_t nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
-    //deallocateĺϲڴ鲿֣ڼ¼ݽṹ
-    std::map<void*, Span*> free_span_map_; // key: Span ʼַvalue: Span ָ
-    std::mutex free_span_mutex_; //  free_span_map_ 
+    // 无锁查询：ptr 所在的页属于哪个 Span（正在使用的 Span 每一页都登记过）
+    Span* mapToSpan(const void* ptr) const {
+        return pageMap_.get(reinterpret_cast<uintptr_t>(ptr) >> PAGE_SHIFT);
+    }
 
+private:
+    PageCache() {
+        freeSpans_.fill(nullptr);
+    }
+    void* systemAlloc(size_t numPages); // 向系统申请内存
 
+    static uintptr_t pageIdOf(const void* ptr) {
+        return reinterpret_cast<uintptr_t>(ptr) >> PAGE_SHIFT;
+    }
 
-    //PageCache+֣
-    std::map<size_t, Span*> freeSpans_;// freeSpans_ ҳspanͬҳӦͬSpan
+    Span* takeFreeSpan(size_t numPages); // 从空闲链表里找一个至少 numPages 页的span（最佳适配）
+    void insertFreeSpan(Span* span); // 和左右相邻的空闲span合并（还没还过的只和没还过的合并，还过的只和还过的合并），再登记、挂回空闲链表
+    void pushFreeSpan(Span* span);
+    void removeFreeSpan(Span* span);
+    size_t freeListIndex(size_t numPages) const {
+        return numPages < kMaxPages ? numPages : kMaxPages;
+    }
 
-    static constexpr size_t kMaxLockedPages = 128; // ʵַƬ
-    std::array<std::mutex, kMaxLockedPages> page_locks_;// freeSpans_ϸ
+    // Span对象本身也不走 new/delete，避免内存池接管 malloc 之后递归
+    static Span* newSpan() { return MetadataAllocator<Span>::allocate(); }
+    static void deleteSpan(Span* span) { MetadataAllocator<Span>::deallocate(span); }
 
+    bool registerSpan(Span* span);     // 正在使用的span：每一页都登记，任意内部指针都能查到span
+    bool registerFreeSpan(Span* span); // 空闲span：只登记首尾两页，合并时只需要看邻居的边界页
 
+private:
+    //原来这里是两棵红黑树 spanMap_ / free_span_map_ 各自配一把全局锁，每次分配、释放span都要排队
+    //现在换成一棵按页号索引的基数树：
+    //  查询（mapToSpan、合并时看左右邻居）都是 O(1)，并且读的时候不用加锁
+    //  正在使用 / 空闲 这个状态直接记在 Span::isUse 里，不再需要两张表
+    //地址空间 48 位，页大小 4KB，所以页号是 36 位
+    PageMap<Span, 48 - PAGE_SHIFT> pageMap_;
+
+
+    //下面是PageCache的自由链表部分：
+    //freeSpans_[n] (1 <= n < kMaxPages) 挂的是恰好 n 页的空闲span，freeSpans_[kMaxPages] 挂所有更大的span
+    //原来是 std::map<size_t, Span*> 加上按页数取模的分片锁，但不同分片的线程会同时修改同一棵 std::map，
+    //合并时又要同时拿好几把锁，所以这里统一用一把锁 mutex_ 保护空闲链表和基数树的写操作。
+    //走到PageCache的请求本来就不多（CentralCache一次拿一整个span），这把锁不会成为瓶颈
+    static constexpr size_t kMaxPages = 128;
+    std::array<Span*, kMaxPages + 1> freeSpans_;
+    size_t freePages_ = 0;     // 空闲链表上一共多少页，pushFreeSpan / removeFreeSpan 维护
+    size_t releasedPages_ = 0; // 其中 isReleased 的有多少页
+    uint64_t spanAllocs_ = 0;
+    uint64_t systemAllocs_ = 0;
+    size_t systemPages_ = 0;   // 向操作系统要过的页数，地址空间从来不还，只增不减
+    std::mutex mutex_;
 };
 
-void* PageCache::allocateSpan(size_t numPages) {
-    // Step 1: ֱӸ numPages ѡ
-    std::unique_lock lock(page_locks_[numPages % kMaxLockedPages]);
-
-    // ҺʵĿspan
-    auto it = freeSpans_.lower_bound(numPages);
-    if (it != freeSpans_.end()) {
-        Span* span = it->second;//ʵǷltsize_t, Span* ĵڶԣҲSpan* 
-        //ȻҲʹC++17Ľṹ󶨣auto& [pageCount, span] = *it;  
-
-// ȡspanԭеĿfreeSpans_[it->first]Ƴ
-        if (span->next) {
-            freeSpans_[it->first] = span->next;
+// 单例不能有非平凡的析构函数：否则第一次构造时会通过 __cxa_atexit 注册析构，
+// 而 __cxa_atexit 可能调用 calloc，内存池接管 malloc 之后就会在单例初始化的过程中递归回来
+static_assert(std::is_trivially_destructible_v<PageCache>);
+static_assert(PageCache::PAGE_SIZE == SizeClass::Rule::kPageSize);
+
+Span* PageCache::allocateSpan(size_t numPages) {
+    if (numPages == 0) return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // 查找合适的空闲span
+    Span* span = takeFreeSpan(numPages);
+    if (!span) {
+        // 没有合适的span，向系统申请
+        // 先要到 Span 对象再要页：反过来的话，Span 对象要不到时刚 mmap 来的页谁也不记得，就永远丢了
+        span = newSpan();
+        if (!span) return nullptr;
+        void* memory_address = systemAlloc(numPages);
+        if (!memory_address) {
+            deleteSpan(span);
+            return nullptr;
         }
-        else {
-            freeSpans_.erase(it);
-        }
-
-        //step2:ǻõspanҪnumPagesзָ
-        //CentralCachenumPagesҳ棬ȡһspan
-        //ȻǰspanǰnumsPagesҳCentralCacheʣǴһµspanȻһPageCacheȥ
-        if (span->numPages > numPages) {
-            // spanʣpage
-            Span* newSpan = new Span;
-            newSpan->pageAddr = static_cast<char*>(span->pageAddr) + numPages * PAGE_SIZE;
-            newSpan->numPages = span->numPages - numPages;
-            newSpan->next = nullptr;
-
-            // ʣpagespanһPageCache
-            size_t target_pages = newSpan->numPages;
-            std::unique_lock target_lock(page_locks_[target_pages % kMaxLockedPages]);
-            newSpan->next = freeSpans_[target_pages];
-            freeSpans_[target_pages] = newSpan;
-
-            // ע⣺вּ¼free_span_map_
-            {
-                std::lock_guard<std::mutex> free_span_lock(free_span_mutex_);
-                free_span_map_[newSpan->pageAddr] = newSpan;
-            }
 
-            span->numPages = numPages; // µǰspanĴС
-        }
+        span->pageAddr = memory_address;
+        span->numPages = numPages;
+        span->next = nullptr;
+        span->prev = nullptr;
+        span->isUse = false;
+        span->isReleased = false;
+        span->freeTime = 0;
+        span->isZero = true; // mmap 来的新页内核保证全 0
+        ++systemAllocs_;
+        systemPages_ += numPages;
+    }
 
-        // ע⣺ڱʹõĲּ¼spanMap_
-        // һspanreturnCentralCache֮߼ǹCentralCache
-        // һspanϾڴеһΣÿһָָ붼Թ
-        {
-            std::lock_guard map_lock(map_mutex_);
-            spanMap_[span->pageAddr] = span;
+    //如果我们获得的span大于需要的numPages则进行分割
+    //就是CentralCache申请了numPages数量的页面，我们取出的是一整个span，
+    //然后我们把这个span的前面numsPages页给到CentralCache，剩下来的我们串成一个新的span，然后挂回PageCache里面去
+    if (span->numPages > numPages) {
+        // 创建新span存放剩余page；要不到 Span 对象的话整个span原样挂回去，不能就这么丢掉
+        Span* rest = newSpan();
+        if (!rest) {
+            insertFreeSpan(span);
+            return nullptr;
         }
-        return span->pageAddr; // CentralCacheõnumPagesҳʼַ
+        rest->pageAddr = static_cast<char*>(span->pageAddr) + numPages * PAGE_SIZE;
+        rest->numPages = span->numPages - numPages;
+        rest->next = nullptr;
+        rest->prev = nullptr;
+        rest->isUse = false;
+        rest->isReleased = span->isReleased; // 剩下的页没被碰过，还给过操作系统的仍然是还给过的
+        rest->freeTime = span->freeTime;
+        rest->isZero = span->isZero;
+
+        span->numPages = numPages; // 更新当前span的大小
+
+        // 把剩余的page组出的span挂回PageCache
+        registerFreeSpan(rest);
+        pushFreeSpan(rest);
     }
 
-    // ûкʵspanͷŵǰϵͳ
-    lock.unlock();
-    void* memory_address = systemAlloc(numPages);
-    if (!memory_address) return nullptr;
-
-    // µspan
-    Span* span = new Span;
-    span->pageAddr = memory_address;
-    span->numPages = numPages;
-    span->next = nullptr;
-
-    //ڱʹõĲּ¼spanMap_
-    {
-        std::lock_guard map_lock(map_mutex_);
-        spanMap_[memory_address] = span;
+    // 就是一个span，return给CentralCache之后，逻辑上它是归属于CentralCache的
+    // 每一页都登记进基数树，这样后面拿着span里的任意地址都能查到它。
+    // 登记失败（地址超出基数树的范围）的话span还是空闲的，原样挂回空闲链表，不能就这么丢掉
+    if (!registerSpan(span)) {
+        assert(false && "Address out of page map range!");
+        insertFreeSpan(span);
+        return nullptr;
     }
-    return memory_address;
+
+    // 还给过操作系统的页不需要做任何事：第一次访问时内核按需缺页补上全 0 的新页
+    // isZero 原样交给调用方，调用方要的是清零的内存时可以据此省掉一遍写
+    span->isUse = true;
+    span->isReleased = false;
+    span->sizeClass = 0;
+    span->objSize = 0;
+    span->freeList = nullptr;
+    span->bumpPtr = nullptr;
+    span->bumpEnd = nullptr;
+    span->useCount = 0;
+    span->sample = nullptr;
+    span->owner = nullptr;
+    span->localFree = nullptr;
+    span->threadFree = nullptr;
+    span->inFull = false;
+    ++spanAllocs_;
+    return span; // CentralCache拿到的是连续numPages页，起始地址是span->pageAddr
 }
 
 
-//ΪʲôҪרдһsystemAllocֱӵmallocϵͳأΪҪһȺpageҳ
-//ڴҳָǷڴʼַ ҳСPAGE_SIZE磺
-//һǵҳСͨΪ 4KB4096 ֽڣ
-//ڴַ0x100040960x200081920x300012288ȡ
-//δڴַ0x10010x2003 ȣ 4096 
+//我们为什么要专门写一个systemAlloc，而不是直接调用malloc找系统分配呢：
+//1. 要满足申请下来的一群page是页对齐的
+//内存页对齐指的是分配的内存块的起始地址必须是 页大小（PAGE_SIZE）的整数倍。例如：
+//一般情况下我们的页大小通常为 4KB（4096 字节）。
+//则对齐的内存地址：0x1000（4096）、0x2000（8192）、0x3000（12288）等。
+//未对齐的内存地址：0x1001、0x2003 等（不是 4096 的整数倍）
+//2. 内存池要能替换掉 malloc 本身，那就不能再反过来调用 malloc
+//直接用 mmap / VirtualAlloc 要来的页本来就是对齐的，而且操作系统保证内容全是0，不需要再 memset 一遍
+//3. Linux 上从预留好的一大段连续地址里顺序切，相邻的span都能合并，还能用上大页（见 SystemArena）
 void* PageCache::systemAlloc(size_t numPages) {
-    const size_t size = numPages * PAGE_SIZE;
-    void* ptr = _aligned_malloc(size, PAGE_SIZE);
-    if (!ptr) return nullptr;
-    std::memset(ptr, 0, size);// Ϊ·ڴ棬дĶݣҪһڴֵΪ0
-    return ptr;
+    return SystemArena::allocate(numPages * PAGE_SIZE);
 }
 
 
-//deallocateѵںϲspan
-//ϲĺ
-//ֻе Span ǿеģ spanMap_ Уfree_span_map_ʱܺϲ
-// Span  spanMap_   ڱʹ  ܺϲ
-// Span  spanMap_   ͷ  Ժϲ
-//ʲôǵǰspanǰһspanأַռڵ Span
+//deallocate的难点在于合并span
+//合并操作的核心条件
+//只有当相邻 Span 是空闲的（isUse == false）时，才能合并。
+//那什么是当前span的前一个span呢：物理地址空间上相邻的 Span
+//有了基数树之后，前一个span就是 pageId - 1 这一页登记的span，后一个span就是 pageId + numPages 这一页登记的span
 void PageCache::deallocateSpan(void* ptr, size_t numPages) {
-    // 1. У
+    // 1. 参数校验
     if (!ptr || numPages == 0) return;
 
-    // 2. ͨȫֶSpanⳤʱ̣߳
-    Span* span = nullptr;
-    {
-        std::lock_guard<std::mutex> map_lock(map_mutex_);
-        auto it = spanMap_.find(ptr);
-        if (it == spanMap_.end()) {
-            assert(false && "Attempt to deallocate unmanaged memory!");
-            return;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // 2. 通过基数树查找Span
+    Span* span = mapToSpan(ptr);
+    if (!span || span->pageAddr != ptr || !span->isUse) {
+        assert(false && "Attempt to deallocate unmanaged memory!");
+        return;
+    }
+    assert(span->numPages == numPages);
+    span->isUse = false;
+    span->isReleased = false;
+    span->freeTime = nowMs();
+    span->isZero = false; // 用过了，里面是什么都有可能
+
+    // 3. 和前后相邻的空闲span合并，挂回空闲链表
+    insertFreeSpan(span);
+}
+
+void PageCache::insertFreeSpan(Span* span) {
+    // 合并前一个相邻Span
+    // 只合并 isReleased 相同的两段：还给过操作系统的页和驻留的页混在一个span里的话，isReleased 怎么记都不对——
+    // 记成没还过，releasedBytes 少算，下一轮还要把已经还掉的页再 madvise 一遍、白白占掉 releaseRate 的预算；
+    // 记成还过，驻留的那部分就再也不会被还掉。两段都是全 0 才算全 0；闲置时间按晚的那段重新算
+    Span* prev_span = pageMap_.get(pageIdOf(span->pageAddr) - 1);
+    if (prev_span && !prev_span->isUse && prev_span->isReleased == span->isReleased) {
+        removeFreeSpan(prev_span);
+
+        prev_span->numPages += span->numPages;
+        prev_span->isZero = prev_span->isZero && span->isZero;
+        prev_span->freeTime = std::max(prev_span->freeTime, span->freeTime);
+        deleteSpan(span);
+        span = prev_span;  // 后续操作基于合并后的Span
+    }
+
+    // 合并后一个相邻Span
+    Span* next_span = pageMap_.get(pageIdOf(span->pageAddr) + span->numPages);
+    if (next_span && !next_span->isUse && next_span->isReleased == span->isReleased) {
+        removeFreeSpan(next_span);
+
+        span->numPages += next_span->numPages;
+        span->isZero = span->isZero && next_span->isZero;
+        span->freeTime = std::max(span->freeTime, next_span->freeTime);
+        deleteSpan(next_span);
+    }
+
+    // 将合并后的Span重新登记并插入空闲链表
+    // 被合并掉的span在基数树里可能还残留在中间页上，但合并只看边界页，所以不会被再次访问到
+    registerFreeSpan(span);
+    pushFreeSpan(span);
+}
+
+
+Span* PageCache::takeFreeSpan(size_t numPages) {
+    // 先在恰好合适或者更大一点的链表里找，第一个非空的就是最佳适配
+    for (size_t n = numPages; n < kMaxPages; ++n) {
+        if (Span* span = freeSpans_[n]) {
+            removeFreeSpan(span);
+            return span;
         }
-        span = it->second;
-        spanMap_.erase(it);  // ȴmapƳ
     }
 
-    // 3. SpanСѡӦķƬ
-    size_t lock_idx = span->numPages % kMaxLockedPages;
-    std::unique_lock<std::mutex> span_lock(page_locks_[lock_idx]);
+    // 大span链表不按页数排序，遍历找最小的那个够用的
+    Span* best = nullptr;
+    for (Span* span = freeSpans_[kMaxPages]; span; span = span->next) {
+        if (span->numPages >= numPages && (!best || span->numPages < best->numPages)) {
+            best = span;
+        }
+    }
+    if (best) removeFreeSpan(best);
+    return best;
+}
 
-    // 4. ϲǰһSpan
-    void* prev_end = static_cast<char*>(span->pageAddr) - 1;
-    {
-        std::lock_guard<std::mutex> free_span_lock(free_span_mutex_);
-        auto it = free_span_map_.upper_bound(prev_end);
-        if (it != free_span_map_.begin()) {
-            --it;
-            Span* prev_span = it->second;
-
-            // 
-            if (static_cast<char*>(prev_span->pageAddr) + prev_span->numPages * PAGE_SIZE == span->pageAddr) {
-                // ǰһSpanķƬ
-                size_t prev_lock_idx = prev_span->numPages % kMaxLockedPages;
-                if (lock_idx != prev_lock_idx) {
-                    span_lock.unlock();
-                    std::lock(page_locks_[prev_lock_idx], page_locks_[lock_idx]);//ʹstd::lockһס2mutex
-                    span_lock.lock(); // ǰƬ
+size_t PageCache::releaseFreeMemory(size_t maxBytes, uint64_t minIdleMs) {
+    // madvise 一大段要很久，不能拿着全局锁做：每一轮在锁里挑出最多 kReleaseBatch 个span从空闲链表上摘下来，
+    // 标成使用中（别的线程分配不到它，释放邻居时也不会合并它），解锁以后再 madvise，最后加锁挂回去
+    static constexpr size_t kReleaseBatch = 16;
+    uint64_t now = nowMs();
+    size_t released = 0;
+    while (released < maxBytes) {
+        Span* picked[kReleaseBatch];
+        size_t count = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t planned = released;
+            // 从大span往小span找，同样的字节数 madvise 的次数最少
+            for (size_t n = kMaxPages; n >= 1 && count < kReleaseBatch && planned < maxBytes; --n) {
+                Span* next = nullptr;
+                for (Span* span = freeSpans_[n]; span && count < kReleaseBatch && planned < maxBytes; span = next) {
+                    next = span->next;
+                    if (span->isReleased || now - span->freeTime < minIdleMs) continue;
+                    removeFreeSpan(span);
+
+                    // 比剩下的预算大：只还前面够预算的几页，后面的切成一个单独的空闲span留着
+                    size_t budget = maxBytes - planned; // maxBytes 默认是 SIZE_MAX，先加 PAGE_SIZE - 1 再除会溢出
+                    size_t budgetPages = budget / PAGE_SIZE + (budget % PAGE_SIZE != 0);
+                    if (span->numPages > budgetPages) {
+                        // 要不到 Span 对象就切不开，整个还掉会远远超出预算：原样挂回去，这一个先不还
+                        Span* rest = newSpan();
+                        if (!rest) {
+                            pushFreeSpan(span);
+                            continue;
+                        }
+                        *rest = *span;
+                        rest->pageAddr = static_cast<char*>(span->pageAddr) + budgetPages * PAGE_SIZE;
+                        rest->numPages = span->numPages - budgetPages;
+                        span->numPages = budgetPages;
+                        registerFreeSpan(rest);
+                        pushFreeSpan(rest);
+                        registerFreeSpan(span);
+                    }
+                    span->isUse = true;
+                    picked[count++] = span;
+                    planned += span->numPages * PAGE_SIZE;
                 }
+            }
+        }
+        if (count == 0) break;
 
-                // ִкϲ
-                prev_span->numPages += span->numPages;
-                delete span;
-                span = prev_span;  // ںϲSpan
+        bool decommitted[kReleaseBatch];
+        for (size_t i = 0; i < count; ++i) {
+            decommitted[i] = SystemMemory::decommit(picked[i]->pageAddr, picked[i]->numPages * PAGE_SIZE);
+        }
 
-                //  free_span_map_ ƳѺϲ Span
-                free_span_map_.erase(prev_span->pageAddr);
+        // 失败的span原样挂回去，下一轮还会被挑中；一整轮都失败就不再试了
+        size_t before = released;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < count; ++i) {
+            Span* span = picked[i];
+            span->isUse = false;
+            if (decommitted[i]) {
+                span->isReleased = true;
+                span->isZero = SystemMemory::kDecommitZeroes;
+                released += span->numPages * PAGE_SIZE;
             }
+            insertFreeSpan(span);
         }
+        if (released == before) break;
     }
+    return released;
+}
 
-    // 5. ϲһSpan
-    void* next_start = static_cast<char*>(span->pageAddr) + span->numPages * PAGE_SIZE;
-    {
-        std::lock_guard<std::mutex> free_span_lock(free_span_mutex_);
-        auto it = free_span_map_.find(next_start);
-        if (it != free_span_map_.end()) {
-            Span* next_span = it->second;
-
-            // һSpanķƬ
-            size_t next_lock_idx = next_span->numPages % kMaxLockedPages;
-            if (lock_idx != next_lock_idx) {
-                span_lock.unlock();
-                std::lock(page_locks_[lock_idx], page_locks_[next_lock_idx]);
-                span_lock.lock();
-            }
+size_t PageCache::freeBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return freePages_ * PAGE_SIZE;
+}
 
-            // ִкϲ
-            span->numPages += next_span->numPages;
+size_t PageCache::releasedBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return releasedPages_ * PAGE_SIZE;
+}
 
-            //  free_span_map_ ƳѺϲ Span
-            free_span_map_.erase(next_span->pageAddr);
+PageHeapStats PageCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return { spanAllocs_, systemAllocs_, systemPages_ * PAGE_SIZE, freePages_ * PAGE_SIZE, releasedPages_ * PAGE_SIZE };
+}
 
-            // ӿƳϲ Span
-            auto& next_list = freeSpans_[next_span->numPages];
-            Span** indirect = &next_list;
-            while (*indirect != next_span) {
-                indirect = &(*indirect)->next;
-            }
-            *indirect = next_span->next;
+void PageCache::pushFreeSpan(Span* span) {
+    freePages_ += span->numPages;
+    if (span->isReleased) releasedPages_ += span->numPages;
 
-            delete next_span;
-        }
-    }
+    Span*& head = freeSpans_[freeListIndex(span->numPages)];
+    span->prev = nullptr;
+    span->next = head;
+    if (head) head->prev = span;
+    head = span;
+}
 
-    // 6. ϲSpan²
-    auto& free_list = freeSpans_[span->numPages];
-    span->next = free_list;
-    free_list = span;
+void PageCache::removeFreeSpan(Span* span) {
+    freePages_ -= span->numPages;
+    if (span->isReleased) releasedPages_ -= span->numPages;
 
-    // 뵽 free_span_map_
-    {
-        std::lock_guard<std::mutex> free_span_lock(free_span_mutex_);
-        free_span_map_[span->pageAddr] = span;
+    if (span->prev) {
+        span->prev->next = span->next;
     }
+    else {
+        freeSpans_[freeListIndex(span->numPages)] = span->next;
+    }
+    if (span->next) span->next->prev = span->prev;
+    span->next = span->prev = nullptr;
+}
 
-    // 7. ¼¼ȫӳ䣨Ȼͷţ spanMap_ ֤ͷŵָǷϷ
-    // ע⣺ﲻҪٲ spanMap_Ϊ span ͷ
-}
\ No newline at end of file
+bool PageCache::registerSpan(Span* span) {
+    uintptr_t start = pageIdOf(span->pageAddr);
+    if (!pageMap_.ensure(start, span->numPages)) return false;
+    for (size_t i = 0; i < span->numPages; ++i) {
+        pageMap_.set(start + i, span);
+    }
+    return true;
+}
+
+bool PageCache::registerFreeSpan(Span* span) {
+    uintptr_t start = pageIdOf(span->pageAddr);
+    if (!pageMap_.ensure(start, span->numPages)) return false;
+    pageMap_.set(start, span);
+    pageMap_.set(start + span->numPages - 1, span);
+    return true;
+}
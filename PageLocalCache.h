@@ -0,0 +1,456 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include "common.h"
+#include "PoolPolicy.h"
+#include "MetadataAllocator.h"
+#include "ThreadCache.h"
+#include "HeapProfiler.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// 按页分片的自由链表（mimalloc 的 free-list sharding），和 ThreadCache + CentralCache 并列的另一套分配引擎
+//
+// ThreadCache 和 CentralCache 的自由链表里什么 span 的块都有，按 LIFO 的顺序进出，
+// 分配释放反复折腾一阵以后，连续分配出来的块散落在很多页上：建一棵树、一条链表，节点挨个分配，
+// 遍历的时候几乎每一跳都是新的缓存行甚至新的页，TLB 和缓存的命中率都很差。
+// 这里每个线程直接从 PageCache 拿 span，span 只归这一个线程，每个 span 自己管自己的块：
+//   freeList：分配从这里取
+//   bumpPtr：还没切过的部分（见 Span::bumpBlock），freeList 空了、也没有还回来的块时才切一页出来放进 freeList
+//   localFree：主人线程释放的块放这里，不直接放回 freeList
+//   threadFree：别的线程释放的块，CAS 头插，主人整条拿走（只有整条拿走，没有 ABA）
+// 每个大小类有一个当前 span，分配一直从它的 freeList 取，取空了才把 localFree / threadFree 整条换进来，
+// 再没有就往后切一页，还是空的就换下一个 span。所以连续的分配总是落在同一个 span 上，而且地址顺序基本就是切块时的顺序。
+//
+// 每个线程每个大小类的 span 分三类：current（正在分配）、available（有空闲块，等 current 用完接班）、
+// full（块都分出去了）。主人在 full 的 span 上释放一块就把它挪回 available；
+// 别的线程释放到 full 的 span 上时，只在 threadFree 从空变成非空的那一次通知主人（remotePending_），
+// 主人下次换 span 的时候把 full 链表扫一遍，不用每次都扫。
+// span 上的块全部回来（useCount 为 0）并且不是 current 的话，整个还给 PageCache。
+//
+// 线程退出时能还的 span 都还掉，还有块在别人手里的 span 放进全局的 abandoned 链表，
+// owner 清空以后别的线程的释放照样进 threadFree，下一个缺这个大小类 span 的线程接手。
+// 接手之前这些 span 上就算所有块都回来了也还不了，等有人接手时才还。
+// 线程对象永远不释放，退出以后留给新线程复用：别的线程可能刚读到 owner 还没来得及通知
+//
+// 块的大小类和中心缓存那一套一样（Policy::SizeClass），大对象也一样走 ThreadCache::allocateLarge；
+// 但小块的 span 不经过中心缓存，所以从这里分配的小块只能还给这里，不能交给 MemoryPool::deallocate
+template <class Policy>
+class BasicPageLocalCache
+{
+public:
+    using SizeClass = typename Policy::SizeClass;
+    using ThreadCache = BasicThreadCache<Policy>;
+    static constexpr size_t kNumClasses = SizeClass::kNumClasses;
+
+    static void* allocate(size_t size)
+    {
+        BasicPageLocalCache* cache = getInstance();
+        return cache ? cache->allocateLocal(size) : nullptr;
+    }
+
+    // 要查 span 才知道是不是自己的，所以带不带 size 都一样
+    static void deallocate(void* ptr, size_t) { deallocate(ptr); }
+
+    static void deallocate(void* ptr)
+    {
+        if (!ptr) return;
+        Span* span = PageCache::getInstance().mapToSpan(ptr);
+        assert(span && span->isUse && "Attempt to deallocate unmanaged memory!");
+        if (span->objSize == 0)
+        {
+            ThreadCache::deallocateLarge(span);
+            return;
+        }
+
+        BasicPageLocalCache* owner = ownerOf(span);
+        BasicPageLocalCache* self = tlsInstance_;
+        if (owner && owner == self) owner->freeLocal(span, ptr);
+        else freeRemote(span, owner, ptr);
+    }
+
+private:
+    static BasicPageLocalCache* getInstance()
+    {
+        BasicPageLocalCache* instance = tlsInstance_;
+        if (!instance) instance = createInstance();
+        return instance;
+    }
+
+    static BasicPageLocalCache* createInstance();
+    static void destroyInstance(void* instance); // 线程退出时调用
+
+    BasicPageLocalCache()
+    {
+        current_.fill(nullptr);
+        available_.fill(nullptr);
+        full_.fill(nullptr);
+        for (auto& pending : remotePending_) pending.store(false, std::memory_order_relaxed);
+    }
+
+    void* allocateLocal(size_t size);
+    void* allocateSlow(size_t index);
+    void freeLocal(Span* span, void* ptr);
+    static void freeRemote(Span* span, BasicPageLocalCache* owner, void* ptr);
+
+    static void* pop(Span* span)
+    {
+        void* ptr = span->freeList;
+        span->freeList = *reinterpret_cast<void**>(ptr);
+        ++span->useCount;
+        return ptr;
+    }
+
+    static bool refill(Span* span);       // freeList 空了：把 localFree 和 threadFree 换进来，再不行切一页新的，还是空的返回 false
+    static void extend(Span* span);
+    static void collectThreadFree(Span* span);
+    void sweepFull(size_t index);         // 别的线程往 full 的 span 上还过块：扫一遍，有空闲块的挪回 available
+    Span* adoptAbandoned(size_t index);   // 接手退出的线程留下的 span
+    Span* newSpan(size_t index);          // 从 PageCache 要一个新 span，先切出第一页
+    static void releaseSpan(Span* span);  // 块全部回来了，还给 PageCache
+
+    // span 链表：借用 span 的 next/prev（和 CentralSpanList 一样，交出去以后 PageCache 不再用它们）
+    static void pushFront(Span*& head, Span* span)
+    {
+        span->prev = nullptr;
+        span->next = head;
+        if (head) head->prev = span;
+        head = span;
+    }
+
+    static void unlink(Span*& head, Span* span)
+    {
+        if (span->prev) span->prev->next = span->next;
+        else head = span->next;
+        if (span->next) span->next->prev = span->prev;
+        span->next = span->prev = nullptr;
+    }
+
+    // owner / threadFree 会被别的线程并发地读写，通过 atomic_ref 访问
+    static BasicPageLocalCache* ownerOf(Span* span)
+    {
+        return static_cast<BasicPageLocalCache*>(std::atomic_ref<void*>(span->owner).load(std::memory_order_acquire));
+    }
+
+    static void setOwner(Span* span, BasicPageLocalCache* owner)
+    {
+        std::atomic_ref<void*>(span->owner).store(owner, std::memory_order_release);
+    }
+
+private:
+    std::array<Span*, kNumClasses> current_;
+    std::array<Span*, kNumClasses> available_;
+    std::array<Span*, kNumClasses> full_;
+    std::array<std::atomic<bool>, kNumClasses> remotePending_; // 别的线程在 full 的 span 上释放过块
+
+    BasicPageLocalCache* nextFree_ = nullptr; // 退出的线程留下的对象，由 instanceMutex_ 保护
+    static inline std::mutex instanceMutex_;
+    static inline BasicPageLocalCache* freeInstances_ = nullptr;
+
+    // 退出的线程留下的、还有块在别人手里的 span，每个大小类一条
+    static inline std::mutex abandonedMutex_;
+    static inline std::array<Span*, kNumClasses> abandoned_{};
+    static inline std::atomic<size_t> abandonedCount_{ 0 }; // 没有的时候不用加锁去看
+
+    static inline thread_local BasicPageLocalCache* tlsInstance_ THREAD_CACHE_TLS_MODEL = nullptr;
+};
+
+
+template <class Policy>
+BasicPageLocalCache<Policy>* BasicPageLocalCache<Policy>::createInstance()
+{
+    BasicPageLocalCache* instance = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(instanceMutex_);
+        instance = freeInstances_;
+        if (instance) freeInstances_ = instance->nextFree_;
+    }
+    if (!instance)
+    {
+        void* mem = MetadataAllocator<BasicPageLocalCache>::allocate();
+        if (!mem) return nullptr;
+        instance = new (mem) BasicPageLocalCache();
+    }
+    tlsInstance_ = instance;
+
+    // 和 ThreadCache 一样用 pthread_key 的析构回调，不需要分配内存
+#ifdef _WIN32
+    struct Cleaner
+    {
+        BasicPageLocalCache* instance;
+        ~Cleaner() { destroyInstance(instance); }
+    };
+    thread_local Cleaner cleaner{ instance };
+    cleaner.instance = instance;
+#else
+    static pthread_key_t key = [] {
+        pthread_key_t k;
+        pthread_key_create(&k, &BasicPageLocalCache::destroyInstance);
+        return k;
+    }();
+    pthread_setspecific(key, instance);
+#endif
+    return instance;
+}
+
+template <class Policy>
+void BasicPageLocalCache<Policy>::destroyInstance(void* instance)
+{
+    BasicPageLocalCache* cache = static_cast<BasicPageLocalCache*>(instance);
+    if (!cache) return;
+
+    for (size_t index = 0; index < kNumClasses; ++index)
+    {
+        if (Span* span = cache->current_[index]) pushFront(cache->available_[index], span);
+        cache->current_[index] = nullptr;
+
+        for (Span** list : { &cache->available_[index], &cache->full_[index] })
+        {
+            while (Span* span = *list)
+            {
+                unlink(*list, span);
+                span->inFull = false;
+                collectThreadFree(span);
+                if (span->useCount == 0)
+                {
+                    releaseSpan(span);
+                    continue;
+                }
+
+                setOwner(span, nullptr);
+                std::lock_guard<std::mutex> lock(abandonedMutex_);
+                pushFront(abandoned_[index], span);
+                abandonedCount_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        cache->remotePending_[index].store(false, std::memory_order_relaxed);
+    }
+
+    if (tlsInstance_ == cache) tlsInstance_ = nullptr;
+    std::lock_guard<std::mutex> lock(instanceMutex_);
+    cache->nextFree_ = freeInstances_;
+    freeInstances_ = cache;
+}
+
+
+template <class Policy>
+void* BasicPageLocalCache<Policy>::allocateLocal(size_t size)
+{
+    if (size == 0) size = SizeClass::kAlignment;
+
+    // 堆采样（见 HeapProfiler.h），抽中的对象自己占一个 span，释放时按大对象处理
+    if (HeapProfiler::tick(size))
+    {
+        if (void* ptr = HeapProfiler::allocateSampled(size)) return ptr;
+    }
+
+    if (size > SizeClass::kMaxBytes) return ThreadCache::allocateLarge(size);
+
+    size_t index = SizeClass::getIndex(size);
+    Span* span = current_[index];
+    if (span && span->freeList) return pop(span);
+    return allocateSlow(index);
+}
+
+template <class Policy>
+void* BasicPageLocalCache<Policy>::allocateSlow(size_t index)
+{
+    // 1. 当前 span 的 freeList 用完了，先看它自己这段时间收回来的块
+    if (Span* span = current_[index])
+    {
+        if (refill(span)) return pop(span);
+        current_[index] = nullptr;
+        span->inFull = true;
+        pushFront(full_[index], span);
+    }
+
+    // 2. 别的线程在 full 的 span 上还过块
+    if (remotePending_[index].load(std::memory_order_relaxed) && remotePending_[index].exchange(false, std::memory_order_acquire))
+    {
+        sweepFull(index);
+    }
+
+    // 3. 有空闲块的 span 接班
+    while (Span* span = available_[index])
+    {
+        unlink(available_[index], span);
+        if (refill(span))
+        {
+            current_[index] = span;
+            return pop(span);
+        }
+        span->inFull = true;
+        pushFront(full_[index], span);
+    }
+
+    // 4. 退出的线程留下的 span，再不行就找 PageCache 要新的
+    Span* span = adoptAbandoned(index);
+    if (!span) span = newSpan(index);
+    if (!span) return nullptr;
+    current_[index] = span;
+    return pop(span);
+}
+
+template <class Policy>
+void BasicPageLocalCache<Policy>::freeLocal(Span* span, void* ptr)
+{
+    *reinterpret_cast<void**>(ptr) = span->localFree;
+    span->localFree = ptr;
+    --span->useCount;
+
+    size_t index = span->sizeClass;
+    if (span->inFull)
+    {
+        span->inFull = false;
+        unlink(full_[index], span);
+        pushFront(available_[index], span);
+    }
+    if (span->useCount == 0 && span != current_[index])
+    {
+        // 整个 span 都空了，还给 PageCache（threadFree 里的块也算在 useCount 里，所以这时它一定是空的）
+        unlink(available_[index], span);
+        releaseSpan(span);
+    }
+}
+
+template <class Policy>
+void BasicPageLocalCache<Policy>::freeRemote(Span* span, BasicPageLocalCache* owner, void* ptr)
+{
+    // 放进 threadFree 以后主人随时可能把 span 还给 PageCache、span 对象被回收，所以主人和大小类要先读出来
+    size_t index = span->sizeClass;
+    std::atomic_ref<void*> threadFree(span->threadFree);
+    void* head = threadFree.load(std::memory_order_relaxed);
+    do {
+        *reinterpret_cast<void**>(ptr) = head;
+    } while (!threadFree.compare_exchange_weak(head, ptr, std::memory_order_release, std::memory_order_relaxed));
+
+    // threadFree 从空变成非空，span 可能在主人的 full 链表上，告诉主人下次换 span 时扫一遍
+    if (!head && owner) owner->remotePending_[index].store(true, std::memory_order_release);
+}
+
+template <class Policy>
+bool BasicPageLocalCache<Policy>::refill(Span* span)
+{
+    if (span->freeList) return true;
+    span->freeList = span->localFree;
+    span->localFree = nullptr;
+    collectThreadFree(span);
+    if (!span->freeList && span->bumpPtr) extend(span);
+    return span->freeList != nullptr;
+}
+
+template <class Policy>
+void BasicPageLocalCache<Policy>::extend(Span* span)
+{
+    // 一次最多切一页（至少一块），按地址顺序串起来，连续分配出去的块就是一个挨一个的；
+    // 没用到的页一直不碰，大的大小类一个 span 好几页，往往只用得上前面几页
+    size_t size = span->objSize;
+    size_t num = std::max<size_t>(PageCache::PAGE_SIZE / size, 1);
+    void** tail = &span->freeList;
+    for (size_t i = 0; i < num && span->bumpPtr; ++i)
+    {
+        void* block = span->bumpBlock();
+        *tail = block;
+        tail = reinterpret_cast<void**>(block);
+    }
+    *tail = nullptr;
+}
+
+template <class Policy>
+void BasicPageLocalCache<Policy>::collectThreadFree(Span* span)
+{
+    std::atomic_ref<void*> threadFree(span->threadFree);
+    if (!threadFree.load(std::memory_order_relaxed)) return;
+    void* list = threadFree.exchange(nullptr, std::memory_order_acquire);
+
+    // 接在 freeList 前面，顺便数一下有几块
+    void* tail = list;
+    size_t num = 1;
+    while (void* next = *reinterpret_cast<void**>(tail))
+    {
+        tail = next;
+        ++num;
+    }
+    *reinterpret_cast<void**>(tail) = span->freeList;
+    span->freeList = list;
+    span->useCount -= num;
+}
+
+template <class Policy>
+void BasicPageLocalCache<Policy>::sweepFull(size_t index)
+{
+    Span* span = full_[index];
+    while (span)
+    {
+        Span* next = span->next;
+        if (std::atomic_ref<void*>(span->threadFree).load(std::memory_order_relaxed))
+        {
+            unlink(full_[index], span);
+            span->inFull = false;
+            collectThreadFree(span);
+            if (span->useCount == 0) releaseSpan(span);
+            else pushFront(available_[index], span);
+        }
+        span = next;
+    }
+}
+
+template <class Policy>
+Span* BasicPageLocalCache<Policy>::adoptAbandoned(size_t index)
+{
+    if (abandonedCount_.load(std::memory_order_relaxed) == 0) return nullptr;
+
+    while (true)
+    {
+        Span* span;
+        {
+            std::lock_guard<std::mutex> lock(abandonedMutex_);
+            span = abandoned_[index];
+            if (!span) return nullptr;
+            unlink(abandoned_[index], span);
+            abandonedCount_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        setOwner(span, this);
+        if (refill(span)) return span;
+
+        // 块全在别人手里，先放进 full 链表，等它们回来。释放的线程刚才读到的 owner 可能还是空的，
+        // 不会通知这里，所以自己先记一笔，下次换 span 时扫一遍（在那之后才放进来的块要等到线程退出才会收回）
+        span->inFull = true;
+        pushFront(full_[index], span);
+        remotePending_[index].store(true, std::memory_order_relaxed);
+    }
+}
+
+template <class Policy>
+Span* BasicPageLocalCache<Policy>::newSpan(size_t index)
+{
+    Span* span = PageCache::getInstance().allocateSpan(SizeClass::classToPages(index));
+    if (!span) return nullptr;
+
+    size_t size = SizeClass::classToSize(index);
+    span->sizeClass = index;
+    span->objSize = size;
+
+    span->initBump((span->numPages * PageCache::PAGE_SIZE) / size);
+    span->freeList = nullptr;
+    span->useCount = 0;
+    extend(span);
+    setOwner(span, this);
+    return span;
+}
+
+template <class Policy>
+void BasicPageLocalCache<Policy>::releaseSpan(Span* span)
+{
+    PageCache::getInstance().deallocateSpan(span->pageAddr, span->numPages);
+}
+
+// 默认配置的按页分片前端
+using PageLocalCache = BasicPageLocalCache<DefaultPoolPolicy>;
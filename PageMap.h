@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "MetadataAllocator.h"
+
+// 页号 -> T* 的三层基数树（radix tree），用来替代 std::map<void*, Span*>
+//
+// x86-64 / AArch64 的用户态地址只有低 48 位有效，页大小 4KB 时页号一共 48 - 12 = 36 位，
+// 这里把 36 位拆成 12/12/12 三段：
+//   root_[高12位] -> Node
+//   Node[中12位]  -> Leaf
+//   Leaf[低12位]  -> T*
+// 每个 Leaf 覆盖 4096 页（16MB），只有真正被用到的地址区间才会分配 Node/Leaf，
+// 所以整棵树的内存占用和实际使用的地址空间成正比，而不是和 2^36 成正比。
+//
+// 并发约定：
+//   读（get）完全无锁：每一层指针都用 acquire 读，节点一旦挂上去就永远不会被摘掉
+//   写（set / ensure）必须由调用方串行化（PageCache 用自己的 mutex_ 保证），
+//   新节点先初始化再用 release 发布，所以无锁读者要么看到 nullptr，要么看到完整的节点
+//   节点从 MetadataAllocator 分配，不经过 malloc
+template <typename T, int BITS>
+class PageMap
+{
+public:
+    PageMap()
+    {
+        for (auto& p : root_) {
+            p.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    // 无锁查询：pageId 所在的页没有登记过时返回 nullptr
+    T* get(uintptr_t pageId) const
+    {
+        if ((pageId >> BITS) != 0) return nullptr;
+
+        Node* node = root_[rootIndex(pageId)].load(std::memory_order_acquire);
+        if (!node) return nullptr;
+        Leaf* leaf = node->leaves[nodeIndex(pageId)].load(std::memory_order_acquire);
+        if (!leaf) return nullptr;
+        return leaf->values[leafIndex(pageId)].load(std::memory_order_acquire);
+    }
+
+    // 登记一页，调用前必须已经 ensure 过这一页
+    void set(uintptr_t pageId, T* value)
+    {
+        Node* node = root_[rootIndex(pageId)].load(std::memory_order_relaxed);
+        Leaf* leaf = node->leaves[nodeIndex(pageId)].load(std::memory_order_relaxed);
+        leaf->values[leafIndex(pageId)].store(value, std::memory_order_release);
+    }
+
+    // 保证 [start, start + n) 这些页对应的中间节点和叶子都已经分配
+    bool ensure(uintptr_t start, size_t n)
+    {
+        for (uintptr_t key = start; key < start + n;) {
+            if ((key >> BITS) != 0) return false;
+
+            auto& nodeSlot = root_[rootIndex(key)];
+            Node* node = nodeSlot.load(std::memory_order_relaxed);
+            if (!node) {
+                void* mem = MetadataAllocator<Node>::allocate();
+                if (!mem) return false;
+                node = new (mem) Node();
+                nodeSlot.store(node, std::memory_order_release);
+            }
+
+            auto& leafSlot = node->leaves[nodeIndex(key)];
+            if (!leafSlot.load(std::memory_order_relaxed)) {
+                void* mem = MetadataAllocator<Leaf>::allocate();
+                if (!mem) return false;
+                leafSlot.store(new (mem) Leaf(), std::memory_order_release);
+            }
+
+            // 跳到下一个叶子覆盖的起始页
+            key = ((key >> LEAF_BITS) + 1) << LEAF_BITS;
+        }
+        return true;
+    }
+
+private:
+    static constexpr int INTERIOR_BITS = (BITS + 2) / 3;
+    static constexpr int LEAF_BITS = BITS - 2 * INTERIOR_BITS;
+    static constexpr size_t INTERIOR_LENGTH = size_t(1) << INTERIOR_BITS;
+    static constexpr size_t LEAF_LENGTH = size_t(1) << LEAF_BITS;
+
+    struct Leaf {
+        std::atomic<T*> values[LEAF_LENGTH] = {};
+    };
+
+    struct Node {
+        std::atomic<Leaf*> leaves[INTERIOR_LENGTH] = {};
+    };
+
+    static size_t rootIndex(uintptr_t k) { return k >> (LEAF_BITS + INTERIOR_BITS); }
+    static size_t nodeIndex(uintptr_t k) { return (k >> LEAF_BITS) & (INTERIOR_LENGTH - 1); }
+    static size_t leafIndex(uintptr_t k) { return k & (LEAF_LENGTH - 1); }
+
+    std::atomic<Node*> root_[INTERIOR_LENGTH];
+};
@@ -9,7 +9,7 @@
 
 using namespace std::chrono;
 
-// ʱ
+// 计时器类
 class Timer
 {
     high_resolution_clock::time_point start;
@@ -19,15 +19,15 @@ public:
     double elapsed()
     {
         auto end = high_resolution_clock::now();
-        return duration_cast<microseconds>(end - start).count() / 1000.0; // תΪ
+        return duration_cast<microseconds>(end - start).count() / 1000.0; // 转换为毫秒
     }
 };
 
-// ܲ
+// 性能测试类
 class PerformanceTest
 {
 private:
-    // ͳϢ
+    // 测试统计信息
     struct TestStats
     {
         double memPoolTime{ 0.0 };
@@ -37,32 +37,32 @@ private:
     };
 
 public:
-    // 1. ϵͳԤ
+    // 1. 系统预热
     static void warmup()
     {
         std::cout << "Warming up memory systems...\n";
-        // ʹ pair 洢ָͶӦĴС
+        // 使用 pair 来存储指针和对应的大小
         std::vector<std::pair<void*, size_t>> warmupPtrs;
 
-        // Ԥڴ
+        // 预热内存池
         for (int i = 0; i < 1000; ++i)
         {
             for (size_t size : {32, 64, 128, 256, 512}) {
                 void* p = MemoryPool::allocate(size);
-                warmupPtrs.emplace_back(p, size);  // 洢ָͶӦĴС
+                warmupPtrs.emplace_back(p, size);  // 存储指针和对应的大小
             }
         }
 
-        // ͷԤڴ
+        // 释放预热内存
         for (const auto& [ptr, size] : warmupPtrs)
         {
-            MemoryPool::deallocate(ptr, size);  // ʹʵʷĴСͷ
+            MemoryPool::deallocate(ptr, size);  // 使用实际分配的大小进行释放
         }
 
         std::cout << "Warmup complete.\n\n";
     }
 
-    // 2. С
+    // 2. 小对象分配测试
     static void testSmallAllocation()
     {
         constexpr size_t NUM_ALLOCS = 100000;
@@ -71,7 +71,7 @@ public:
         std::cout << "\nTesting small allocations (" << NUM_ALLOCS << " allocations of "
             << SMALL_SIZE << " bytes):" << std::endl;
 
-        // ڴ
+        // 测试内存池
         {
             Timer t;
             std::vector<void*> ptrs;
@@ -81,7 +81,7 @@ public:
             {
                 ptrs.push_back(MemoryPool::allocate(SMALL_SIZE));
 
-                // ģʵʹãͷ
+                // 模拟真实使用：部分立即释放
                 if (i % 4 == 0)
                 {
                     MemoryPool::deallocate(ptrs.back(), SMALL_SIZE);
@@ -98,7 +98,7 @@ public:
                 << t.elapsed() << " ms" << std::endl;
         }
 
-        // new/delete
+        // 测试new/delete
         {
             Timer t;
             std::vector<void*> ptrs;
@@ -125,7 +125,7 @@ public:
         }
     }
 
-    // 3. ̲߳
+    // 3. 多线程测试
     static void testMultiThreaded(size_t num)
     {
         /*constexpr size_t NUM_THREADS = 4;*/
@@ -152,9 +152,9 @@ public:
                         : new char[size];
                     ptrs.push_back({ ptr, size });
 
-                    // ͷһЩڴ
+                    // 随机释放一些内存
                     if (rand() % 100 < 75)
-                    {  // 75%ĸͷ
+                    {  // 75%的概率释放
                         size_t index = rand() % ptrs.size();
                         if (useMemPool)
                         {
@@ -169,7 +169,7 @@ public:
                     }
                 }
 
-                // ʣڴ
+                // 清理剩余内存
                 for (const auto& [ptr, size] : ptrs)
                 {
                     if (useMemPool)
@@ -183,7 +183,7 @@ public:
                 }
             };
 
-        // ڴ
+        // 测试内存池
         {
             Timer t;
             std::vector<std::thread> threads;
@@ -202,7 +202,7 @@ public:
                 << t.elapsed() << " ms" << std::endl;
         }
 
-        // new/delete
+        // 测试new/delete
         {
             Timer t;
             std::vector<std::thread> threads;
@@ -222,7 +222,46 @@ public:
         }
     }
 
-    // 4. ϴС
+    // 中心缓存争用测试：所有线程反复整批取、整批还同一个大小类，只走传输缓存（无锁版本是 pop + push 各两次 CAS，加锁版本是分片锁）
+    // 无锁版本的栈顶是 8 字节的 TaggedIndex，CAS 是一条 lock cmpxchg；原来 16 字节的版本要调用 libatomic
+    // 两种中心缓存都是模板，同一个程序里可以直接对比（见 PoolPolicy.h）
+    template <class Central>
+    static void testCentralContention(const char* name, size_t num)
+    {
+        size_t NUM_THREADS = num;
+        constexpr size_t ROUNDS_PER_THREAD = 200000;
+
+        std::cout << "\nTesting central cache contention (" << name << ", " << NUM_THREADS
+            << " threads, " << ROUNDS_PER_THREAD << " batch round trips each):" << std::endl;
+
+        size_t index = SizeClass::getIndex(64);
+        size_t batchNum = SizeClass::numToMove(index);
+        size_t batchBytes = batchNum * SizeClass::classToSize(index);
+
+        Timer t;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < NUM_THREADS; ++i)
+        {
+            threads.emplace_back([=]() {
+                Central& central = Central::getInstance();
+                for (size_t r = 0; r < ROUNDS_PER_THREAD; ++r)
+                {
+                    void* batch = central.fetchRange(index, batchNum);
+                    central.returnRange(batch, batchBytes, index);
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        double ms = t.elapsed();
+        std::cout << name << ": " << std::fixed << std::setprecision(3) << ms << " ms ("
+            << std::setprecision(1) << ms * 1e6 / (NUM_THREADS * ROUNDS_PER_THREAD) << " ns per round trip)" << std::endl;
+    }
+
+    // 4. 混合大小测试
     static void testMixedSizes()
     {
         constexpr size_t NUM_ALLOCS = 50000;
@@ -231,7 +270,7 @@ public:
         std::cout << "\nTesting mixed size allocations (" << NUM_ALLOCS
             << " allocations):" << std::endl;
 
-        // ڴ
+        // 测试内存池
         {
             Timer t;
             std::vector<std::pair<void*, size_t>> ptrs;
@@ -243,7 +282,7 @@ public:
                 void* p = MemoryPool::allocate(size);
                 ptrs.emplace_back(p, size);
 
-                // ͷ
+                // 批量释放
                 if (i % 100 == 0 && !ptrs.empty())
                 {
                     size_t releaseCount = std::min(ptrs.size(), size_t(20));
@@ -264,7 +303,7 @@ public:
                 << t.elapsed() << " ms" << std::endl;
         }
 
-        // new/delete
+        // 测试new/delete
         {
             Timer t;
             std::vector<std::pair<void*, size_t>> ptrs;
@@ -303,10 +342,10 @@ int main()
 {
     std::cout << "Starting performance tests..." << std::endl;
 
-    // Ԥϵͳ
+    // 预热系统
     PerformanceTest::warmup();
 
-     //в
+     //运行测试
     PerformanceTest::testSmallAllocation();
     PerformanceTest::testMultiThreaded(1);
     //PerformanceTest::testMixedSizes();
@@ -316,11 +355,17 @@ int main()
     PerformanceTest::testMultiThreaded(160);
     PerformanceTest::testMultiThreaded(320);
     PerformanceTest::testMultiThreaded(640);
+    static_assert(std::atomic<TaggedIndex>::is_always_lock_free);
+    for (size_t threads : { 1, 4, 16 })
+    {
+        PerformanceTest::testCentralContention<LockFreeCentralCache<SizeClass>>("Lock-free Central Cache", threads);
+        PerformanceTest::testCentralContention<LockedCentralCache<SizeClass>>("Locked Central Cache", threads);
+    }
 
-    //    // Ԥϵͳ
+    //    // 预热系统
     //PerformanceTest::warmup();
 
-    //// в
+    //// 运行测试
     //PerformanceTest::testSmallAllocation();
     //PerformanceTest::testMultiThreaded(32);
     //PerformanceTest::testMixedSizes();
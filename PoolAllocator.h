@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include "ObjectPool.h"
+
+// 标准库容器用的分配器：std::list / std::map / std::unordered_map 的节点、std::deque 的块都从线程缓存拿
+//
+//   std::map<int, std::string, std::less<int>, PoolAllocator<std::pair<const int, std::string>>> m;
+//
+// 容器通过 allocator_traits 把它 rebind 成节点类型，节点一次只要一个（n == 1），走 ObjectPool 的编译期大小类；
+// 数组（vector 的缓冲区、deque 的块和 map、unordered_map 的桶）按字节数分配。
+// 释放时容器会把 n 原样传回来，所以总是带 size 释放。分配器没有状态，任意两个实例都相等，容器之间可以随便 swap / splice
+template <class T, class Policy = DefaultPoolPolicy>
+class BasicPoolAllocator
+{
+public:
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    template <class U>
+    struct rebind
+    {
+        using other = BasicPoolAllocator<U, Policy>;
+    };
+
+    BasicPoolAllocator() noexcept = default;
+
+    template <class U>
+    BasicPoolAllocator(const BasicPoolAllocator<U, Policy>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+
+        void* ptr;
+        if (n == 1) ptr = Objects::allocate();
+        else if (alignof(T) > Pool::kAlignment) ptr = Pool::allocateAligned(n * sizeof(T), alignof(T));
+        else ptr = Pool::allocate(n * sizeof(T));
+        if (!ptr) throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept
+    {
+        if (n == 1) Objects::deallocate(ptr);
+        // allocateAligned 可能挑了更大的大小类，按请求的字节数算出来的大小类不一定对，让释放自己查
+        else if (alignof(T) > Pool::kAlignment) Pool::deallocate(ptr);
+        else Pool::deallocate(ptr, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(const BasicPoolAllocator<U, Policy>&) const noexcept { return true; }
+
+private:
+    using Pool = BasicMemoryPool<Policy>;
+    using Objects = BasicObjectPool<T, Policy>;
+};
+
+// 默认配置的分配器
+template <class T>
+using PoolAllocator = BasicPoolAllocator<T, DefaultPoolPolicy>;
@@ -0,0 +1,24 @@
+#pragma once
+#include "common.h"
+#include "CentralCache_Lock.h"
+#include "CentralCache_LockFree.h"
+
+// BasicMemoryPool 的编译期配置：用哪个中心缓存，以及大小类的三个参数（见 common.h 里的 SizeClassRule）
+//
+//   using SsePool = BasicMemoryPool<PoolPolicy<LockFreeCentralCache, 16>>;          每一块都 16 字节对齐
+//   using LockedPool = BasicMemoryPool<PoolPolicy<LockedCentralCache>>;             加锁的中心缓存
+//   using CachelinePool = BasicMemoryPool<PoolPolicy<LockFreeCentralCache, 64, 64 * 1024, 16>>;
+//
+// 不同的配置是不同的类型，各有各的 ThreadCache / CpuCache / 中心缓存单例，可以在同一个程序里并存，
+// 所有的选择都在编译期完成，快速路径上没有多余的分支或者间接调用。
+// 它们共用同一个 PageCache（以及 LargeSpanCache），所以页可以在不同的池之间流动；
+// 但一个池分配出来的块必须还给同一个池（Span 上记的大小类下标只对分配它的那个池有意义）
+template <template <class> class Central, size_t Alignment = ALIGNMENT, size_t MaxBytes = MAX_BYTES, size_t MinSpanPages = 8>
+struct PoolPolicy
+{
+    using SizeClass = BasicSizeClass<Alignment, MaxBytes, MinSpanPages>;
+    using CentralCache = Central<SizeClass>;
+};
+
+// MemoryPool（以及 malloc 替换库）用的配置
+using DefaultPoolPolicy = PoolPolicy<LockFreeCentralCache>;
@@ -0,0 +1,140 @@
+#pragma once
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// 内存池的统计信息，MemoryPool::getStats() 返回
+//
+// 字节数（每一层现在攥着多少）大部分本来就有计数，随时都能拿到；
+// 次数统计（每个大小类的分配 / 释放次数、前端缓存的命中率等）要在分配的快速路径上计数：
+// 计数器放在各自的 ThreadCache（每CPU缓存时是 Slab）里，只有自己写，所以用 relaxed 的 load + store，
+// 编译出来就是一条普通的加法，不是原子指令；getStats 的时候才把所有线程的加起来。
+// 编译时定义 MEMORYPOOL_STATS=0 可以把这些计数整个去掉，getStats 里的次数统计就都是 0
+#ifndef MEMORYPOOL_STATS
+#define MEMORYPOOL_STATS 1
+#endif
+
+// 只有一个线程写、其他线程只读的计数器加 n
+inline void statsAdd(std::atomic<uint64_t>& counter, uint64_t n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct SizeClassStats
+{
+    size_t size = 0;       // 块大小
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+};
+
+struct MemoryPoolStats
+{
+    // 字节数
+    size_t inUseBytes = 0;            // 用户手里的：小对象按块大小算（需要次数统计），大对象按整页算
+    size_t threadCacheBytes = 0;      // 所有 ThreadCache 的自由链表
+    size_t cpuCacheBytes = 0;         // 所有CPU缓存的链表
+    size_t remoteFreeBytes = 0;       // 别的线程释放、还挂在主人的远程释放链表上的块（见 RemoteFreeHeap.h）
+    size_t centralCacheBytes = 0;     // 中心缓存：传输缓存 + span 上的空闲块 + span 切剩的边角料（由 smallSpanBytes 推算，需要次数统计）
+    size_t smallSpanBytes = 0;        // 这个池的中心缓存从 PageCache 拿走、切成小块的 span 一共多少字节
+    size_t largeSpanCacheBytes = 0;   // LargeSpanCache 里缓存着的大span
+    size_t pageHeapFreeBytes = 0;     // PageCache 空闲链表上的 span，还占着物理内存的部分
+    size_t pageHeapReleasedBytes = 0; // PageCache 空闲链表上已经还给操作系统的部分
+    size_t systemBytes = 0;           // 一共向操作系统要过多少字节（地址空间）
+
+    // 次数
+    uint64_t frontendHits = 0;        // 前端缓存（ThreadCache / CpuCache）直接给出去的分配
+    uint64_t frontendMisses = 0;      // 前端缓存空了、去中心缓存拿了一批
+    uint64_t centralReturns = 0;      // 前端缓存还给中心缓存的批数
+    uint64_t remoteFrees = 0;         // 释放时挂到了别的线程的远程释放链表上的块数（见 RemoteFreeHeap.h）
+    uint64_t largeCacheHits = 0;      // LargeSpanCache
+    uint64_t largeCacheMisses = 0;
+    uint64_t pageHeapSpanAllocs = 0;  // PageCache::allocateSpan 的次数
+    uint64_t systemAllocs = 0;        // PageCache 向操作系统要内存的次数
+
+    std::vector<SizeClassStats> sizeClasses;
+
+    // 人看的多行文本，每个大小类一行（没用过的大小类不列）
+    std::string toString() const
+    {
+        std::string out;
+        char line[256];
+        auto add = [&](const char* name, size_t bytes) {
+            std::snprintf(line, sizeof(line), "%-26s %14zu bytes (%8.1f MB)\n", name, bytes, bytes / 1048576.0);
+            out += line;
+        };
+        add("in use", inUseBytes);
+        add("thread caches", threadCacheBytes);
+        add("cpu caches", cpuCacheBytes);
+        add("remote free lists", remoteFreeBytes);
+        add("central cache", centralCacheBytes);
+        add("small spans", smallSpanBytes);
+        add("large span cache", largeSpanCacheBytes);
+        add("page heap free", pageHeapFreeBytes);
+        add("page heap released to OS", pageHeapReleasedBytes);
+        add("system", systemBytes);
+
+        uint64_t frontend = frontendHits + frontendMisses;
+        std::snprintf(line, sizeof(line),
+            "frontend hits %" PRIu64 " / misses %" PRIu64 " (hit rate %.2f%%), central returns %" PRIu64 ", remote frees %" PRIu64 "\n",
+            frontendHits, frontendMisses, frontend ? 100.0 * frontendHits / frontend : 0.0, centralReturns, remoteFrees);
+        out += line;
+        std::snprintf(line, sizeof(line),
+            "large cache hits %" PRIu64 " / misses %" PRIu64 ", page heap span allocs %" PRIu64 ", system allocs %" PRIu64 "\n",
+            largeCacheHits, largeCacheMisses, pageHeapSpanAllocs, systemAllocs);
+        out += line;
+
+        out += "  class     size         allocs          frees           live\n";
+        for (size_t i = 0; i < sizeClasses.size(); ++i)
+        {
+            const SizeClassStats& c = sizeClasses[i];
+            if (c.allocs == 0 && c.frees == 0) continue;
+            std::snprintf(line, sizeof(line), "  %5zu %8zu %14" PRIu64 " %14" PRIu64 " %14" PRId64 "\n",
+                i, c.size, c.allocs, c.frees, static_cast<int64_t>(c.allocs - c.frees));
+            out += line;
+        }
+        return out;
+    }
+
+    std::string toJson() const
+    {
+        std::string out = "{";
+        char item[128];
+        auto field = [&](const char* name, uint64_t value) {
+            std::snprintf(item, sizeof(item), "\"%s\":%" PRIu64 ",", name, value);
+            out += item;
+        };
+        field("inUseBytes", inUseBytes);
+        field("threadCacheBytes", threadCacheBytes);
+        field("cpuCacheBytes", cpuCacheBytes);
+        field("remoteFreeBytes", remoteFreeBytes);
+        field("centralCacheBytes", centralCacheBytes);
+        field("smallSpanBytes", smallSpanBytes);
+        field("largeSpanCacheBytes", largeSpanCacheBytes);
+        field("pageHeapFreeBytes", pageHeapFreeBytes);
+        field("pageHeapReleasedBytes", pageHeapReleasedBytes);
+        field("systemBytes", systemBytes);
+        field("frontendHits", frontendHits);
+        field("frontendMisses", frontendMisses);
+        field("centralReturns", centralReturns);
+        field("remoteFrees", remoteFrees);
+        field("largeCacheHits", largeCacheHits);
+        field("largeCacheMisses", largeCacheMisses);
+        field("pageHeapSpanAllocs", pageHeapSpanAllocs);
+        field("systemAllocs", systemAllocs);
+
+        out += "\"sizeClasses\":[";
+        for (size_t i = 0; i < sizeClasses.size(); ++i)
+        {
+            const SizeClassStats& c = sizeClasses[i];
+            std::snprintf(item, sizeof(item), "%s{\"size\":%zu,\"allocs\":%" PRIu64 ",\"frees\":%" PRIu64 "}",
+                i ? "," : "", c.size, c.allocs, c.frees);
+            out += item;
+        }
+        out += "]}";
+        return out;
+    }
+};
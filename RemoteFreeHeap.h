@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "PageCache.h"
+
+// 跨线程释放（mimalloc 的 delayed free）
+//
+// 生产者 / 消费者的程序里 A 线程分配、B 线程释放。原来 B 释放的块直接进 B 自己的自由链表，
+// 内存一批批地流到消费者那边（攒多了再还给中心缓存），生产者则每一批都要去中心缓存拿。
+// 现在每个 span 记着它现在归哪个线程（Span::owner，线程从中心缓存拿到一批块时把这些块所在的 span 认领过来），
+// 别的线程释放这个 span 上的块时不放进自己的链表，而是挂到主人的远程释放链表上；
+// 主人自己的链表空了、要去中心缓存之前，先把远程链表一次性整条拿回来。
+// 这样块会回到分配它的线程，生产者大多数时候不用再进中心缓存，消费者的缓存也不会越攒越大。
+//
+// 每个线程一个 RemoteFreeHeap，每个大小类一条链表：
+//   push（别的线程）：CAS 头插，多个线程可以同时往里放
+//   takeAll：exchange 成 nullptr，一次拿走整条。只有整条拿走、没有单个弹出，所以不存在 ABA 问题
+// 主人可能很久都不再分配（比如只在启动时灌数据的线程），链表会一直涨下去。所以链表头的高 16 位记着挂了多少块
+// （x86-64 和 AArch64 的用户态地址只用到低 48 位），16 位记满（kMaxCount）以后再挂的块数记在 overflow 里，
+// push 返回两者之和，每攒够一定数量释放的线程就检查一次主人：
+// 主人每次缺块都会把 activity 加一，超过 kIdleMs 毫秒 activity 都没变过，说明主人已经闲下来了，
+// 释放的线程就自己把整条拿走、并且把这些 span 认领过来，以后这些块的释放就都是本地的了。
+// 主人还在忙的话不能抢：它两次缺块之间可能要分配好几千块，这期间远程链表攒得再多也是正常的；
+// 主人只是暂时没被调度（核比线程少的时候一个时间片就是几毫秒）也不算闲，所以要按时间算，不能只看这期间缺没缺过块
+//
+// 线程退出时 heap 标记成不活跃，连同 ThreadCache 的缓存一起还给中心缓存，然后挂进孤儿列表，下一个新线程接着用。
+// 别的线程看到主人不活跃就照常放进自己的链表；判断和 push 之间主人恰好退出的话，这几块会留在孤儿 heap 里，
+// 等下一个接手的线程缺块时拿走。heap 永远不释放，所以 span 上过时的 owner 指针总是能安全地读
+//
+// 带 size 的释放不查基数树，不知道块属于哪个 span，所以先放进自己的链表，等链表超长、要还一批给中心缓存的时候
+// 再按 span 分拣（ThreadCache::sendRemote），归别的线程的块这时才挂到主人的远程链表上，查询的开销摊到一整批上。
+// 编译时定义 MEMORYPOOL_REMOTE_FREE=0 可以关掉
+#ifndef MEMORYPOOL_REMOTE_FREE
+#define MEMORYPOOL_REMOTE_FREE 1
+#endif
+
+template <size_t NumClasses>
+struct alignas(64) RemoteFreeHeap
+{
+    static constexpr int kCountShift = 48;
+    static constexpr uintptr_t kPtrMask = (uintptr_t(1) << kCountShift) - 1;
+    static constexpr uintptr_t kMaxCount = (uintptr_t(1) << (64 - kCountShift)) - 1;
+
+    std::array<std::atomic<uintptr_t>, NumClasses> lists; // 每个大小类一条：低 48 位是以 nullptr 结尾的链表头，高 16 位是块数
+    std::array<std::atomic<size_t>, NumClasses> overflow; // 高 16 位记满以后又挂了多少块；只有挂了几万块的链表才会碰到
+    std::atomic<uint64_t> activity; // 主人每次缺块加一
+    std::atomic<uint64_t> seenActivity; // 释放的线程上一次检查时看到的 activity
+    std::atomic<uint64_t> seenTime;     // 以及那时候的时间（毫秒）
+    std::atomic<bool> alive;
+    RemoteFreeHeap* nextOrphan; // 孤儿列表，由 ThreadCache 的 registryMutex_ 保护
+
+    RemoteFreeHeap() : activity(0), seenActivity(0), seenTime(0), alive(true), nextOrphan(nullptr)
+    {
+        for (auto& list : lists) list.store(0, std::memory_order_relaxed);
+        for (auto& extra : overflow) extra.store(0, std::memory_order_relaxed);
+    }
+
+    // 别的线程释放 ptr，返回放进去以后链表上有多少块；主人已经退出时返回 0，由调用方自己收下
+    size_t push(size_t index, void* ptr)
+    {
+        if (!alive.load(std::memory_order_relaxed)) return 0;
+        static_assert(sizeof(void*) == 8, "the pending count lives in the top 16 bits of the list head");
+
+        uintptr_t head = lists[index].load(std::memory_order_relaxed);
+        uintptr_t count;
+        do {
+            *reinterpret_cast<uintptr_t*>(ptr) = head & kPtrMask;
+            count = std::min((head >> kCountShift) + 1, kMaxCount);
+        } while (!lists[index].compare_exchange_weak(head, reinterpret_cast<uintptr_t>(ptr) | (count << kCountShift),
+            std::memory_order_release, std::memory_order_relaxed));
+        if ((head >> kCountShift) < kMaxCount) return count;
+        return kMaxCount + overflow[index].fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    // 主人缺块时调用，只有主人写
+    void markActive()
+    {
+        activity.store(activity.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // 释放的线程调用：主人已经至少 kIdleMs 毫秒没缺过块的话返回 true。只在远程链表攒够一批的时候调用，读时钟的开销摊得很薄
+    static constexpr uint64_t kIdleMs = 50;
+    bool ownerIdle()
+    {
+        uint64_t current = activity.load(std::memory_order_relaxed);
+        uint64_t now = PageCache::nowMs();
+        if (seenActivity.load(std::memory_order_relaxed) != current)
+        {
+            seenActivity.store(current, std::memory_order_relaxed);
+            seenTime.store(now, std::memory_order_relaxed);
+            return false;
+        }
+        return now - seenTime.load(std::memory_order_relaxed) >= kIdleMs;
+    }
+
+    // 把整条链表拿走；先看一眼是不是空的，空的时候不去抢那一条缓存行的独占权。
+    // overflow 顺便清零：push 在 CAS 和 fetch_add 之间碰上 takeAll 的话会多记一块，
+    // 只影响统计和下一次检查主人的时机，下一次 takeAll 又会清掉
+    void* takeAll(size_t index)
+    {
+        if (!lists[index].load(std::memory_order_relaxed)) return nullptr;
+        uintptr_t head = lists[index].exchange(0, std::memory_order_acquire);
+        if (overflow[index].load(std::memory_order_relaxed)) overflow[index].store(0, std::memory_order_relaxed);
+        return reinterpret_cast<void*>(head & kPtrMask);
+    }
+
+    // index 这条链表上现在挂着多少块（统计用）
+    size_t pending(size_t index) const
+    {
+        size_t count = static_cast<size_t>(lists[index].load(std::memory_order_relaxed) >> kCountShift);
+        return count == kMaxCount ? count + overflow[index].load(std::memory_order_relaxed) : count;
+    }
+
+    // span 现在归哪个 heap：别的线程释放时会并发地读，认领时会并发地写，所以通过 atomic_ref 访问；
+    // release / acquire 保证读到 heap 指针的线程也看得到 heap 构造时写的内容
+    static RemoteFreeHeap* ownerOf(Span* span)
+    {
+        return static_cast<RemoteFreeHeap*>(std::atomic_ref<void*>(span->owner).load(std::memory_order_acquire));
+    }
+
+    static void setOwner(Span* span, RemoteFreeHeap* heap)
+    {
+        std::atomic_ref<void*>(span->owner).store(heap, std::memory_order_release);
+    }
+};
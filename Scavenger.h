@@ -0,0 +1,82 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include "PageCache.h"
+#include "LargeSpanCache.h"
+
+// 后台回收线程的参数
+struct ScavengerOptions
+{
+    std::chrono::milliseconds minIdleAge{ 1000 };   // 空闲span至少闲置这么久才还给操作系统，免得刚还回去马上又要缺页
+    size_t releaseRate = 64 * 1024 * 1024;          // 每秒最多还给操作系统多少字节，避免一次 madvise 太多造成卡顿
+    std::chrono::milliseconds interval{ 100 };      // 多久检查一次
+};
+
+// 可选的后台线程：定期把 LargeSpanCache 和 PageCache 里闲置够久的空闲span的物理页还给操作系统（见 PageCache::releaseFreeMemory）
+// 不调用 start 就没有这个线程，内存只在调用 MemoryPool::releaseFreeMemory 的时候归还
+class Scavenger
+{
+public:
+    // 已经在运行时返回 false
+    static bool start(const ScavengerOptions& options = {})
+    {
+        std::lock_guard<std::mutex> lock(controlMutex_);
+        if (state_) return false;
+
+        // 线程和条件变量都放在堆上：做成静态成员的话，它们的析构函数会在进程退出时跑，
+        // 线程还没停就会 std::terminate
+        state_ = new State();
+        state_->options = options;
+        state_->thread = std::thread(&Scavenger::run, state_);
+        return true;
+    }
+
+    static void stop()
+    {
+        std::lock_guard<std::mutex> lock(controlMutex_);
+        if (!state_) return;
+
+        {
+            std::lock_guard<std::mutex> stateLock(state_->mutex);
+            state_->stopping = true;
+        }
+        state_->cv.notify_one();
+        state_->thread.join();
+        delete state_;
+        state_ = nullptr;
+    }
+
+private:
+    struct State
+    {
+        ScavengerOptions options;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+    static void run(State* state)
+    {
+        const ScavengerOptions& options = state->options;
+        // 每一轮的额度按间隔折算，至少一页，保证速率设得很小时也能往前走
+        size_t budget = static_cast<size_t>(options.releaseRate * options.interval.count() / 1000);
+        if (budget < PageCache::PAGE_SIZE) budget = PageCache::PAGE_SIZE;
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (!state->cv.wait_for(lock, options.interval, [state] { return state->stopping; }))
+        {
+            lock.unlock();
+            // 大对象缓存里闲置够久的span先还给 PageCache，和其他空闲span一起按速率归还
+            LargeSpanCache::getInstance().releaseIdle(options.minIdleAge.count());
+            PageCache::getInstance().releaseFreeMemory(budget, options.minIdleAge.count());
+            lock.lock();
+        }
+    }
+
+    static inline std::mutex controlMutex_;
+    static inline State* state_ = nullptr;
+};
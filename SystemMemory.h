@@ -0,0 +1,195 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// 直接找操作系统要整页内存，绕开 libc 的 malloc
+// 这样 PageCache 和各种元数据（Span、基数树节点、ThreadCache 对象）都不会递归进 malloc，
+// 内存池才能被 LD_PRELOAD 当作 malloc 本身来用
+class SystemMemory
+{
+public:
+    // 返回的内存页对齐，并且操作系统保证内容全是 0
+    static void* allocate(size_t bytes)
+    {
+#ifdef _WIN32
+        return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+    }
+
+    // 把一段页还给操作系统，但保留地址空间：之后再访问时按需缺页
+    // Linux 上用 MADV_DONTNEED 而不是 MADV_FREE：后者要等到内存紧张时内核才真正回收，
+    // RSS 不会马上降下来，按 RSS 做扩缩容的服务看不到效果；并且 MADV_DONTNEED 之后再访问一定是全 0 的新页
+    // Windows 的 MEM_RESET 不保证内容
+#ifdef _WIN32
+    static constexpr bool kDecommitZeroes = false;
+#else
+    static constexpr bool kDecommitZeroes = true;
+#endif
+
+    // 失败时返回 false，页原样留着（内容也还在）：比如 MEMORYPOOL_HUGETLB 的大页映射不能按 4K 粒度 MADV_DONTNEED，
+    // 会返回 EINVAL，这时调用方不能把这段当作已经还掉、更不能当作全 0
+    static bool decommit(void* ptr, size_t bytes)
+    {
+#ifdef _WIN32
+        return VirtualAlloc(ptr, bytes, MEM_RESET, PAGE_READWRITE) != nullptr;
+#else
+        return madvise(ptr, bytes, MADV_DONTNEED) == 0;
+#endif
+    }
+
+    // 清零一大块内存：超过 kStreamThreshold 的部分用 non-temporal store 直接写内存，
+    // 不把整块读进缓存、也不把缓存里别的热数据挤出去（反正调用方马上用到的只是开头一小段）
+    static constexpr size_t kStreamThreshold = 1024 * 1024;
+
+    static void zero(void* ptr, size_t bytes)
+    {
+#if defined(__SSE2__) || defined(_M_X64)
+        if (bytes >= kStreamThreshold)
+        {
+            char* p = static_cast<char*>(ptr);
+            char* end = p + bytes;
+            char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + 63) & ~uintptr_t(63));
+            std::memset(p, 0, aligned - p);
+
+            const __m128i zeros = _mm_setzero_si128();
+            for (; aligned + 64 <= end; aligned += 64)
+            {
+                _mm_stream_si128(reinterpret_cast<__m128i*>(aligned), zeros);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(aligned + 16), zeros);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(aligned + 32), zeros);
+                _mm_stream_si128(reinterpret_cast<__m128i*>(aligned + 48), zeros);
+            }
+            _mm_sfence(); // non-temporal store 是弱序的，返回之前要让它们对其他线程可见
+            std::memset(aligned, 0, end - aligned);
+            return;
+        }
+#endif
+        std::memset(ptr, 0, bytes);
+    }
+
+    static void release(void* ptr, size_t bytes)
+    {
+#ifdef _WIN32
+        (void)bytes;
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, bytes);
+#endif
+    }
+};
+
+
+// PageCache 专用的页来源
+//
+// Linux 上第一次用的时候先用 mmap(PROT_NONE) 预留一大段连续的虚拟地址（只占地址空间，不占物理内存也不计入 commit），
+// 之后按 2MB 一块的粒度 mprotect 成可读写，span 从里面顺序切出去：
+//   所有 span 在地址上首尾相接，PageCache 释放时能跨越原来各次 systemAlloc 的边界合并；
+//   用到的地址集中在一起，基数树只需要很少几个叶子节点
+//   预留的起始地址按 2MB 对齐，打开 MEMORYPOOL_HUGEPAGES 时对新提交的块 madvise(MADV_HUGEPAGE)，
+//   内核用透明大页来填，缺页次数和 TLB miss 都少得多；
+//   打开 MEMORYPOOL_HUGETLB 时先尝试用 MAP_HUGETLB 的预留大页覆盖上去，系统没配大页就退回普通页
+// 新提交的页都是内核给的全 0 页，不需要 memset
+// 预留区用完了（或者预留失败、或者不是 Linux），就退回到每次单独 SystemMemory::allocate
+//
+// 没有自己的锁：只有 PageCache 在持有自己的 mutex_ 时调用
+class SystemArena
+{
+public:
+#ifndef MEMORYPOOL_ARENA_SIZE
+    static constexpr size_t kArenaSize = size_t(64) << 30; // 64GB 虚拟地址
+#else
+    static constexpr size_t kArenaSize = MEMORYPOOL_ARENA_SIZE;
+#endif
+    static constexpr size_t kChunkSize = size_t(2) << 20;  // 提交粒度，也是大页的大小
+
+    // bytes 必须是页大小的整数倍
+    static void* allocate(size_t bytes)
+    {
+#ifndef _WIN32
+        if (!base_ && !reserveFailed_) reserve();
+        if (base_ && bytes <= static_cast<size_t>(end_ - next_))
+        {
+            char* result = next_;
+            if (next_ + bytes > committed_)
+            {
+                char* newCommitted = base_ + (next_ + bytes - base_ + kChunkSize - 1) / kChunkSize * kChunkSize;
+                if (newCommitted > end_) newCommitted = end_;
+                if (!commit(committed_, newCommitted - committed_)) return SystemMemory::allocate(bytes);
+                committed_ = newCommitted;
+            }
+            next_ += bytes;
+            return result;
+        }
+#endif
+        return SystemMemory::allocate(bytes);
+    }
+
+    // ptr 是不是从预留区里切出来的
+    static bool contains(const void* ptr)
+    {
+        return base_ && ptr >= base_ && ptr < end_;
+    }
+
+private:
+#ifndef _WIN32
+    static void reserve()
+    {
+        // 多预留一块，把起始地址对齐到 2MB，透明大页要求按 2MB 对齐
+        size_t size = kArenaSize + kChunkSize;
+        void* ptr = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED)
+        {
+            reserveFailed_ = true;
+            return;
+        }
+
+        char* raw = static_cast<char*>(ptr);
+        char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + kChunkSize - 1) & ~(uintptr_t(kChunkSize) - 1));
+        if (aligned > raw) munmap(raw, aligned - raw);
+        char* alignedEnd = aligned + kArenaSize;
+        if (raw + size > alignedEnd) munmap(alignedEnd, raw + size - alignedEnd);
+
+        base_ = next_ = committed_ = aligned;
+        end_ = alignedEnd;
+    }
+
+    static bool commit(char* addr, size_t bytes)
+    {
+#ifdef MEMORYPOOL_HUGETLB
+        if (mmap(addr, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) != MAP_FAILED)
+        {
+            return true;
+        }
+#endif
+        if (mprotect(addr, bytes, PROT_READ | PROT_WRITE) != 0) return false;
+#if defined(MEMORYPOOL_HUGEPAGES) && defined(MADV_HUGEPAGE)
+        madvise(addr, bytes, MADV_HUGEPAGE);
+#endif
+        return true;
+    }
+#endif
+
+    static inline char* base_ = nullptr;
+    static inline char* next_ = nullptr;      // 下一次从这里切
+    static inline char* committed_ = nullptr; // [base_, committed_) 已经可读写
+    static inline char* end_ = nullptr;
+    static inline bool reserveFailed_ = false;
+};
@@ -1,7 +1,19 @@
 ﻿#pragma once
 #include <array>
+#include <atomic>
+#include <mutex>
+#include <new>
 #include "common.h"
-#include "CentralCache_LockFree.h"
+#include "PoolPolicy.h"
+#include "LargeSpanCache.h"
+#include "MetadataAllocator.h"
+#include "PoolStats.h"
+#include "HeapProfiler.h"
+#include "RemoteFreeHeap.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 //注意！！！！！！！！！！！！！！！！！！！！！！！！！
 //下面的*（void**）这样的操作，本质上是因为我们这里的链表的节点，我们是直接使用裸空间，因此对于链表的处理会显得很繁杂
@@ -24,35 +36,90 @@
 //};
 
 
-class ThreadCache //使用单例模式
+//Policy 是 PoolPolicy 的某个实例（见 PoolPolicy.h），决定大小类的划分和用哪个中心缓存，默认配置就是下面的 ThreadCache
+template <class Policy>
+class BasicThreadCache //使用单例模式
 {
 
 public:
-    static ThreadCache* getInstance()
+    using SizeClass = typename Policy::SizeClass;
+    using CentralCache = typename Policy::CentralCache;
+    static constexpr size_t kNumClasses = SizeClass::kNumClasses;
+
+    static BasicThreadCache* getInstance()
     {
-        static thread_local ThreadCache instance;//在 ThreadCache 的设计中，如果只使用 static 而不使用 thread_local,由于static 变量是全局的，因此会导致所有线程共享同一个 ThreadCache
+        //在 ThreadCache 的设计中，如果只使用 static 而不使用 thread_local,由于static 变量是全局的，因此会导致所有线程共享同一个 ThreadCache
         //所有线程访问的是 同一个 instance。所以后果是：多个线程同时调用 allocate() 或 deallocate() 时，会修改同一块内存池，导致 数据竞争（Data Race）
-        return &instance;
+        //
+        //注意这里 thread_local 的只是一个指针，而不是 ThreadCache 对象本身：
+        //thread_local 对象第一次访问时要跑构造函数、还要通过 __cxa_thread_atexit 注册析构，这两步都可能调用 malloc，
+        //内存池接管 malloc 之后就会递归回来。指针是常量初始化的，不需要任何运行时动作，对象本身从 MetadataAllocator 分配
+        BasicThreadCache* instance = tlsInstance_;
+        if (!instance) instance = createInstance();
+        return instance;
     }
 
     void* allocate(size_t size);
+    void* allocateClass(size_t index); // 调用方已经知道大小类（比如 ObjectPool 在编译期算好了），省掉查表
     void deallocate(void* ptr, size_t size);
+    void deallocate(void* ptr); // 不带大小的释放：通过 页号 -> Span -> sizeClass 反查
+
+    // 所有存活线程的 ThreadCache 里一共缓存了多少字节（只是个快照，各线程同时还在分配释放）
+    static size_t totalCachedBytes();
+
+    // 别的线程释放以后挂在远程释放链表上、主人还没拿走的字节数（见 RemoteFreeHeap.h），关掉 MEMORYPOOL_REMOTE_FREE 时总是 0
+    static size_t remoteFreeBytes();
+
+#if MEMORYPOOL_STATS
+    // 把所有线程（包括已经退出的）的次数统计加到 stats 上
+    static void collectStats(MemoryPoolStats& stats);
+#endif
+
+    // 大对象（> MAX_BYTES）不经过线程缓存，直接按整页分配，CpuCache 也走这两个
+    static void* allocateLarge(size_t size, size_t alignment = PageCache::PAGE_SIZE);
+    static void deallocateLarge(Span* span);
 
 
 private:
-    ThreadCache()
+    static BasicThreadCache* createInstance();
+    static void destroyInstance(void* instance); // 线程退出时调用
+
+    BasicThreadCache()
     {
         // 初始化自由链表和大小统计
         freeList_.fill(nullptr);
-        //freeListSize_.fill(0);
+        freeListSize_.fill(0);
+        maxListSize_.fill(1);
+        overages_.fill(0);
     }
 
 
+    void* popFreeList(size_t index); // 从自由链表取一块，空了就去中心缓存拿
     void* fetchFromCentralCache(size_t index);// 从中心缓存获取内存
-    size_t getBatchNum(size_t size);
-
-
-    void returnToCentralCache(void* start, size_t size, size_t bytes);// 归还内存到中心缓存
+    void pushFreeList(size_t index, void* ptr); // 放回自由链表，超过上限就还一批给中心缓存
+    void freeSmall(Span* span, void* ptr); // 小块：span 归别的线程的话挂到它的远程释放链表上，否则放回自己的链表
+    void flush(); // 把所有自由链表都还给中心缓存
+    void addCachedBytes(size_t index, ptrdiff_t num);
+
+    void returnToCentralCache(size_t index, size_t num);// 把链表头部的 num 块归还到中心缓存
+    void listTooLong(size_t index);// 链表长度超过上限时调用
+    void growListLimit(size_t index);// 链表取空、补充了一批之后调大上限
+
+#if MEMORYPOOL_REMOTE_FREE
+    using RemoteHeap = RemoteFreeHeap<kNumClasses>;
+    bool drainRemote(size_t index); // 把别的线程还回来的块接到自由链表上，没有的话返回 false
+    void adoptList(size_t index, void* list, bool claim); // 把一条以 nullptr 结尾的链表接到自由链表上，claim 的话顺便认领 span
+    void claimSpans(void* start);   // 从中心缓存拿到的这一批块所在的 span 都归自己
+    void* sendRemote(size_t index, void* start, size_t& num); // 要还给中心缓存的这一批里 span 归别的线程的块挂回主人，返回剩下的
+
+    //远程链表上每攒够这么多块（至少 kStealBatches 批、kStealBytes 字节）看一眼主人是不是闲着，闲着的话释放的线程自己收下
+    static constexpr size_t kStealBatches = 4;
+    static constexpr size_t kStealBytes = 32 * 1024;
+    static size_t stealThreshold(size_t index)
+    {
+        return std::max(kStealBatches * SizeClass::numToMove(index), kStealBytes / SizeClass::classToSize(index));
+    }
+#endif
 
 
 
@@ -81,30 +148,270 @@ private:
 
 
    //每个线程的 ThreadCache 会维护多个自由链表，每个链表专门管理一种固定大小的内存块.比如链表1，每个节点就是8B的内存块；链表2，每个节点就是16B的内存块
-    std::array<void*, FREE_LIST_SIZE>  freeList_;         // 存储自由链表的头指针
-    //std::array<size_t, FREE_LIST_SIZE> freeListSize_;     // 记录每个自由链表的当前大小
+    std::array<void*, kNumClasses>  freeList_;         // 存储自由链表的头指针
+    std::array<size_t, kNumClasses> freeListSize_;     // 记录每个自由链表的当前大小
+
+    //每个自由链表的长度上限，按 tcmalloc 的慢启动方式自适应调整：
+    //  链表取空时（要去中心缓存拿）上限变大：不到一批（numToMove）时每次 +1，到了一批以后每次 +一批，最多 kMaxListSize
+    //  链表超长时（要还给中心缓存）先还一批；上限超过一批的话，连续超长 kMaxOverages 次就把上限减一批
+    //这样只偶尔用一下的大小类只会缓存很少的块，而反复分配释放的大小类每次去中心缓存都能拿一大批
+    static constexpr size_t kMaxListSize = 8192;
+    static constexpr size_t kMaxOverages = 3;
+    std::array<size_t, kNumClasses> maxListSize_;
+    std::array<size_t, kNumClasses> overages_;        // 连续超长的次数
+
+    //只有本线程会写，其他线程只在 totalCachedBytes 里读，所以用 relaxed 的 load + store 就够了，不需要 fetch_add
+    std::atomic<size_t> cachedBytes_{ 0 };
+
+    //所有存活的 ThreadCache 串成一个双向链表，创建和销毁时在 registryMutex_ 下增删
+    BasicThreadCache* prev_ = nullptr;
+    BasicThreadCache* next_ = nullptr;
+    static inline std::mutex registryMutex_;
+    static inline BasicThreadCache* registryHead_ = nullptr;
+
+#if MEMORYPOOL_REMOTE_FREE
+    //别的线程释放的、属于本线程 span 的块先挂在这里（见 RemoteFreeHeap.h）；线程退出后 heap 进孤儿列表，给下一个线程接着用
+    RemoteHeap* heap_ = nullptr;
+    static inline RemoteHeap* orphanHeaps_ = nullptr; // 由 registryMutex_ 保护
+#endif
+
+#if MEMORYPOOL_STATS
+    //次数统计（见 PoolStats.h），和 cachedBytes_ 一样只有本线程写
+    struct Counters
+    {
+        std::array<std::atomic<uint64_t>, kNumClasses> allocs{}; // 小对象的分配，不管链表里有没有
+        std::array<std::atomic<uint64_t>, kNumClasses> frees{};
+        std::atomic<uint64_t> misses{ 0 };  // fetchFromCentralCache 的次数
+        std::atomic<uint64_t> returns{ 0 }; // returnToCentralCache 的次数
+        std::atomic<uint64_t> remoteFrees{ 0 }; // 挂到别的线程远程释放链表上的块数
+    };
+    Counters counters_;
+    static inline Counters retired_; // 已经退出的线程留下的计数，在 registryMutex_ 下累加
+#endif
+
+    static inline thread_local BasicThreadCache* tlsInstance_ THREAD_CACHE_TLS_MODEL = nullptr;
 };
 
 
 
 
 
-void* ThreadCache::allocate(size_t size)
+template <class Policy>
+BasicThreadCache<Policy>* BasicThreadCache<Policy>::createInstance()
+{
+    void* mem = MetadataAllocator<BasicThreadCache>::allocate();
+    if (!mem) return nullptr;
+    BasicThreadCache* instance = new (mem) BasicThreadCache();
+    tlsInstance_ = instance;
+
+    {
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        instance->next_ = registryHead_;
+        if (registryHead_) registryHead_->prev_ = instance;
+        registryHead_ = instance;
+
+#if MEMORYPOOL_REMOTE_FREE
+        //优先接手已经退出的线程留下的 heap，上面可能还挂着它退出之后才还回来的块，缺块的时候会被拿走
+        RemoteHeap* heap = orphanHeaps_;
+        if (heap) orphanHeaps_ = heap->nextOrphan;
+        else if (void* mem = MetadataAllocator<RemoteHeap>::allocate()) heap = new (mem) RemoteHeap();
+        if (heap) heap->alive.store(true, std::memory_order_relaxed);
+        instance->heap_ = heap; // 拿不到的话只是不认领 span，别的线程的块照样还回去
+#endif
+    }
+
+    //线程退出时把 ThreadCache 对象还给 MetadataAllocator，供以后新建的线程复用
+#ifdef _WIN32
+    struct Cleaner
+    {
+        BasicThreadCache* instance;
+        ~Cleaner() { destroyInstance(instance); }
+    };
+    thread_local Cleaner cleaner{ instance };
+    cleaner.instance = instance;
+#else
+    //pthread_key 的析构回调不需要分配内存（不像 __cxa_thread_atexit）
+    static pthread_key_t key = [] {
+        pthread_key_t k;
+        pthread_key_create(&k, &BasicThreadCache::destroyInstance);
+        return k;
+    }();
+    pthread_setspecific(key, instance);
+#endif
+    return instance;
+}
+
+template <class Policy>
+void BasicThreadCache<Policy>::destroyInstance(void* instance)
+{
+    BasicThreadCache* cache = static_cast<BasicThreadCache*>(instance);
+    if (!cache) return;
+
+    //线程池伸缩的时候线程来来去去，线程退出前不把缓存的块还回去，这些块就再也没人能用了
+#if MEMORYPOOL_REMOTE_FREE
+    //先不再接收远程释放，再把已经挂上来的收回来一起还掉
+    RemoteHeap* heap = cache->heap_;
+    if (heap)
+    {
+        heap->alive.store(false, std::memory_order_relaxed);
+        for (size_t index = 0; index < kNumClasses; ++index) cache->drainRemote(index);
+    }
+#endif
+    cache->flush();
+
+    {
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        if (cache->prev_) cache->prev_->next_ = cache->next_;
+        else registryHead_ = cache->next_;
+        if (cache->next_) cache->next_->prev_ = cache->prev_;
+
+#if MEMORYPOOL_STATS
+        for (size_t index = 0; index < kNumClasses; ++index)
+        {
+            statsAdd(retired_.allocs[index], cache->counters_.allocs[index].load(std::memory_order_relaxed));
+            statsAdd(retired_.frees[index], cache->counters_.frees[index].load(std::memory_order_relaxed));
+        }
+        statsAdd(retired_.misses, cache->counters_.misses.load(std::memory_order_relaxed));
+        statsAdd(retired_.returns, cache->counters_.returns.load(std::memory_order_relaxed));
+        statsAdd(retired_.remoteFrees, cache->counters_.remoteFrees.load(std::memory_order_relaxed));
+#endif
+#if MEMORYPOOL_REMOTE_FREE
+        if (heap)
+        {
+            heap->nextOrphan = orphanHeaps_;
+            orphanHeaps_ = heap;
+        }
+#endif
+    }
+
+    if (tlsInstance_ == cache) tlsInstance_ = nullptr;
+    cache->~BasicThreadCache();
+    MetadataAllocator<BasicThreadCache>::deallocate(cache);
+}
+
+
+template <class Policy>
+void BasicThreadCache<Policy>::flush()
+{
+    for (size_t index = 0; index < kNumClasses; ++index)
+    {
+        // 按批归还，和平时链表超长时一样
+        while (freeListSize_[index] > 0)
+        {
+            returnToCentralCache(index, std::min(freeListSize_[index], SizeClass::numToMove(index)));
+        }
+    }
+}
+
+template <class Policy>
+size_t BasicThreadCache<Policy>::totalCachedBytes()
+{
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    size_t total = 0;
+    for (BasicThreadCache* cache = registryHead_; cache; cache = cache->next_)
+    {
+        total += cache->cachedBytes_.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template <class Policy>
+size_t BasicThreadCache<Policy>::remoteFreeBytes()
+{
+    size_t total = 0;
+#if MEMORYPOOL_REMOTE_FREE
+    auto add = [&total](const RemoteHeap* heap) {
+        for (size_t index = 0; index < kNumClasses; ++index)
+        {
+            total += heap->pending(index) * SizeClass::classToSize(index);
+        }
+    };
+
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    for (BasicThreadCache* cache = registryHead_; cache; cache = cache->next_)
+    {
+        if (cache->heap_) add(cache->heap_);
+    }
+    for (RemoteHeap* heap = orphanHeaps_; heap; heap = heap->nextOrphan) add(heap);
+#endif
+    return total;
+}
+
+#if MEMORYPOOL_STATS
+template <class Policy>
+void BasicThreadCache<Policy>::collectStats(MemoryPoolStats& stats)
+{
+    auto add = [&stats](const Counters& counters) {
+        for (size_t index = 0; index < kNumClasses; ++index)
+        {
+            stats.sizeClasses[index].allocs += counters.allocs[index].load(std::memory_order_relaxed);
+            stats.sizeClasses[index].frees += counters.frees[index].load(std::memory_order_relaxed);
+        }
+        stats.frontendMisses += counters.misses.load(std::memory_order_relaxed);
+        stats.centralReturns += counters.returns.load(std::memory_order_relaxed);
+        stats.remoteFrees += counters.remoteFrees.load(std::memory_order_relaxed);
+    };
+
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    add(retired_);
+    for (BasicThreadCache* cache = registryHead_; cache; cache = cache->next_)
+    {
+        add(cache->counters_);
+    }
+}
+#endif
+
+template <class Policy>
+void BasicThreadCache<Policy>::addCachedBytes(size_t index, ptrdiff_t num)
+{
+    size_t bytes = cachedBytes_.load(std::memory_order_relaxed) + num * static_cast<ptrdiff_t>(SizeClass::classToSize(index));
+    cachedBytes_.store(bytes, std::memory_order_relaxed);
+}
+
+
+template <class Policy>
+void* BasicThreadCache<Policy>::allocate(size_t size)
 {
     // 处理0大小的分配请求
     if (size == 0)
     {
-        size = ALIGNMENT; // 至少分配一个对齐大小
+        size = SizeClass::kAlignment; // 至少分配一个对齐大小
+    }
+
+    // 堆采样（见 HeapProfiler.h）：没轮到采样时只是一次减法和一次判断
+    if (HeapProfiler::tick(size))
+    {
+        if (void* ptr = HeapProfiler::allocateSampled(size)) return ptr;
     }
 
-    if (size > MAX_BYTES)
+    if (size > SizeClass::kMaxBytes)
     {
-        // 大对象直接从系统分配
-        return malloc(size);
+        // 大对象直接从PageCache按整页分配
+        // （原来是走系统malloc，但那样的话释放时就分不清一个指针是不是我们的，只能靠调用方传size）
+        return allocateLarge(size);
     }
 
-    size_t index = SizeClass::getIndex(size);
+    return popFreeList(SizeClass::getIndex(size));
+}
 
+template <class Policy>
+void* BasicThreadCache<Policy>::allocateClass(size_t index)
+{
+    // 采样按块大小算，和 allocate(classToSize(index)) 一样
+    size_t size = SizeClass::classToSize(index);
+    if (HeapProfiler::tick(size))
+    {
+        if (void* ptr = HeapProfiler::allocateSampled(size)) return ptr;
+    }
+    return popFreeList(index);
+}
+
+template <class Policy>
+inline void* BasicThreadCache<Policy>::popFreeList(size_t index)
+{
+#if MEMORYPOOL_STATS
+    statsAdd(counters_.allocs[index]);
+#endif
 
     // 检查线程本地自由链表
     // 如果 freeList_[index] 不为空，表示该链表中有可用内存块
@@ -118,7 +425,9 @@ void* ThreadCache::allocate(size_t size)
         uintptr_t cur_add = (uintptr_t)freeList_[index];// 获取当前链表头的地址
         uintptr_t next = 0;// 定义一个整数变量 next，用来存储下一个块的地址
         memcpy(&next, (void*)cur_add, sizeof(void*));//从ptr地址拷贝8字节数据到next（因为64位机器下，一个地址需要64个bit也即8个B来表示）
-        //freeList_[index] = (void*)next;//把next转化为指针形式，作为新的链表头
+        freeList_[index] = (void*)next;//把next转化为指针形式，作为新的链表头
+        --freeListSize_[index];
+        addCachedBytes(index, -1);
         //当然我们也可以用此一步实现：freeList_[index] = *reinterpret_cast<void**>(ptr);
         //reinterpret_cast<void**>(ptr)就是将 ptr（void*类型）强转为 void** 类型（指针的指针），即ptr指向一个指针（这个指针就是那个地址的前8B，指向了下一个内存块的起始地址）
         //没转换之前，ptr是一个指针，指向一个内存块，而不是指向一个指针
@@ -134,60 +443,229 @@ void* ThreadCache::allocate(size_t size)
 
 
 
-void* ThreadCache::fetchFromCentralCache(size_t index)
+template <class Policy>
+void* BasicThreadCache<Policy>::fetchFromCentralCache(size_t index)
 {
-    size_t size = (index + 1) * ALIGNMENT;
-    // 根据对象内存大小计算批量获取的数量
-    size_t batchNum = getBatchNum(size);
+    // 根据对象内存大小计算批量获取的数量（编译期算好的表，见 common.h），
+    // 但不超过这个链表当前的长度上限：刚开始用的大小类一次只拿一两块
+#if MEMORYPOOL_REMOTE_FREE
+    if (heap_) heap_->markActive();
+
+    // 别的线程还回来的块优先：不用进中心缓存，而且多半还在本线程最近碰过的页上
+    if (drainRemote(index))
+    {
+        growListLimit(index);
+        void* result = freeList_[index];
+        freeList_[index] = *reinterpret_cast<void**>(result);
+        --freeListSize_[index];
+        addCachedBytes(index, -1);
+        return result;
+    }
+#endif
+
+    size_t batchNum = SizeClass::numToMove(index);
+    size_t num = std::min(maxListSize_[index], batchNum);
     // 从中心缓存批量获取内存
-    void* start = CentralCache::getInstance().fetchRange(index, batchNum);
+    void* start = CentralCache::getInstance().fetchRange(index, num);
     if (!start) return nullptr;
+#if MEMORYPOOL_STATS
+    statsAdd(counters_.misses);
+#endif
+#if MEMORYPOOL_REMOTE_FREE
+    claimSpans(start);
+#endif
+
+    growListLimit(index);
 
-    // 取一个返回，其余放入线程本地自由链表
+    // 取一个返回，其余放入线程本地自由链表（走到这里说明链表是空的）
     void* result = start;
-    if (batchNum > 1)
-    {
-        freeList_[index] = *reinterpret_cast<void**>(start);
-    }
+    freeList_[index] = *reinterpret_cast<void**>(start);
+    freeListSize_[index] = num - 1;
+    addCachedBytes(index, num - 1);
 
     return result;
 }
 
-// 根据对象内存大小计算批量获取的数量
-size_t ThreadCache::getBatchNum(size_t size)
+template <class Policy>
+void BasicThreadCache<Policy>::deallocate(void* ptr, size_t size)//ptr是我们要回收的内存块的地址
 {
-    // 基准：每次批量获取不超过4KB内存
-    constexpr size_t MAX_BATCH_SIZE = 4 * 1024; // 4KB
+    //调用方给了size，这是快速路径：不用查基数树，直接算出自由链表下标
+    if (size > SizeClass::kMaxBytes)
+    {
+        deallocateLarge(PageCache::getInstance().mapToSpan(ptr));
+        return;
+    }
+
+    //被采样的小对象单独占一个span（见 HeapProfiler.h），地址一定是页对齐的；
+    //普通的小块很少正好页对齐，碰上了就按不带size的路径查一下span，快速路径上只多一次对寄存器的判断
+    if ((reinterpret_cast<uintptr_t>(ptr) & (PageCache::PAGE_SIZE - 1)) == 0)
+    {
+        deallocate(ptr);
+        return;
+    }
+
+    //打开了跨线程释放也不在这里查 span 归谁：块先进本地链表，攒够一批要还给中心缓存的时候再按 span 送回主人（见 returnToCentralCache）
+    pushFreeList(SizeClass::getIndex(size), ptr);
+};
+
+
+template <class Policy>
+void BasicThreadCache<Policy>::deallocate(void* ptr)
+{
+    if (!ptr) return;
 
-    // 根据对象大小设置合理的基准批量数
-    size_t baseNum;
-    if (size <= 32) baseNum = 64;    // 64 * 32 = 2KB
-    else if (size <= 64) baseNum = 32;  // 32 * 64 = 2KB
-    else if (size <= 128) baseNum = 16; // 16 * 128 = 2KB
-    else if (size <= 256) baseNum = 8;  // 8 * 256 = 2KB
-    else if (size <= 512) baseNum = 4;  // 4 * 512 = 2KB
-    else if (size <= 1024) baseNum = 2; // 2 * 1024 = 2KB
-    else baseNum = 1;                   // 大于1024的对象每次只从中心缓存取1个
+    //调用方没给size：ptr所在的页 -> 基数树查到Span -> Span上记着它被切成了哪种大小的块
+    //基数树的查询是无锁的，所以这里的额外代价只有三次访存
+    Span* span = PageCache::getInstance().mapToSpan(ptr);
+    assert(span && span->isUse && "Attempt to deallocate unmanaged memory!");
 
-    // 计算最大批量数
-    size_t maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
+    if (span->objSize == 0)
+    {
+        deallocateLarge(span);
+        return;
+    }
 
-    // 取最小值，但确保至少返回1
-    return std::max(sizeof(1), std::min(maxNum, baseNum));
+    freeSmall(span, ptr);
 }
 
 
-void ThreadCache::deallocate(void* ptr, size_t size)//ptr是我们要回收的内存块的地址
+template <class Policy>
+void BasicThreadCache<Policy>::freeSmall(Span* span, void* ptr)
 {
-    if (size > MAX_BYTES)
+#if MEMORYPOOL_REMOTE_FREE
+    size_t index = span->sizeClass;
+    RemoteHeap* owner = RemoteHeap::ownerOf(span);
+    if (owner && owner != heap_)
     {
-        free(ptr);
-        return;
+        if (size_t pending = owner->push(index, ptr))
+        {
+#if MEMORYPOOL_STATS
+            statsAdd(counters_.frees[index]);
+            statsAdd(counters_.remoteFrees);
+#endif
+            if (pending % stealThreshold(index) == 0 && owner->ownerIdle())
+            {
+                if (void* list = owner->takeAll(index)) adoptList(index, list, true);
+            }
+            return;
+        }
+    }
+#endif
+    pushFreeList(span->sizeClass, ptr);
+}
+
+
+#if MEMORYPOOL_REMOTE_FREE
+template <class Policy>
+bool BasicThreadCache<Policy>::drainRemote(size_t index)
+{
+    if (!heap_) return false;
+    void* list = heap_->takeAll(index);
+    if (!list) return false;
+    adoptList(index, list, false);
+    return true;
+}
+
+template <class Policy>
+void BasicThreadCache<Policy>::adoptList(size_t index, void* list, bool claim)
+{
+    if (claim) claimSpans(list);
+
+    // 数一下有多少块，顺便找到链表尾，接在自由链表前面
+    size_t num = 1;
+    void* tail = list;
+    while (void* next = *reinterpret_cast<void**>(tail))
+    {
+        tail = next;
+        ++num;
+    }
+    *reinterpret_cast<void**>(tail) = freeList_[index];
+    freeList_[index] = list;
+    freeListSize_[index] += num;
+    addCachedBytes(index, num);
+
+    // 一次还回来太多（消费者攒了一大堆才释放）的话，超出上限的部分整批整批地还给中心缓存，剩下的至少还有上限那么多
+    size_t batchNum = SizeClass::numToMove(index);
+    while (freeListSize_[index] > maxListSize_[index] + batchNum)
+    {
+        returnToCentralCache(index, batchNum);
+    }
+}
+
+template <class Policy>
+void BasicThreadCache<Policy>::claimSpans(void* start)
+{
+    if (!heap_) return;
+
+    // 一批里相邻的块大多来自同一个 span，只在换 span 的时候查基数树
+    PageCache& pageCache = PageCache::getInstance();
+    char* begin = nullptr;
+    char* end = nullptr;
+    for (char* block = static_cast<char*>(start); block; block = *reinterpret_cast<char**>(block))
+    {
+        if (block >= begin && block < end) continue;
+        Span* span = pageCache.mapToSpan(block);
+        begin = static_cast<char*>(span->pageAddr);
+        end = begin + span->numPages * PageCache::PAGE_SIZE;
+        if (RemoteHeap::ownerOf(span) != heap_) RemoteHeap::setOwner(span, heap_);
     }
+}
 
-    size_t index = SizeClass::getIndex(size);
+template <class Policy>
+void* BasicThreadCache<Policy>::sendRemote(size_t index, void* start, size_t& num)
+{
+    // 带 size 的释放不查 span，别的线程的块也先进了本地链表，到这里才按 span 分拣：
+    // 和 claimSpans 一样只在换 span 的时候查基数树，查询的开销摊到一整批上
+    PageCache& pageCache = PageCache::getInstance();
+    char* begin = nullptr;
+    char* end = nullptr;
+    RemoteHeap* owner = nullptr;
+    void* kept = nullptr;
+    void** tail = &kept;
+    num = 0;
+    for (void* block = start; block;)
+    {
+        void* next = *reinterpret_cast<void**>(block);
+        char* addr = static_cast<char*>(block);
+        if (addr < begin || addr >= end)
+        {
+            Span* span = pageCache.mapToSpan(block);
+            begin = static_cast<char*>(span->pageAddr);
+            end = begin + span->numPages * PageCache::PAGE_SIZE;
+            owner = RemoteHeap::ownerOf(span);
+            if (owner == heap_) owner = nullptr;
+        }
+
+        // push 会改写块的前 8 个字节，next 要先读出来
+        if (size_t pending = owner ? owner->push(index, block) : 0)
+        {
+#if MEMORYPOOL_STATS
+            statsAdd(counters_.remoteFrees);
+#endif
+            // 主人闲着的话和 freeSmall 一样整条收下；认领以后这个 span 就是自己的了
+            if (pending % stealThreshold(index) == 0 && owner->ownerIdle())
+            {
+                if (void* list = owner->takeAll(index)) adoptList(index, list, true);
+                owner = nullptr;
+            }
+        }
+        else
+        {
+            *tail = block;
+            tail = reinterpret_cast<void**>(block);
+            ++num;
+        }
+        block = next;
+    }
+    *tail = nullptr;
+    return kept;
+}
+#endif
 
 
+template <class Policy>
+void BasicThreadCache<Policy>::pushFreeList(size_t index, void* ptr)
+{
     void* old_head = freeList_[index];
     memcpy(ptr, &old_head, sizeof(void*));// 把当前链表头地址写入ptr的前8个字节
     freeList_[index] = ptr;// 更新链表头为当前ptr
@@ -195,45 +673,120 @@ void ThreadCache::deallocate(void* ptr, size_t size)//ptr是我们要回收的
     //当然我们也可以使用下面的语法糖：
     //*reinterpret_cast<void**>(ptr) = freeList_[index];  // 让 ptr 指向原来的链表头
     //freeList_[index] = ptr;                             // 让链表头指向 ptr
-};
 
+    // 一个线程释放了一大堆内存之后不能一直自己攥着，超过上限就还一批给中心缓存，别的线程才用得上
+    addCachedBytes(index, 1);
+#if MEMORYPOOL_STATS
+    statsAdd(counters_.frees[index]);
+#endif
+    if (++freeListSize_[index] > maxListSize_[index])
+    {
+        listTooLong(index);
+    }
+}
 
 
-void ThreadCache::returnToCentralCache(void* start,   // 内存块链表的起始地址
-    size_t size,    // 每个内存块的大小
-    size_t bytes)   // 总字节数
+template <class Policy>
+void* BasicThreadCache<Policy>::allocateLarge(size_t size, size_t alignment)
+{
+    // span的起始地址本来就是页对齐的，只有要求超过一页的对齐时才需要多要一些页，再在里面找对齐的位置
+    size_t extra = alignment > PageCache::PAGE_SIZE ? alignment - PageCache::PAGE_SIZE : 0;
+    size_t numPages = (size + extra + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+    // 刚释放的同样大小的span先从 LargeSpanCache 里找，不进 PageCache 的锁
+    Span* span = LargeSpanCache::getInstance().allocate(numPages);
+    if (!span) return nullptr;
+
+    span->objSize = 0; // 整个span就是一个对象
+    uintptr_t addr = reinterpret_cast<uintptr_t>(span->pageAddr);
+    return reinterpret_cast<void*>((addr + alignment - 1) & ~(uintptr_t(alignment) - 1));
+}
 
-    //批量归还内存块：当ThreadCache中某个大小的内存块过多时，将多余的部分归还给CentralCache
-    //保留适当缓存：仍然保留一部分在ThreadCache中供后续快速分配
-    //维护链表结构：正确处理内存块之间的链接关系
 
+template <class Policy>
+void BasicThreadCache<Policy>::deallocateLarge(Span* span)
 {
-    size_t index = SizeClass::getIndex(size);// 根据大小计算对应的索引
-    size_t batchNum = bytes / size;// 计算要归还内存块数量
-    if (batchNum <= 1) return; // 如果只有一个块，则不归还
+    assert(span && span->objSize == 0);
+    if (span->sample)
+    {
+        HeapProfiler::deallocateSampled(span);
+        return;
+    }
+    LargeSpanCache::getInstance().deallocate(span);
+}
 
-    // 将内存块串成链表
-    char* current = static_cast<char*>(start);
 
-    // 保留一部分在ThreadCache中（比如保留1/4）
-    size_t keepNum = std::max(batchNum / 4, size_t(1));
-    size_t returnNum = batchNum - keepNum;
 
-    // 计算要保留的最后一个节点位置
-    char* splitNode = current + (keepNum - 1) * bytes;
+template <class Policy>
+void BasicThreadCache<Policy>::listTooLong(size_t index)
+{
+    size_t batchNum = SizeClass::numToMove(index);
+    returnToCentralCache(index, std::min(freeListSize_[index], batchNum));
 
-    // 将要返回的部分和要保留的部分断开
-    // start~splitNode是要保留的，splitNode之后接着的就是nextNode，nextNode~末尾是要还给CentralCache的
-    void* nextNode = *reinterpret_cast<void**>(splitNode);
-    *reinterpret_cast<void**>(splitNode) = nullptr; // 断开连接
+    if (maxListSize_[index] < batchNum)
+    {
+        // 还在慢启动阶段，上限照常增长
+        ++maxListSize_[index];
+    }
+    else if (maxListSize_[index] > batchNum)
+    {
+        // 偶尔超长一次不要紧，连续超长好几次说明这个线程释放得比分配得多，上限收缩一批
+        if (++overages_[index] > kMaxOverages)
+        {
+            maxListSize_[index] -= batchNum;
+            overages_[index] = 0;
+        }
+    }
+}
+
+template <class Policy>
+void BasicThreadCache<Policy>::growListLimit(size_t index)
+{
+    // 慢启动：每次取空都说明上限不够用，调大一点
+    size_t batchNum = SizeClass::numToMove(index);
+    if (maxListSize_[index] < batchNum)
+    {
+        ++maxListSize_[index];
+    }
+    else
+    {
+        size_t newSize = std::min(maxListSize_[index] + batchNum, kMaxListSize);
+        maxListSize_[index] = newSize - newSize % batchNum;
+    }
+}
 
-    // 更新ThreadCache的空闲链表
-    freeList_[index] = start;
+template <class Policy>
+void BasicThreadCache<Policy>::returnToCentralCache(size_t index, size_t num)
 
-    // 将剩余部分返回给CentralCache
-    if (returnNum > 0)
+    //批量归还内存块：当ThreadCache中某个大小的内存块过多时，将多余的部分归还给CentralCache
+    //保留适当缓存：链表剩下的部分仍然留在ThreadCache中供后续快速分配
+    //维护链表结构：正确处理内存块之间的链接关系
+
+{
+    if (num == 0) return;
+
+    // 从链表头开始数 num 块，在第 num 块后面断开
+    void* start = freeList_[index];
+    void* splitNode = start;
+    for (size_t i = 1; i < num; ++i)
     {
-        char* returnStart = static_cast<char*>(nextNode);
-        CentralCache::getInstance().returnRange(returnStart, returnNum * bytes, index);
+        splitNode = *reinterpret_cast<void**>(splitNode);
     }
+
+    // start~splitNode是要还给CentralCache的，splitNode之后接着的是留在ThreadCache的
+    freeList_[index] = *reinterpret_cast<void**>(splitNode);
+    *reinterpret_cast<void**>(splitNode) = nullptr; // 断开连接
+    freeListSize_[index] -= num;
+    addCachedBytes(index, -static_cast<ptrdiff_t>(num));
+#if MEMORYPOOL_STATS
+    statsAdd(counters_.returns);
+#endif
+
+#if MEMORYPOOL_REMOTE_FREE
+    start = sendRemote(index, start, num);
+    if (!start) return;
+#endif
+    CentralCache::getInstance().returnRange(start, num * SizeClass::classToSize(index), index);
 }
+
+// 默认配置的线程缓存
+using ThreadCache = BasicThreadCache<DefaultPoolPolicy>;
@@ -1,4 +1,6 @@
 #include "MemoryPool.h"
+#include "PageLocalCache.h"
+#include "PoolAllocator.h"
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -7,24 +9,30 @@
 #include <random>
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
 
 
-// 
+// 基础分配测试
 void testBasicAllocation()
 {
     std::cout << "Running basic allocation test..." << std::endl;
 
-    // Сڴ
+    // 测试小内存分配
     void* ptr1 = MemoryPool::allocate(8);
     assert(ptr1 != nullptr);
     MemoryPool::deallocate(ptr1, 8);
 
-    // еȴСڴ
+    // 测试中等大小内存分配
     void* ptr2 = MemoryPool::allocate(1024);
     assert(ptr2 != nullptr);
     MemoryPool::deallocate(ptr2, 1024);
 
-    // Դڴ䣨MAX_BYTES
+    // 测试大内存分配（超过MAX_BYTES）
     void* ptr3 = MemoryPool::allocate(1024 * 1024);
     assert(ptr3 != nullptr);
     MemoryPool::deallocate(ptr3, 1024 * 1024);
@@ -32,23 +40,23 @@ void testBasicAllocation()
     std::cout << "Basic allocation test passed!" << std::endl;
 }
 
-// ڴд
+// 内存写入测试
 void testMemoryWriting()
 {
     std::cout << "Running memory writing test..." << std::endl;
 
-    // 䲢д
+    // 分配并写入数据
     const size_t size = 128;
     char* ptr = static_cast<char*>(MemoryPool::allocate(size));
     assert(ptr != nullptr);
 
-    // д
+    // 写入数据
     for (size_t i = 0; i < size; ++i)
     {
         ptr[i] = static_cast<char>(i % 256);
     }
 
-    // ֤
+    // 验证数据
     for (size_t i = 0; i < size; ++i)
     {
         assert(ptr[i] == static_cast<char>(i % 256));
@@ -58,7 +66,7 @@ void testMemoryWriting()
     std::cout << "Memory writing test passed!" << std::endl;
 }
 
-// ̲߳
+// 多线程测试
 void testMultiThreading()
 {
     std::cout << "Running multi-threading test..." << std::endl;
@@ -123,28 +131,28 @@ void testMultiThreading()
     std::cout << "Multi-threading test passed!" << std::endl;
 }
 
-// ߽
+// 边界测试
 void testEdgeCases()
 {
     std::cout << "Running edge cases test..." << std::endl;
 
-    // 0С
+    // 测试0大小分配
     void* ptr1 = MemoryPool::allocate(0);
     assert(ptr1 != nullptr);
     MemoryPool::deallocate(ptr1, 0);
 
-    // СС
+    // 测试最小对齐大小
     void* ptr2 = MemoryPool::allocate(1);
     assert(ptr2 != nullptr);
     assert((reinterpret_cast<uintptr_t>(ptr2) & (ALIGNMENT - 1)) == 0);
     MemoryPool::deallocate(ptr2, 1);
 
-    // С߽
+    // 测试最大大小边界
     void* ptr3 = MemoryPool::allocate(MAX_BYTES);
     assert(ptr3 != nullptr);
     MemoryPool::deallocate(ptr3, MAX_BYTES);
 
-    // ԳС
+    // 测试超过最大大小
     void* ptr4 = MemoryPool::allocate(MAX_BYTES + 1);
     assert(ptr4 != nullptr);
     MemoryPool::deallocate(ptr4, MAX_BYTES + 1);
@@ -152,7 +160,7 @@ void testEdgeCases()
     std::cout << "Edge cases test passed!" << std::endl;
 }
 
-// ѹ
+// 压力测试
 void testStress()
 {
     std::cout << "Running stress test..." << std::endl;
@@ -169,7 +177,7 @@ void testStress()
         allocations.push_back({ ptr, size });
     }
 
-    // ˳ͷ
+    // 随机顺序释放
     std::random_device rd;
     std::mt19937 g(rd());
     std::shuffle(allocations.begin(), allocations.end(), g);
@@ -181,17 +189,1081 @@ void testStress()
     std::cout << "Stress test passed!" << std::endl;
 }
 
+// Span合并与页号查询测试
+void testSpanCoalescing()
+{
+    std::cout << "Running span coalescing test..." << std::endl;
+
+    PageCache& pc = PageCache::getInstance();
+    const size_t P = PageCache::PAGE_SIZE;
+
+    // 一次拿12页，再切成 4 + 4 + 4 三段还回去，三段应该能合并成一个12页的span
+    char* base = static_cast<char*>(pc.allocateSpan(12)->pageAddr);
+    assert(base != nullptr);
+    pc.deallocateSpan(base, 12);
+
+    char* a = static_cast<char*>(pc.allocateSpan(4)->pageAddr);
+    char* b = static_cast<char*>(pc.allocateSpan(4)->pageAddr);
+    char* c = static_cast<char*>(pc.allocateSpan(4)->pageAddr);
+    assert(a == base && b == base + 4 * P && c == base + 8 * P);
+
+    // span内部任意地址都能查到所属的span
+    assert(pc.mapToSpan(b + 3 * P + 100)->pageAddr == b);
+
+    // 先还两边，再还中间，中间那次要同时和前后两个邻居合并
+    pc.deallocateSpan(a, 4);
+    pc.deallocateSpan(c, 4);
+    pc.deallocateSpan(b, 4);
+
+    char* merged = static_cast<char*>(pc.allocateSpan(12)->pageAddr);
+    assert(merged == base);
+    pc.deallocateSpan(merged, 12);
+
+    std::cout << "Span coalescing test passed!" << std::endl;
+}
+
+// 不带大小的释放测试
+void testSizelessFree()
+{
+    std::cout << "Running size-less free test..." << std::endl;
+
+    std::vector<void*> ptrs;
+    for (size_t size : { size_t(1), size_t(8), size_t(100), size_t(4096), MAX_BYTES, MAX_BYTES + 1, size_t(3 * 1024 * 1024) })
+    {
+        void* p = MemoryPool::allocate(size);
+        assert(p != nullptr);
+        assert(MemoryPool::usableSize(p) >= size);
+        std::memset(p, 0xAB, size); // 整块都要可写
+        ptrs.push_back(p);
+    }
+
+    for (void* p : ptrs)
+    {
+        MemoryPool::deallocate(p);
+    }
+
+    // 还回去的小块应该能被同一个线程再次拿到
+    void* a = MemoryPool::allocate(48);
+    MemoryPool::deallocate(a);
+    void* b = MemoryPool::allocate(48);
+    assert(a == b);
+    MemoryPool::deallocate(b);
+
+    std::cout << "Size-less free test passed!" << std::endl;
+}
+
+// 对齐分配测试（posix_memalign / aligned_alloc / 对齐版 operator new 依赖它）
+void testAlignedAllocation()
+{
+    std::cout << "Running aligned allocation test..." << std::endl;
+
+    for (size_t alignment = 16; alignment <= 64 * 1024; alignment *= 2)
+    {
+        for (size_t size : { size_t(1), size_t(24), size_t(1000), size_t(5000), MAX_BYTES + 1 })
+        {
+            void* p = MemoryPool::allocateAligned(size, alignment);
+            assert(p != nullptr);
+            assert((reinterpret_cast<uintptr_t>(p) & (alignment - 1)) == 0);
+            assert(MemoryPool::usableSize(p) >= size);
+            std::memset(p, 0xCD, size);
+            MemoryPool::deallocate(p);
+        }
+    }
+
+    std::cout << "Aligned allocation test passed!" << std::endl;
+}
+
+// 大小类表测试：每个请求都映射到放得下它的最小大小类，并且 64 字节以上的内部碎片不超过 12.5%
+void testSizeClasses()
+{
+    std::cout << "Running size class test..." << std::endl;
+
+    for (size_t size = 1; size <= MAX_BYTES; ++size)
+    {
+        size_t index = SizeClass::getIndex(size);
+        assert(index < FREE_LIST_SIZE);
+        size_t classSize = SizeClass::classToSize(index);
+        assert(classSize >= size);
+        assert(index == 0 || SizeClass::classToSize(index - 1) < size);
+        if (size >= 64) assert((classSize - size) * 8 <= classSize);
+    }
+
+    for (size_t i = 0; i < FREE_LIST_SIZE; ++i)
+    {
+        assert(SizeClass::classToSize(i) % ALIGNMENT == 0);
+        assert(SizeClass::classToPages(i) * PageCache::PAGE_SIZE >= SizeClass::classToSize(i));
+        assert(SizeClass::numToMove(i) >= 1);
+        // 一个新span至少切得出一批，ThreadCache 按 fetchRange 一定拿满 numToMove 块来记链表长度
+        assert(SizeClass::numToMove(i) <= SizeClass::classToPages(i) * PageCache::PAGE_SIZE / SizeClass::classToSize(i));
+    }
+
+    std::cout << "Size class test passed!" << std::endl;
+}
+
+// 自由链表长度上限测试：一个线程释放的大量内存超过上限的部分会还给中心缓存，别的线程能接着用
+void testFreeListLimit()
+{
+    std::cout << "Running free list limit test..." << std::endl;
+
+    constexpr size_t NUM_BLOCKS = 20000;
+    constexpr size_t SIZE = 200;
+    std::vector<void*> freedByA;
+
+    std::thread a([&]() {
+        for (size_t i = 0; i < NUM_BLOCKS; ++i)
+        {
+            freedByA.push_back(MemoryPool::allocate(SIZE));
+        }
+        for (void* p : freedByA)
+        {
+            MemoryPool::deallocate(p, SIZE);
+        }
+    });
+    a.join();
+
+    std::sort(freedByA.begin(), freedByA.end());
+    size_t reused = 0;
+    std::thread b([&]() {
+        std::vector<void*> ptrs;
+        for (size_t i = 0; i < NUM_BLOCKS; ++i)
+        {
+            void* p = MemoryPool::allocate(SIZE);
+            ptrs.push_back(p);
+            if (std::binary_search(freedByA.begin(), freedByA.end(), p)) ++reused;
+        }
+        for (void* p : ptrs)
+        {
+            MemoryPool::deallocate(p, SIZE);
+        }
+    });
+    b.join();
+
+    // 线程 a 最多自己留着 kMaxListSize 块，其余的都应该被线程 b 拿到
+    assert(reused >= NUM_BLOCKS - 8192);
+
+    std::cout << "Free list limit test passed!" << std::endl;
+}
+
+// 线程退出测试：线程退出时 ThreadCache 里缓存的块要全部还给中心缓存
+void testThreadExitFlush()
+{
+    std::cout << "Running thread exit flush test..." << std::endl;
+    if (CpuCache::available())
+    {
+        // 小块都进了 CPU 缓存，线程自己不缓存任何东西
+        std::cout << "Thread exit flush test skipped (per-CPU cache in use)" << std::endl;
+        return;
+    }
+
+    std::atomic<int> phase{ 0 };
+    std::thread t([&]() {
+        std::vector<void*> ptrs;
+        for (int i = 0; i < 1000; ++i)
+        {
+            ptrs.push_back(MemoryPool::allocate(64));
+        }
+        for (void* p : ptrs)
+        {
+            MemoryPool::deallocate(p, 64);
+        }
+        phase = 1;
+        while (phase != 2) std::this_thread::yield();
+    });
+
+    while (phase != 1) std::this_thread::yield();
+    size_t during = MemoryPool::threadCacheBytes();
+    phase = 2;
+    t.join();
+    size_t after = MemoryPool::threadCacheBytes();
+
+    // 主线程这段时间没有分配释放，少掉的就是线程 t 缓存着的那些
+    assert(during >= after + 64);
+
+    std::cout << "Thread exit flush test passed!" << std::endl;
+}
+
+// span 回收测试：一个大小类的块全部释放后，span 要还给 PageCache，别的大小类能用上这些页
+void testSpanRelease()
+{
+    std::cout << "Running span release test..." << std::endl;
+
+    constexpr size_t NUM_BLOCKS = 5000;
+    std::vector<uintptr_t> pagesOfA;
+    pagesOfA.reserve(NUM_BLOCKS * 8);
+
+    // 在单独的线程里分配、释放，线程退出时 ThreadCache 也会清空
+    std::thread a([&]() {
+        std::vector<void*> ptrs;
+        ptrs.reserve(NUM_BLOCKS);
+        for (size_t i = 0; i < NUM_BLOCKS; ++i)
+        {
+            void* p = MemoryPool::allocate(2048);
+            ptrs.push_back(p);
+            Span* span = PageCache::getInstance().mapToSpan(p);
+            uintptr_t firstPage = reinterpret_cast<uintptr_t>(span->pageAddr) >> PageCache::PAGE_SHIFT;
+            for (size_t k = 0; k < span->numPages; ++k) pagesOfA.push_back(firstPage + k);
+        }
+        for (void* p : ptrs)
+        {
+            MemoryPool::deallocate(p, 2048);
+        }
+    });
+    a.join();
+
+    std::sort(pagesOfA.begin(), pagesOfA.end());
+    pagesOfA.erase(std::unique(pagesOfA.begin(), pagesOfA.end()), pagesOfA.end());
+
+    // 换一个大小类（每块正好一页），应该能拿到线程 a 用过的页
+    std::vector<void*> ptrs;
+    ptrs.reserve(NUM_BLOCKS);
+    size_t reused = 0;
+    for (size_t i = 0; i < NUM_BLOCKS; ++i)
+    {
+        void* p = MemoryPool::allocate(4096);
+        ptrs.push_back(p);
+        uintptr_t page = reinterpret_cast<uintptr_t>(p) >> PageCache::PAGE_SHIFT;
+        if (std::binary_search(pagesOfA.begin(), pagesOfA.end(), page)) ++reused;
+    }
+    for (void* p : ptrs)
+    {
+        MemoryPool::deallocate(p, 4096);
+    }
+
+    // 只有中心缓存无锁链表里的少量块会钉住几个span
+    assert(reused * 10 >= pagesOfA.size() * 9);
+
+    std::cout << "Span release test passed!" << std::endl;
+}
+
+// 新 span 不预先切块：只推进取走的那几块，还回来的块先于没切过的块被再次取走，全部取完 bumpPtr 清空
+void testLazyCarving()
+{
+    std::cout << "Running lazy carving test..." << std::endl;
+
+    CentralSpanList<SizeClass> spans;
+    const size_t index = SizeClass::getIndex(3072);
+    const size_t size = SizeClass::classToSize(index);
+    assert(spans.populate(index));
+
+    void* start;
+    assert(spans.removeRange(3, start) == 3);
+    Span* span = PageCache::getInstance().mapToSpan(start);
+    char* base = static_cast<char*>(span->pageAddr);
+    assert(span->freeList == nullptr && span->useCount == 3);
+    assert(span->bumpPtr == base + 3 * size);
+    // 链表是头插的，最后取的块在最前面
+    assert(start == base + 2 * size);
+
+    // 还回来一块，下次先拿它
+    void* rest = *static_cast<void**>(start);
+    *static_cast<void**>(start) = nullptr;
+    spans.insertRange(start);
+    assert(span->freeList == start && span->useCount == 2);
+    void* again;
+    assert(spans.removeRange(1, again) == 1 && again == start);
+    assert(span->bumpPtr == base + 3 * size);
+
+    // 把剩下的全部取完
+    size_t totalBlocks = span->numPages * PageCache::PAGE_SIZE / size;
+    void* tail;
+    assert(spans.removeRange(totalBlocks, tail) == totalBlocks - 3);
+    assert(span->bumpPtr == nullptr && spans.empty());
+
+    // 全部还回来，span 还给 PageCache
+    *static_cast<void**>(again) = rest;
+    spans.insertRange(again);
+    spans.insertRange(tail);
+    assert(spans.spanBytes() == 0);
+
+    std::cout << "Lazy carving test passed!" << std::endl;
+}
+
+// 归还内存测试：空闲span的物理页还给操作系统之后，span 照样能再分配、正常读写
+void testReleaseFreeMemory()
+{
+    std::cout << "Running release free memory test..." << std::endl;
+
+    constexpr size_t SIZE = 4 * 1024 * 1024;
+    PageCache& pageCache = PageCache::getInstance();
+
+    // 同步归还
+    char* p = static_cast<char*>(MemoryPool::allocate(SIZE));
+    std::memset(p, 0xAB, SIZE);
+    MemoryPool::deallocate(p);
+    assert(MemoryPool::releaseFreeMemory() >= SIZE);
+    assert(pageCache.releasedBytes() == pageCache.freeBytes());
+
+    char* q = static_cast<char*>(MemoryPool::allocate(SIZE));
+    std::memset(q, 0xCD, SIZE);
+    assert(q[0] == '\xCD' && q[SIZE - 1] == '\xCD');
+    MemoryPool::deallocate(q);
+
+    // 带预算的归还：一个 4MB 的空闲span只还预算那么多，剩下的切出去留着
+    Span* span = pageCache.allocateSpan(SIZE / PageCache::PAGE_SIZE);
+    std::memset(span->pageAddr, 0xEF, SIZE);
+    pageCache.deallocateSpan(span->pageAddr, SIZE / PageCache::PAGE_SIZE);
+    size_t releasedBefore = pageCache.releasedBytes();
+    assert(pageCache.releaseFreeMemory(64 * 1024) == 64 * 1024);
+    assert(pageCache.releasedBytes() == releasedBefore + 64 * 1024);
+    assert(pageCache.releaseFreeMemory(5000) == 2 * PageCache::PAGE_SIZE);
+
+    // 还给过操作系统的span旁边又释放了一个span：两个不能合并，否则已经还掉的页又算成驻留的
+    // 两个span都比现有的空闲span大，只能从预留区顺序切出来，一定首尾相接
+    constexpr size_t BIG_PAGES = 64 * 1024 * 1024 / PageCache::PAGE_SIZE;
+    Span* left = pageCache.allocateSpan(BIG_PAGES);
+    Span* right = pageCache.allocateSpan(BIG_PAGES);
+    assert(static_cast<char*>(left->pageAddr) + BIG_PAGES * PageCache::PAGE_SIZE == right->pageAddr);
+    pageCache.deallocateSpan(left->pageAddr, BIG_PAGES);
+    pageCache.releaseFreeMemory();
+    releasedBefore = pageCache.releasedBytes();
+    pageCache.deallocateSpan(right->pageAddr, BIG_PAGES);
+    assert(pageCache.releasedBytes() == releasedBefore);
+    // 下一轮只还新释放的这一个span，不会把已经还掉的页再算一遍
+    assert(pageCache.releaseFreeMemory() == BIG_PAGES * PageCache::PAGE_SIZE);
+    assert(pageCache.releasedBytes() == releasedBefore + BIG_PAGES * PageCache::PAGE_SIZE);
+
+    // 后台线程
+    ScavengerOptions options;
+    options.minIdleAge = std::chrono::milliseconds(0);
+    options.interval = std::chrono::milliseconds(10);
+    assert(MemoryPool::startScavenger(options));
+    assert(!MemoryPool::startScavenger(options));
+    for (int i = 0; i < 200 && pageCache.releasedBytes() < pageCache.freeBytes(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    MemoryPool::stopScavenger();
+    assert(pageCache.releasedBytes() == pageCache.freeBytes());
+
+    std::cout << "Release free memory test passed!" << std::endl;
+}
+
+// 预留地址区测试：顺序切出来的页首尾相接、页对齐，并且是内核给的全 0 页
+void testSystemArena()
+{
+#ifndef _WIN32
+    std::cout << "Running system arena test..." << std::endl;
+
+    constexpr size_t BYTES = 3 * PageCache::PAGE_SIZE;
+    char* a = static_cast<char*>(SystemArena::allocate(BYTES));
+    char* b = static_cast<char*>(SystemArena::allocate(BYTES));
+    assert(a && b);
+    assert(SystemArena::contains(a) && SystemArena::contains(b));
+    assert(b == a + BYTES);
+    assert((reinterpret_cast<uintptr_t>(a) & (PageCache::PAGE_SIZE - 1)) == 0);
+    for (size_t i = 0; i < 2 * BYTES; ++i)
+    {
+        assert(a[i] == 0);
+    }
+    std::memset(a, 0x5A, 2 * BYTES);
+
+    // 大对象走的也是预留区
+    void* big = MemoryPool::allocate(MAX_BYTES * 4);
+    assert(SystemArena::contains(big));
+    MemoryPool::deallocate(big);
+
+    std::cout << "System arena test passed!" << std::endl;
+#endif
+}
+
+// 清零分配测试：不管拿到的是新页还是用过的内存，allocateZeroed 返回的内容都是全 0
+void testAllocateZeroed()
+{
+    std::cout << "Running zeroed allocation test..." << std::endl;
+
+    auto allZero = [](const void* p, size_t size) {
+        const char* c = static_cast<const char*>(p);
+        return std::all_of(c, c + size, [](char x) { return x == 0; });
+    };
+
+    for (size_t size : { size_t(24), size_t(3000), MAX_BYTES + 1, size_t(4 * 1024 * 1024) })
+    {
+        // 先弄脏一块再释放，下一次大概率拿回同一块
+        void* dirty = MemoryPool::allocate(size);
+        std::memset(dirty, 0xEE, size);
+        MemoryPool::deallocate(dirty);
+
+        void* p = MemoryPool::allocateZeroed(size);
+        assert(p != nullptr);
+        assert(allZero(p, size));
+        MemoryPool::deallocate(p);
+    }
+
+    // 新页、或者还给过操作系统的页，不需要再清零
+    MemoryPool::releaseFreeMemory();
+    size_t big = 32 * 1024 * 1024;
+    void* fresh = MemoryPool::allocateZeroed(big);
+    assert(PageCache::getInstance().mapToSpan(fresh)->isZero);
+    assert(allZero(fresh, big));
+    MemoryPool::deallocate(fresh);
+
+    // 还给过操作系统的空闲span和后面一个脏的span合并：合并出来的span不能再当作全 0
+    size_t half = 2100 * PageCache::PAGE_SIZE;
+    char* a = static_cast<char*>(MemoryPool::allocate(half));
+    char* b = static_cast<char*>(MemoryPool::allocate(half));
+    MemoryPool::deallocate(a);
+    MemoryPool::releaseFreeMemory();
+    std::memset(b, 0xAB, half);
+    MemoryPool::deallocate(b);
+    void* merged = MemoryPool::allocateZeroed(2 * half);
+    assert(allZero(merged, 2 * half));
+    MemoryPool::deallocate(merged);
+
+    std::cout << "Zeroed allocation test passed!" << std::endl;
+}
+
+// 大对象缓存测试：刚释放的大对象被同一档大小的请求直接拿走，releaseFreeMemory 会把缓存清空
+void testLargeSpanCache()
+{
+    std::cout << "Running large span cache test..." << std::endl;
+
+    LargeSpanCache& cache = LargeSpanCache::getInstance();
+    size_t inUseBefore = cache.inUseBytes();
+
+    // 2MB + 50KB 和 2MB + 100KB 都落在 576 页这一档
+    void* a = MemoryPool::allocate(2 * 1024 * 1024 + 50 * 1024);
+    assert(cache.inUseBytes() >= inUseBefore + 2 * 1024 * 1024);
+    MemoryPool::deallocate(a);
+    assert(cache.inUseBytes() == inUseBefore);
+    assert(cache.cachedBytes() >= 2 * 1024 * 1024);
+
+    size_t hits = cache.hits();
+    void* b = MemoryPool::allocate(2 * 1024 * 1024 + 100 * 1024);
+    assert(b == a);
+    assert(cache.hits() == hits + 1);
+    assert(MemoryPool::usableSize(b) >= 2 * 1024 * 1024 + 100 * 1024);
+    MemoryPool::deallocate(b);
+
+    // 太大的不缓存
+    size_t cached = cache.cachedBytes();
+    void* huge = MemoryPool::allocate(16 * 1024 * 1024);
+    MemoryPool::deallocate(huge);
+    assert(cache.cachedBytes() == cached);
+
+    MemoryPool::releaseFreeMemory();
+    assert(cache.cachedBytes() == 0);
+
+    std::cout << "Large span cache test passed!" << std::endl;
+}
+
+// 传输缓存测试：整批还回中心缓存的块，下一次整批取的时候原样拿回来
+void testTransferCache()
+{
+    std::cout << "Running transfer cache test..." << std::endl;
+
+    CentralCache& central = CentralCache::getInstance();
+    size_t index = SizeClass::getIndex(96);
+    size_t batchNum = SizeClass::numToMove(index);
+    size_t size = SizeClass::classToSize(index);
+
+    void* batch = central.fetchRange(index, batchNum);
+    assert(batch != nullptr);
+    std::vector<void*> blocks;
+    for (void* p = batch; p; p = *reinterpret_cast<void**>(p)) blocks.push_back(p);
+    assert(blocks.size() == batchNum);
+
+    central.returnRange(batch, batchNum * size, index);
+    void* again = central.fetchRange(index, batchNum);
+    assert(again == batch);
+    size_t i = 0;
+    for (void* p = again; p; p = *reinterpret_cast<void**>(p), ++i) assert(p == blocks[i]);
+    assert(i == batchNum);
+    central.returnRange(again, batchNum * size, index);
+
+    std::cout << "Transfer cache test passed!" << std::endl;
+}
+
+// 中心缓存并发测试：多个线程同时整批取、整批还同一个大小类，拿到的每一块马上整个写满（连 next 指针一起覆盖掉，
+// 就像用户数据一样），还回去之前检查没被别人改过：同一块被同时分给两个线程、或者无锁路径读了别人手里的块都会被发现
+void testCentralConcurrency()
+{
+    std::cout << "Running central cache concurrency test..." << std::endl;
+
+    size_t index = SizeClass::getIndex(32);
+    size_t batchNum = SizeClass::numToMove(index);
+    size_t size = SizeClass::classToSize(index);
+
+    std::atomic<bool> failed{ false };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([=, &failed]() {
+            CentralCache& central = CentralCache::getInstance();
+            std::vector<void*> blocks;
+            for (int round = 0; round < 5000; ++round)
+            {
+                void* batch = central.fetchRange(index, batchNum);
+                if (!batch)
+                {
+                    failed = true;
+                    return;
+                }
+                blocks.clear();
+                for (void* p = batch; p; p = *reinterpret_cast<void**>(p)) blocks.push_back(p);
+                if (blocks.size() != batchNum) failed = true;
+
+                for (void* p : blocks) std::memset(p, t + 1, size);
+                if (round % 16 == 0) std::this_thread::yield();
+                for (void* p : blocks)
+                {
+                    const unsigned char* bytes = static_cast<const unsigned char*>(p);
+                    for (size_t j = 0; j < size; ++j) if (bytes[j] != t + 1) failed = true;
+                }
+
+                for (size_t i = 0; i < blocks.size(); ++i)
+                {
+                    *reinterpret_cast<void**>(blocks[i]) = i + 1 < blocks.size() ? blocks[i + 1] : nullptr;
+                }
+                central.returnRange(batch, blocks.size() * size, index);
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    assert(!failed);
+
+    std::cout << "Central cache concurrency test passed!" << std::endl;
+}
+
+// 不同配置的内存池在同一个程序里并存：16 字节对齐、加锁中心缓存的池，和 64 字节对齐、小对象上限 64KB 的无锁池
+using SsePool = BasicMemoryPool<PoolPolicy<LockedCentralCache, 16>>;
+using CachelinePool = BasicMemoryPool<PoolPolicy<LockFreeCentralCache, 64, 64 * 1024, 16>>;
+
+template <class Pool>
+void checkPool()
+{
+    using Classes = typename Pool::SizeClass;
+    for (size_t i = 0; i < Classes::kNumClasses; ++i)
+    {
+        assert(Classes::classToSize(i) % Pool::kAlignment == 0);
+        assert(Classes::numToMove(i) <= Classes::classToPages(i) * PageCache::PAGE_SIZE / Classes::classToSize(i));
+    }
+    assert(Classes::classToSize(Classes::kNumClasses - 1) == Pool::kMaxBytes);
+
+    std::vector<std::pair<void*, size_t>> ptrs;
+    for (size_t size : { size_t(1), size_t(7), size_t(16), size_t(33), size_t(100), size_t(1000), size_t(5000), Pool::kMaxBytes, Pool::kMaxBytes + 1 })
+    {
+        for (int i = 0; i < 10; ++i)
+        {
+            void* p = Pool::allocate(size);
+            assert(p != nullptr);
+            assert(reinterpret_cast<uintptr_t>(p) % Pool::kAlignment == 0);
+            assert(Pool::usableSize(p) >= size);
+            std::memset(p, 0x5a, size);
+            ptrs.emplace_back(p, size);
+        }
+    }
+    for (size_t i = 0; i < ptrs.size(); ++i)
+    {
+        if (i % 2) Pool::deallocate(ptrs[i].first, ptrs[i].second);
+        else Pool::deallocate(ptrs[i].first);
+    }
+}
+
+void testPolicyPools()
+{
+    std::cout << "Running policy pools test..." << std::endl;
+
+    static_assert(SsePool::kAlignment == 16 && CachelinePool::kAlignment == 64);
+    static_assert(CachelinePool::kMaxBytes == 64 * 1024);
+    static_assert(!std::is_same_v<SsePool::ThreadCache, MemoryPool::ThreadCache>);
+
+    checkPool<SsePool>();
+    checkPool<CachelinePool>();
+
+    // 三个池同时在多个线程里用，各自的线程缓存和中心缓存互不干扰
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([]() {
+            for (int i = 0; i < 2000; ++i)
+            {
+                size_t size = (i * 37) % 2000 + 1;
+                void* a = SsePool::allocate(size);
+                void* b = CachelinePool::allocate(size);
+                void* c = MemoryPool::allocate(size);
+                std::memset(a, 1, size);
+                std::memset(b, 2, size);
+                std::memset(c, 3, size);
+                SsePool::deallocate(a, size);
+                CachelinePool::deallocate(b);
+                MemoryPool::deallocate(c, size);
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    std::cout << "Policy pools test passed!" << std::endl;
+}
+
+// CPU 缓存测试：开了 MEMORYPOOL_PERCPU 并且 rseq 可用时，小块不经过 ThreadCache，每个CPU缓存的块数有上限
+void testCpuCache()
+{
+    std::cout << "Running per-CPU cache test..." << std::endl;
+    if (!CpuCache::available())
+    {
+        std::cout << "Per-CPU cache test skipped (rseq not available)" << std::endl;
+        return;
+    }
+
+    size_t threadBytes = MemoryPool::threadCacheBytes();
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 5000; ++i)
+    {
+        void* p = MemoryPool::allocate(64);
+        assert(p != nullptr);
+        std::memset(p, i & 0xff, 64);
+        ptrs.push_back(p);
+    }
+    for (size_t i = 0; i < ptrs.size(); ++i)
+    {
+        // 一半带 size 释放，一半不带
+        if (i % 2) MemoryPool::deallocate(ptrs[i], 64);
+        else MemoryPool::deallocate(ptrs[i]);
+    }
+    assert(MemoryPool::threadCacheBytes() == threadBytes);
+    size_t cached = MemoryPool::cpuCacheBytes();
+    assert(cached > 0);
+    assert(cached <= std::thread::hardware_concurrency() * FREE_LIST_SIZE * CpuCache::kMaxBatches * 4096);
+
+    // 多个线程同时在同一个CPU上分配释放，被抢占打断的操作要能正确重来
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed{ false };
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([t, &failed]() {
+            std::vector<std::pair<unsigned char*, size_t>> live;
+            std::mt19937 gen(t);
+            for (int i = 0; i < 20000; ++i)
+            {
+                if (live.empty() || gen() % 2)
+                {
+                    size_t size = gen() % 512 + 1;
+                    auto* p = static_cast<unsigned char*>(MemoryPool::allocate(size));
+                    std::memset(p, t, size);
+                    live.emplace_back(p, size);
+                }
+                else
+                {
+                    size_t k = gen() % live.size();
+                    auto [p, size] = live[k];
+                    for (size_t j = 0; j < size; ++j) if (p[j] != t) failed = true;
+                    MemoryPool::deallocate(p, size);
+                    live[k] = live.back();
+                    live.pop_back();
+                }
+            }
+            for (auto [p, size] : live) MemoryPool::deallocate(p, size);
+        });
+    }
+    for (auto& th : threads) th.join();
+    assert(!failed);
+
+    std::cout << "Per-CPU cache test passed!" << std::endl;
+}
+
+// 统计测试：分配释放的次数按大小类记下来，线程退出后它的计数不会丢；各层的字节数对得上
+void testStats()
+{
+    std::cout << "Running stats test..." << std::endl;
+
+    size_t index = SizeClass::getIndex(200);
+    size_t size = SizeClass::classToSize(index);
+    std::vector<void*> ptrs;
+    ptrs.reserve(1000); // 先分配好，下面的计数里只有这 1000 块
+
+    MemoryPoolStats before = MemoryPool::getStats();
+    assert(before.sizeClasses.size() == SizeClass::kNumClasses);
+    assert(before.sizeClasses[index].size == size);
+
+    for (int i = 0; i < 1000; ++i) ptrs.push_back(MemoryPool::allocate(200));
+    std::thread([] {
+        for (int i = 0; i < 100; ++i) MemoryPool::deallocate(MemoryPool::allocate(200), 200);
+    }).join();
+
+    MemoryPoolStats during = MemoryPool::getStats();
+    assert(during.systemBytes >= during.pageHeapFreeBytes + during.pageHeapReleasedBytes + during.smallSpanBytes);
+    assert(during.smallSpanBytes >= 1000 * size);
+    assert(during.pageHeapSpanAllocs >= before.pageHeapSpanAllocs);
+#if MEMORYPOOL_STATS
+    assert(during.sizeClasses[index].allocs == before.sizeClasses[index].allocs + 1100);
+    assert(during.sizeClasses[index].frees == before.sizeClasses[index].frees + 100);
+    assert(during.frontendMisses > before.frontendMisses);
+    assert(during.frontendHits > before.frontendHits);
+    assert(during.inUseBytes >= before.inUseBytes + 1000 * size);
+    assert(during.smallSpanBytes >= during.centralCacheBytes + during.threadCacheBytes + during.cpuCacheBytes);
+#else
+    assert(during.sizeClasses[index].allocs == 0 && during.frontendHits == 0);
+#endif
+
+    for (void* p : ptrs) MemoryPool::deallocate(p);
+    MemoryPoolStats after = MemoryPool::getStats();
+#if MEMORYPOOL_STATS
+    assert(after.sizeClasses[index].frees == before.sizeClasses[index].frees + 1100);
+    assert(after.inUseBytes + 1000 * size <= during.inUseBytes + 4096);
+#endif
+
+    std::string json = after.toJson();
+    assert(json.front() == '{' && json.back() == '}');
+    assert(json.find("\"sizeClasses\":[{\"size\":" + std::to_string(SizeClass::classToSize(0))) != std::string::npos);
+    assert(after.toString().find("system") != std::string::npos);
+
+    std::cout << "Stats test passed!" << std::endl;
+}
+
+// 跨线程释放测试：别的线程释放的块挂到主人的远程释放链表上，主人缺块时拿回去；主人一直闲着的话释放的线程自己收下
+void testRemoteFree()
+{
+    std::cout << "Running remote free test..." << std::endl;
+    if (!MEMORYPOOL_REMOTE_FREE || CpuCache::available())
+    {
+        std::cout << "Remote free test skipped (per-CPU caches or remote free disabled)" << std::endl;
+        return;
+    }
+
+    // 448 字节这个大小类别的测试没怎么用过；少于两个检查点的块数（见 ThreadCache::stealThreshold），一定不会被抢
+    const size_t size = 448;
+    const int count = 140;
+    std::vector<void*> ptrs;
+    for (int i = 0; i < count; ++i)
+    {
+        void* p = MemoryPool::allocate(size);
+        std::memset(p, i & 0xff, size);
+        ptrs.push_back(p);
+    }
+
+    MemoryPoolStats before = MemoryPool::getStats();
+    std::thread([&ptrs, size] {
+        for (size_t i = 0; i < ptrs.size(); ++i)
+        {
+            if (i % 2) MemoryPool::deallocate(ptrs[i], size);
+            else MemoryPool::deallocate(ptrs[i]);
+        }
+    }).join();
+
+    // 释放线程已经退出了，块还挂在本线程的远程链表上
+    MemoryPoolStats during = MemoryPool::getStats();
+    assert(during.remoteFreeBytes >= before.remoteFreeBytes + count * size);
+#if MEMORYPOOL_STATS
+    assert(during.remoteFrees == before.remoteFrees + count);
+#endif
+
+    // 本线程再分配的时候把它们收回来
+    std::vector<void*> again;
+    for (int i = 0; i < count; ++i)
+    {
+        void* p = MemoryPool::allocate(size);
+        std::memset(p, 0x5a, size);
+        again.push_back(p);
+    }
+    assert(MemoryPool::getStats().remoteFreeBytes + count * size <= during.remoteFreeBytes + 4 * size);
+    size_t reused = 0;
+    for (void* p : again) reused += std::find(ptrs.begin(), ptrs.end(), p) != ptrs.end();
+    assert(reused >= count / 2);
+    for (void* p : again) MemoryPool::deallocate(p, size);
+
+    // 本线程分配完以后就闲着了：释放的线程隔了 kIdleMs 以后不再往这里挂，自己收下
+    ptrs.clear();
+    for (int i = 0; i < 2000; ++i) ptrs.push_back(MemoryPool::allocate(size));
+    before = MemoryPool::getStats();
+    std::thread([&ptrs, size] {
+        for (size_t i = 0; i < ptrs.size(); ++i)
+        {
+            if (i == ptrs.size() / 2) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            MemoryPool::deallocate(ptrs[i], size);
+        }
+    }).join();
+    MemoryPoolStats after = MemoryPool::getStats();
+    assert(after.remoteFreeBytes < before.remoteFreeBytes + 1000 * size);
+
+    // 链表头的高 16 位只记得下 65535 块，多出来的记在 overflow 里，push 的返回值和 pending 都不能卡在 65535
+    {
+        RemoteFreeHeap<1> heap;
+        std::vector<void*> blocks(70000);
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            assert(heap.push(0, &blocks[i]) == i + 1);
+        }
+        assert(heap.pending(0) == blocks.size());
+        size_t taken = 0;
+        for (void* block = heap.takeAll(0); block; block = *static_cast<void**>(block)) ++taken;
+        assert(taken == blocks.size() && heap.pending(0) == 0);
+        assert(heap.push(0, &blocks[0]) == 1);
+    }
+
+    // 远程链表攒过 65535 块以后主人闲下来，释放的线程照样要收下
+    const size_t tiny = 8;
+    ptrs.clear();
+    for (int i = 0; i < 200000; ++i) ptrs.push_back(MemoryPool::allocate(tiny));
+    before = MemoryPool::getStats();
+    std::thread([&ptrs, tiny] {
+        for (size_t i = 0; i < ptrs.size(); ++i)
+        {
+            if (i == ptrs.size() / 2) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            MemoryPool::deallocate(ptrs[i], tiny);
+        }
+    }).join();
+    after = MemoryPool::getStats();
+    // 以前计数卡在 65535 以后再也不检查主人，这里会一直挂着至少 65535 块
+    assert(after.remoteFreeBytes < before.remoteFreeBytes + 65535 / 2 * tiny);
+
+    std::cout << "Remote free test passed!" << std::endl;
+}
+
+// 堆采样测试：采样间隔设成 1 字节，几乎每次分配都被抽中；抽中的对象单独占一个span，不管带不带 size 释放都能认出来
+MEMORYPOOL_NOINLINE void* sampledAllocation(size_t size)
+{
+    return MemoryPool::allocate(size);
+}
+
+void testHeapProfiler()
+{
+    std::cout << "Running heap profiler test..." << std::endl;
+
+    HeapProfiler::Totals before = HeapProfiler::sampledTotals();
+    HeapProfiler::start(1);
+    std::vector<void*> ptrs;
+    ptrs.reserve(200);
+    for (int i = 0; i < 100; ++i)
+    {
+        void* p = sampledAllocation(100);
+        std::memset(p, 0xab, 100);
+        ptrs.push_back(p);
+    }
+    void* big = sampledAllocation(MemoryPool::kMaxBytes + 1);
+    HeapProfiler::stop();
+
+    HeapProfiler::Totals during = HeapProfiler::sampledTotals();
+    assert(during.allocObjects - before.allocObjects >= 90); // 间隔是随机的，偶尔会有连着两次没抽中
+    assert(during.liveObjects > before.liveObjects);
+    size_t sampled = 0;
+    for (void* p : ptrs)
+    {
+        if (reinterpret_cast<uintptr_t>(p) % PageCache::PAGE_SIZE == 0) ++sampled;
+    }
+    assert(sampled >= 90);
+
+    std::string text = HeapProfiler::dumpText(5);
+    assert(text.find("heap profile: sampling every 1 bytes") == 0);
+    assert(text.find("#1 live") != std::string::npos);
+    std::string pprof = HeapProfiler::dumpPprof();
+    assert(pprof.find("heap profile:") == 0);
+    assert(pprof.find("@ heap_v2/1\n") != std::string::npos);
+    assert(pprof.find("MAPPED_LIBRARIES:") != std::string::npos);
+
+    // 一半带 size 释放（走页对齐的判断），一半不带
+    for (size_t i = 0; i < ptrs.size(); ++i)
+    {
+        if (i % 2) MemoryPool::deallocate(ptrs[i], 100);
+        else MemoryPool::deallocate(ptrs[i]);
+    }
+    MemoryPool::deallocate(big, MemoryPool::kMaxBytes + 1);
+    HeapProfiler::Totals after = HeapProfiler::sampledTotals();
+    assert(after.liveObjects == before.liveObjects);
+    assert(after.allocObjects == during.allocObjects);
+
+    std::cout << "Heap profiler test passed!" << std::endl;
+}
+
+// 按页分片的前端：连续分配落在同一个 span 上；本线程、别的线程释放的块都能收回来；退出的线程留下的 span 有人接手
+void testPageLocalCache()
+{
+    std::cout << "Running page-local cache test..." << std::endl;
+    PageCache& pageCache = PageCache::getInstance();
+
+    // 新切的 span 按地址顺序分配
+    const size_t size = 96;
+    std::vector<char*> ptrs;
+    for (int i = 0; i < 1000; ++i)
+    {
+        char* p = static_cast<char*>(PageLocalCache::allocate(size));
+        std::memset(p, i & 0xff, size);
+        ptrs.push_back(p);
+    }
+    size_t adjacent = 0;
+    for (size_t i = 1; i < ptrs.size(); ++i) adjacent += ptrs[i] == ptrs[i - 1] + size;
+    assert(adjacent >= ptrs.size() - 8);
+    for (size_t i = 0; i < ptrs.size(); ++i) assert(static_cast<unsigned char>(ptrs[i][size - 1]) == (i & 0xff));
+
+    // 本线程释放一半、别的线程同时释放另一半
+    std::thread remote([&ptrs, size] {
+        for (size_t i = 1; i < ptrs.size(); i += 2) PageLocalCache::deallocate(ptrs[i], size);
+    });
+    for (size_t i = 0; i < ptrs.size(); i += 2) PageLocalCache::deallocate(ptrs[i]);
+    remote.join();
+
+    std::vector<char*> again;
+    for (int i = 0; i < 1000; ++i) again.push_back(static_cast<char*>(PageLocalCache::allocate(size)));
+    size_t reused = 0;
+    for (char* p : again)
+    {
+        Span* span = pageCache.mapToSpan(p);
+        assert(span && span->isUse && span->objSize == size);
+        reused += std::find(ptrs.begin(), ptrs.end(), p) != ptrs.end();
+    }
+    assert(reused >= 500);
+    for (char* p : again) PageLocalCache::deallocate(p, size);
+
+    // 线程退出时块还在外面：span 先挂起来，这里释放以后下一个缺这个大小类的线程（本线程）接手
+    const size_t orphanSize = 1536;
+    std::vector<void*> orphans;
+    std::thread([&orphans, orphanSize] {
+        for (int i = 0; i < 100; ++i) orphans.push_back(PageLocalCache::allocate(orphanSize));
+    }).join();
+    for (void* p : orphans)
+    {
+        assert(pageCache.mapToSpan(p)->owner == nullptr);
+        PageLocalCache::deallocate(p, orphanSize);
+    }
+    std::vector<void*> adopted;
+    for (int i = 0; i < 100; ++i) adopted.push_back(PageLocalCache::allocate(orphanSize));
+    reused = 0;
+    for (void* p : adopted) reused += std::find(orphans.begin(), orphans.end(), p) != orphans.end();
+    assert(reused >= 50);
+    for (void* p : adopted) PageLocalCache::deallocate(p);
+
+    // 大对象照常走 ThreadCache::allocateLarge
+    void* big = PageLocalCache::allocate(MemoryPool::kMaxBytes + 1);
+    assert(pageCache.mapToSpan(big)->objSize == 0);
+    PageLocalCache::deallocate(big, MemoryPool::kMaxBytes + 1);
+
+    std::cout << "Page-local cache test passed!" << std::endl;
+}
+
+// 按类型分配：大小类在编译期定下来，对齐照顾到；构造函数抛异常时内存还回去；标准库容器挂上 PoolAllocator 照常工作
+struct PooledObject
+{
+    static inline int live = 0;
+    int value;
+    char payload[52];
+
+    explicit PooledObject(int v) : value(v)
+    {
+        if (v < 0) throw std::runtime_error("negative");
+        ++live;
+    }
+    ~PooledObject() { --live; }
+};
+
+struct alignas(64) AlignedObject
+{
+    char bytes[72];
+};
+
+struct HugeObject
+{
+    char bytes[MemoryPool::kMaxBytes + 1];
+};
+
+void testObjectPool()
+{
+    std::cout << "Running object pool test..." << std::endl;
+
+    static_assert(ObjectPool<PooledObject>::kIndex == SizeClass::getIndex(sizeof(PooledObject)));
+    static_assert(SizeClass::classToSize(ObjectPool<AlignedObject>::kIndex) % 64 == 0);
+    static_assert(!ObjectPool<HugeObject>::kSmall);
+
+    std::vector<PooledObject*> objects;
+    for (int i = 0; i < 1000; ++i) objects.push_back(ObjectPool<PooledObject>::create(i));
+    assert(PooledObject::live == 1000);
+    for (int i = 0; i < 1000; ++i) assert(objects[i]->value == i);
+    for (PooledObject* object : objects) ObjectPool<PooledObject>::destroy(object);
+    assert(PooledObject::live == 0);
+
+    // 构造失败：内存还回线程缓存，下一次分配（后进先出）拿到的还是它
+    PooledObject* first = ObjectPool<PooledObject>::create(1);
+    void* firstAddr = first;
+    ObjectPool<PooledObject>::destroy(first);
+    bool threw = false;
+    try
+    {
+        ObjectPool<PooledObject>::create(-1);
+    }
+    catch (const std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw && PooledObject::live == 0);
+    PooledObject* second = ObjectPool<PooledObject>::create(2);
+    assert(static_cast<void*>(second) == firstAddr);
+    ObjectPool<PooledObject>::destroy(second);
+
+    std::vector<AlignedObject*> aligned;
+    for (int i = 0; i < 100; ++i)
+    {
+        AlignedObject* object = ObjectPool<AlignedObject>::create();
+        assert(reinterpret_cast<uintptr_t>(object) % 64 == 0);
+        std::memset(object->bytes, i, sizeof(object->bytes));
+        aligned.push_back(object);
+    }
+    for (AlignedObject* object : aligned) ObjectPool<AlignedObject>::destroy(object);
+
+    HugeObject* huge = ObjectPool<HugeObject>::create();
+    huge->bytes[MemoryPool::kMaxBytes] = 1;
+    ObjectPool<HugeObject>::destroy(huge);
+
+    // 标准库容器
+    {
+        std::list<int, PoolAllocator<int>> list;
+        std::map<int, std::string, std::less<int>, PoolAllocator<std::pair<const int, std::string>>> map;
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, int>>> hash;
+        std::deque<int, PoolAllocator<int>> deque;
+        std::vector<AlignedObject, PoolAllocator<AlignedObject>> vector(10);
+        for (int i = 0; i < 10000; ++i)
+        {
+            list.push_back(i);
+            map.emplace(i, std::to_string(i));
+            hash.emplace(i, i * 2);
+            deque.push_front(i);
+        }
+        for (int i = 0; i < 10000; i += 2)
+        {
+            map.erase(i);
+            hash.erase(i);
+        }
+        assert(list.size() == 10000 && map.size() == 5000 && hash.size() == 5000 && deque.size() == 10000);
+        assert(map.at(4999) == "4999" && hash.at(4999) == 9998 && deque.front() == 9999 && list.back() == 9999);
+        assert(reinterpret_cast<uintptr_t>(vector.data()) % 64 == 0);
+
+        PoolAllocator<int> a;
+        PoolAllocator<double> b(a);
+        assert(a == b);
+    }
+
+    std::cout << "Object pool test passed!" << std::endl;
+}
+
 int main()
 {
     try
     {
         std::cout << "Starting memory pool tests..." << std::endl;
 
+        testSpanCoalescing();
         testBasicAllocation();
         testMemoryWriting();
         testMultiThreading();
         testEdgeCases();
         testStress();
+        testSizelessFree();
+        testAlignedAllocation();
+        testSizeClasses();
+        testFreeListLimit();
+        testThreadExitFlush();
+        testSpanRelease();
+        testLazyCarving();
+        testReleaseFreeMemory();
+        testSystemArena();
+        testAllocateZeroed();
+        testLargeSpanCache();
+        testTransferCache();
+        testCentralConcurrency();
+        testPolicyPools();
+        testCpuCache();
+        testStats();
+        testHeapProfiler();
+        testRemoteFree();
+        testPageLocalCache();
+        testObjectPool();
 
         std::cout << "All tests passed successfully!" << std::endl;
         return 0;
@@ -1,26 +1,194 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <algorithm>
 
 
-constexpr size_t ALIGNMENT = 8;//зڴС ALIGNMENT8ֽڣ
-constexpr size_t MAX_BYTES = 256 * 1024; //ڴֻ 256KB 󣬸ֱϵͳ malloc
-constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT; // ALIGNMENTָvoid*ĴС
+// 动态库被 LD_PRELOAD 进来的时候，initial-exec 模型的 thread_local 访问只是一次 fs 段寻址，
+// 不会走 __tls_get_addr（后者在某些情况下会调用 malloc）。内存池里所有的 thread_local 都要加上
+#if defined(__GNUC__)
+#define THREAD_CACHE_TLS_MODEL __attribute__((tls_model("initial-exec")))
+#else
+#define THREAD_CACHE_TLS_MODEL
+#endif
 
+// 堆采样取调用栈时按固定的层数跳过自己，所以不能被内联
+#if defined(__GNUC__)
+#define MEMORYPOOL_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define MEMORYPOOL_NOINLINE __declspec(noinline)
+#else
+#define MEMORYPOOL_NOINLINE
+#endif
 
+constexpr size_t ALIGNMENT = 8;//所有分配的内存块大小必须是 ALIGNMENT（8字节）的整数倍
+constexpr size_t MAX_BYTES = 256 * 1024; //该内存池只处理 ≤256KB 的请求，更大的请求直接找PageCache按整页分配。
 
-// С
-class SizeClass
+
+
+//大小类表
+//原来是每 8 字节一个大小类，256KB 以内一共 32768 个自由链表，每个 ThreadCache 光链表头就要 256KB，
+//CentralCache 也要 32768 个原子链表头（加锁版本还有 32768 个 mutex 和条件变量）。
+//现在改成 tcmalloc 那样按几何级数增长的大小类：
+//  [8, 128]            每 8 字节一档                         8, 16, 24, ..., 128
+//  (2^k, 2^(k+1)]      每 2^k / 8 一档，也就是每翻一倍切 8 档   144, 160, ..., 256, 288, ..., 512, ...
+//一共 104 个大小类。对 64 字节以上的请求，内部碎片（块大小 - 请求大小）/ 块大小 不超过 1/8 = 12.5%；
+//64 字节以下由 8 字节对齐决定，浪费的绝对值不超过 7 字节。
+//
+//所有的表都在编译期算好（constexpr），运行时查表只要一次数组访问
+
+//默认配置的大小类就是上面说的这 104 个。对齐（ALIGNMENT）、小对象上限（MAX_BYTES）和 span 的最少页数都可以换成别的编译期参数，
+//每一组参数编译期各算一张表，BasicMemoryPool 按 PoolPolicy 选用（见 PoolPolicy.h），默认的 MemoryPool 用的是 SizeClass 这一张
+
+//大小类的划分规则，都是编译期函数，SizeClassTable 用它们把表算出来
+//  Alignment：最小的大小类，也是所有大小类的公约数（8/16/64...），切出来的每一块都按它对齐
+//  MaxBytes：最大的小对象，更大的请求直接按整页分配；必须正好是一个大小类
+//  MinSpanPages：每次至少从PageCache要几页
+template <size_t Alignment, size_t MaxBytes, size_t MinSpanPages>
+struct SizeClassRule
+{
+    static_assert(Alignment >= 8 && Alignment <= 128 && (Alignment & (Alignment - 1)) == 0,
+        "classes above 1024 must be multiples of 128 for the lookup table");
+    static_assert(MinSpanPages >= 1);
+
+    static constexpr size_t kAlignment = Alignment;
+    static constexpr size_t kMaxBytes = MaxBytes;
+    static constexpr size_t kPageSize = 4096; // 和 PageCache::PAGE_SIZE 一致（PageCache.h 里有 static_assert）
+    static constexpr size_t kMinSpanPages = MinSpanPages;
+
+    //查找表的下标：1024 以内按 8 字节一格，1024 以上按 128 字节一格（1024 以上的大小类都是 128 的整数倍）
+    static constexpr size_t kSmallMax = 1024;
+    static constexpr size_t lookupSlot(size_t bytes)
+    {
+        return bytes <= kSmallMax ? (bytes + 7) >> 3 : (bytes + 127 + (120 << 7)) >> 7;
+    }
+
+    //在 size 这一档之后的下一档
+    static constexpr size_t nextClassSize(size_t size)
+    {
+        size_t pow2 = 1;
+        while (pow2 * 2 <= size) pow2 *= 2;
+        return size + std::max(Alignment, pow2 / 8);
+    }
+
+    static constexpr size_t countClasses()
+    {
+        size_t n = 0;
+        for (size_t size = Alignment; size <= MaxBytes; size = nextClassSize(size)) ++n;
+        return n;
+    }
+
+    //span至少 MinSpanPages 页，并且切完之后剩下的边角料不超过 span 的 1/8
+    static constexpr size_t pagesFor(size_t size)
+    {
+        size_t pages = std::max(MinSpanPages, (size + kPageSize - 1) / kPageSize);
+        while ((pages * kPageSize) % size > (pages * kPageSize) / 8) ++pages;
+        return pages;
+    }
+
+    //根据对象大小计算批量获取的数量（原来 ThreadCache::getBatchNum 的逻辑）
+    static constexpr size_t batchFor(size_t size)
+    {
+        // 基准：每次批量获取不超过4KB内存
+        constexpr size_t MAX_BATCH_SIZE = 4 * 1024; // 4KB
+
+        // 根据对象大小设置合理的基准批量数
+        size_t baseNum;
+        if (size <= 32) baseNum = 64;    // 64 * 32 = 2KB
+        else if (size <= 64) baseNum = 32;  // 32 * 64 = 2KB
+        else if (size <= 128) baseNum = 16; // 16 * 128 = 2KB
+        else if (size <= 256) baseNum = 8;  // 8 * 256 = 2KB
+        else if (size <= 512) baseNum = 4;  // 4 * 512 = 2KB
+        else if (size <= 1024) baseNum = 2; // 2 * 1024 = 2KB
+        else baseNum = 1;                   // 大于1024的对象每次只从中心缓存取1个
+
+        // 计算最大批量数
+        size_t maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
+
+        // 取最小值，但确保至少返回1
+        return std::max(size_t(1), std::min(maxNum, baseNum));
+    }
+};
+
+template <class Rule>
+class SizeClassTable
+{
+public:
+    static constexpr size_t kNumClasses = Rule::countClasses();
+    static constexpr size_t kLookupSize = Rule::lookupSlot(Rule::kMaxBytes) + 1;
+
+    std::array<uint32_t, kNumClasses> classSize{};   // 第 i 个大小类的块大小
+    std::array<uint16_t, kNumClasses> classPages{};  // 第 i 个大小类每次从PageCache要几页
+    std::array<uint16_t, kNumClasses> numToMove{};   // ThreadCache 和 CentralCache 之间一次搬几块
+    std::array<uint8_t, kLookupSize> lookup{};       // lookupSlot(bytes) -> 大小类下标
+
+    constexpr SizeClassTable()
+    {
+        size_t index = 0;
+        for (size_t size = Rule::kAlignment; size <= Rule::kMaxBytes; size = Rule::nextClassSize(size), ++index)
+        {
+            classSize[index] = static_cast<uint32_t>(size);
+
+            classPages[index] = static_cast<uint16_t>(Rule::pagesFor(size));
+            numToMove[index] = static_cast<uint16_t>(Rule::batchFor(size));
+        }
+
+        //每个格子对应这一格里最大的那个字节数，找第一个放得下它的大小类
+        size_t cls = 0;
+        for (size_t slot = 0; slot < kLookupSize; ++slot)
+        {
+            size_t bytes = slot <= (Rule::kSmallMax >> 3) ? slot << 3 : (slot - 120) << 7;
+            while (cls + 1 < kNumClasses && classSize[cls] < bytes) ++cls;
+            lookup[slot] = static_cast<uint8_t>(cls);
+        }
+    }
+};
+
+
+
+// 大小类管理
+template <size_t Alignment = ALIGNMENT, size_t MaxBytes = MAX_BYTES, size_t MinSpanPages = 8>
+class BasicSizeClass
 {
 public:
+    using Rule = SizeClassRule<Alignment, MaxBytes, MinSpanPages>;
+    using Table = SizeClassTable<Rule>;
 
-    static size_t getIndex(size_t bytes)//ֽڴС bytes תΪ sizeClass ±꣩
+    static constexpr size_t kAlignment = Alignment;
+    static constexpr size_t kMaxBytes = MaxBytes;
+    static constexpr size_t kNumClasses = Table::kNumClasses; // 自由链表的个数 = 大小类的个数
+    static constexpr Table kTable{};
 
-        //û malloc(10)
-        // SizeClass::getIndex(10) õ sizeClass = 1
-        // freeLists_[1]16B ȡһ鷵ء
+    static_assert(kNumClasses <= 256, "lookup table stores class index in uint8_t");
+    static_assert(kTable.classSize[kNumClasses - 1] == MaxBytes, "MaxBytes must be a size class");
 
+    static constexpr size_t getIndex(size_t bytes)//将字节大小 bytes 转换为 sizeClass 索引（自由链表数组的下标）
+
+        //用户请求 malloc(10)。
+        //调用 SizeClass::getIndex(10) 得到 sizeClass = 1。
+        //从 freeLists_[1]（16B 的自由链表）中取出一个块返回。
+
+    {
+        return kTable.lookup[Rule::lookupSlot(bytes)];
+    }
+
+    static constexpr size_t classToSize(size_t index)//getIndex的反过程：第 index 个自由链表里每个块的大小
+    {
+        return kTable.classSize[index];
+    }
+
+    static constexpr size_t classToPages(size_t index)//第 index 个自由链表每次从PageCache要几页
     {
+        return kTable.classPages[index];
+    }
 
-        bytes = std::max(bytes, ALIGNMENT);// ȷbytesΪALIGNMENT
-        return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+    static constexpr size_t numToMove(size_t index)//ThreadCache 和 CentralCache 之间一次搬多少块
+    {
+        return kTable.numToMove[index];
     }
-};
\ No newline at end of file
+};
+
+using SizeClass = BasicSizeClass<>; // 默认配置
+
+constexpr size_t FREE_LIST_SIZE = SizeClass::kNumClasses; // 默认配置下自由链表的个数